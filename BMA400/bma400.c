@@ -39,6 +39,7 @@
 #include "bma400.h"
 #include "hardware.h"
 #include "i2c.h"
+#include "i2c_xfer.h"
 
 #define GRAVITY_EARTH (9.80665f) /* Earth's gravity in m/s^2 */
 
@@ -3405,7 +3406,7 @@ int8_t i2c_reg_write(uint8_t i2c_addr, uint8_t reg_addr, uint8_t *reg_data, uint
 
     /* Write to registers using I2C. Return 0 for a successful execution. */
 	 HAL_StatusTypeDef writeStatus;
-	    writeStatus = HAL_I2C_Mem_Write(&hi2c1, (i2c_addr<<1), reg_addr, I2C_MEMADD_SIZE_8BIT, reg_data, length, 1000);
+	    writeStatus = I2C_MemWrite((i2c_addr<<1), reg_addr, I2C_MEMADD_SIZE_8BIT, reg_data, length, 1000);
 	    if (writeStatus != HAL_OK)
 	    {
 	        return -1;
@@ -3418,7 +3419,7 @@ int8_t i2c_reg_read(uint8_t i2c_addr, uint8_t reg_addr, uint8_t *reg_data, uint1
 
     /* Read from registers using I2C. Return 0 for a successful execution. */
 	HAL_StatusTypeDef readStatus;
-		readStatus = HAL_I2C_Mem_Read(&hi2c1, (i2c_addr<<1), reg_addr,I2C_MEMADD_SIZE_8BIT, reg_data, length,1000);
+		readStatus = I2C_MemRead((i2c_addr<<1), reg_addr,I2C_MEMADD_SIZE_8BIT, reg_data, length,1000);
 		if(readStatus != HAL_OK)
 		{
 			return -1;
@@ -41,6 +41,7 @@
 #include "bme680.h"
 #include "hardware.h"
 #include "i2c.h"
+#include "i2c_xfer.h"
 
 /*!
  * @brief This internal API is used to read the calibrated data from the sensor.
@@ -1360,12 +1361,12 @@ static int8_t null_ptr_check(const struct bme680_dev *dev)
 }
 
 int8_t user_i2c_read(uint8_t id, uint8_t reg_addr, uint8_t *data, uint16_t len) {
-	return HAL_I2C_Mem_Read(&hi2c1, id << 1, reg_addr, I2C_MEMADD_SIZE_8BIT, data, len, 100) != HAL_OK ? BME680_E_COM_FAIL : BME680_OK;
+	return I2C_MemRead(id << 1, reg_addr, I2C_MEMADD_SIZE_8BIT, data, len, 100) != HAL_OK ? BME680_E_COM_FAIL : BME680_OK;
 }
 
 /*!
  * @brief This function for writing the sensor's registers through I2C bus.
  */
 int8_t user_i2c_write(uint8_t id, uint8_t reg_addr, uint8_t *data, uint16_t len) {
-    return HAL_I2C_Mem_Write(&hi2c1, id << 1, reg_addr, I2C_MEMADD_SIZE_8BIT, data, len, 100) != HAL_OK ? BME680_E_COM_FAIL : BME680_OK;
+    return I2C_MemWrite(id << 1, reg_addr, I2C_MEMADD_SIZE_8BIT, data, len, 100) != HAL_OK ? BME680_E_COM_FAIL : BME680_OK;
 }
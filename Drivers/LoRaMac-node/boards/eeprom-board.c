@@ -29,31 +29,17 @@
 
 LmnStatus_t EepromMcuWriteBuffer( uint16_t addr, uint8_t *buffer, uint16_t size )
 {
-    LmnStatus_t status = LMN_STATUS_ERROR;
-
     assert_param( ( EEPROM_LORA + addr ) >= EEPROM_LORA );
     assert_param( buffer != NULL );
     assert_param( size < ( EEPROM_LORA_END - EEPROM_LORA ) );
 
-    if( HAL_FLASHEx_DATAEEPROM_Unlock( ) == HAL_OK )
+    // Word granular, skips unchanged words and only blocks interrupts per word
+    if( HW_WriteEEPROM( ( void* )( EEPROM_LORA + addr ), buffer, size ) == false )
     {
-        CRITICAL_SECTION_BEGIN( );
-        for( uint16_t i = 0; i < size; i++ )
-        {
-            if( HAL_FLASHEx_DATAEEPROM_Program( FLASH_TYPEPROGRAMDATA_BYTE,
-                                                ( EEPROM_LORA + addr + i ),
-                                                  buffer[i] ) != HAL_OK )
-            {
-                // Failed to write EEPROM
-                break;
-            }
-        }
-        CRITICAL_SECTION_END( );
-        status = LMN_STATUS_OK;
+        // Failed to write EEPROM
+        return LMN_STATUS_ERROR;
     }
-
-    HAL_FLASHEx_DATAEEPROM_Lock( );
-    return status;
+    return LMN_STATUS_OK;
 }
 
 LmnStatus_t EepromMcuReadBuffer( uint16_t addr, uint8_t *buffer, uint16_t size )
@@ -39,9 +39,7 @@
 // MCU Wake Up Time
 #define MIN_ALARM_DELAY                             3 // in ticks
 
-// sub-second number of bits
-#define N_PREDIV_S                                  8
-// Synchronous prediv
+// Synchronous prediv, N_PREDIV_S sub-second bits see rtc-board.h
 #define PREDIV_S                                    ( ( 1 << N_PREDIV_S ) - 1 )
 
 // Asynchronous prediv
@@ -409,11 +407,27 @@ uint32_t RtcGetTimerElapsedTime( void )
   return( ( uint32_t )( calendarValue - RtcTimerContext.Time ) );
 }
 
+static uint32_t RtcGetCalendarDays( RTC_DateTypeDef* date )
+{
+    uint32_t days;
+    uint32_t correction;
+
+    // Calculte amount of elapsed days since 01/01/2000
+    days = DIVC( ( DAYS_IN_YEAR * 3 + DAYS_IN_LEAP_YEAR ) * date->Year , 4 );
+
+    correction = ( ( date->Year % 4 ) == 0 ) ? DAYS_IN_MONTH_CORRECTION_LEAP : DAYS_IN_MONTH_CORRECTION_NORM;
+
+    days += ( DIVC( ( date->Month-1 ) * ( 30 + 31 ), 2 ) - ( ( ( correction >> ( ( date->Month - 1 ) * 2 ) ) & 0x03 ) ) );
+
+    days += ( date->Date -1 );
+
+    return days;
+}
+
 static uint64_t RtcGetCalendarValue( RTC_DateTypeDef* date, RTC_TimeTypeDef* time )
 {
     uint64_t calendarValue = 0;
     uint32_t firstRead;
-    uint32_t correction;
     uint32_t seconds;
 
     // Make sure it is correct due to asynchronus nature of RTC
@@ -424,17 +438,8 @@ static uint64_t RtcGetCalendarValue( RTC_DateTypeDef* date, RTC_TimeTypeDef* tim
         HAL_RTC_GetTime( &hrtc, time, RTC_FORMAT_BIN );
     }while( firstRead != RTC->SSR );
 
-    // Calculte amount of elapsed days since 01/01/2000
-    seconds = DIVC( ( DAYS_IN_YEAR * 3 + DAYS_IN_LEAP_YEAR ) * date->Year , 4 );
-
-    correction = ( ( date->Year % 4 ) == 0 ) ? DAYS_IN_MONTH_CORRECTION_LEAP : DAYS_IN_MONTH_CORRECTION_NORM;
-
-    seconds += ( DIVC( ( date->Month-1 ) * ( 30 + 31 ), 2 ) - ( ( ( correction >> ( ( date->Month - 1 ) * 2 ) ) & 0x03 ) ) );
-
-    seconds += ( date->Date -1 );
-
     // Convert from days to seconds
-    seconds *= SECONDS_IN_1DAY;
+    seconds = RtcGetCalendarDays( date ) * SECONDS_IN_1DAY;
 
     seconds += ( ( uint32_t )time->Seconds + 
                  ( ( uint32_t )time->Minutes * SECONDS_IN_1MINUTE ) +
@@ -445,6 +450,58 @@ static uint64_t RtcGetCalendarValue( RTC_DateTypeDef* date, RTC_TimeTypeDef* tim
     return( calendarValue );
 }
 
+uint64_t RtcGetTicks( void )
+{
+    static uint32_t cachedDate = UINT32_MAX;
+    static uint32_t cachedSeconds;
+    static uint64_t lastTicks;
+    static uint64_t wrapTicks;
+    RTC_DateTypeDef date;
+    uint32_t ssr;
+    uint32_t tr;
+    uint32_t dr;
+    uint32_t seconds;
+    uint64_t ticks;
+
+    CRITICAL_SECTION_BEGIN( );
+
+    // Registers are read directly (bypass shadow), SSR unchanged means TR and DR are consistent
+    do
+    {
+        ssr = RTC->SSR;
+        tr = RTC->TR;
+        dr = RTC->DR;
+    }while( ssr != RTC->SSR );
+
+    // The day count only changes at midnight
+    if( dr != cachedDate )
+    {
+        date.Year = RTC_Bcd2ToByte( ( dr & ( RTC_DR_YT | RTC_DR_YU ) ) >> RTC_DR_YU_Pos );
+        date.Month = RTC_Bcd2ToByte( ( dr & ( RTC_DR_MT | RTC_DR_MU ) ) >> RTC_DR_MU_Pos );
+        date.Date = RTC_Bcd2ToByte( ( dr & ( RTC_DR_DT | RTC_DR_DU ) ) >> RTC_DR_DU_Pos );
+        cachedSeconds = RtcGetCalendarDays( &date ) * SECONDS_IN_1DAY;
+        cachedDate = dr;
+    }
+
+    seconds = cachedSeconds +
+              RTC_Bcd2ToByte( ( tr & ( RTC_TR_ST | RTC_TR_SU ) ) >> RTC_TR_SU_Pos ) +
+              RTC_Bcd2ToByte( ( tr & ( RTC_TR_MNT | RTC_TR_MNU ) ) >> RTC_TR_MNU_Pos ) * SECONDS_IN_1MINUTE +
+              RTC_Bcd2ToByte( ( tr & ( RTC_TR_HT | RTC_TR_HU ) ) >> RTC_TR_HU_Pos ) * SECONDS_IN_1HOUR;
+
+    ticks = ( ( ( uint64_t )seconds ) << N_PREDIV_S ) + ( PREDIV_S - ssr );
+
+    // Calendar rolls over after year 99, extend it
+    if( ticks + wrapTicks < lastTicks )
+    {
+        wrapTicks += ( uint64_t )( DAYS_IN_YEAR * 75 + DAYS_IN_LEAP_YEAR * 25 ) * SECONDS_IN_1DAY << N_PREDIV_S;
+    }
+    lastTicks = ticks + wrapTicks;
+
+    CRITICAL_SECTION_END( );
+
+    return lastTicks;
+}
+
 uint32_t RtcGetCalendarTime( uint16_t *milliseconds )
 {
     RTC_TimeTypeDef time ;
@@ -486,6 +543,16 @@ void RTC_IRQHandler( void )
             HAL_RTC_AlarmAEventCallback( &hrtc );
         }
     }
+
+    // AlarmB wakes HW_StopUntil, same handling as AlarmA
+    if( __HAL_RTC_ALARM_GET_IT_SOURCE( &hrtc, RTC_IT_ALRB ) != RESET )
+    {
+        if( __HAL_RTC_ALARM_GET_FLAG( &hrtc, RTC_FLAG_ALRBF ) != RESET )
+        {
+            __HAL_RTC_ALARM_CLEAR_FLAG( &hrtc, RTC_FLAG_ALRBF );
+            HAL_RTCEx_AlarmBEventCallback( &hrtc );
+        }
+    }
     HAL_RTCEx_WakeUpTimerIRQHandler(&hrtc);
 }
 
@@ -52,6 +52,11 @@ extern "C"
  */
 #define RTC_TEMP_DEV_TURNOVER                           ( 5.0f )
 
+/*!
+ * \brief Sub-second number of bits, ticks are 1 / ( 1 << N_PREDIV_S ) s
+ */
+#define N_PREDIV_S                                      8
+
 /*!
  * \brief Initializes the RTC timer
  *
@@ -134,6 +139,16 @@ uint32_t RtcGetTimerContext( void );
  */
 uint32_t RtcGetCalendarTime( uint16_t *milliseconds );
 
+/*!
+ * \brief Gets a monotonic time in ticks (1 << N_PREDIV_S per second) since RtcInit
+ *
+ * \remark Cheaper than RtcGetCalendarTime, the day count is cached and the
+ *         calendar roll over is extended.
+ *
+ * \retval ticks Number of ticks elapsed since RtcInit
+ */
+uint64_t RtcGetTicks( void );
+
 /*!
  * \brief Get the RTC timer value
  *
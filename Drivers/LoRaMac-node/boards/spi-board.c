@@ -26,11 +26,17 @@
 #include "system/gpio.h"
 #include "spi-board.h"
 #include <stdlib.h>
+#include <string.h>
 #include "spi.h"
 #include "system/spi.h"
 
 extern SPI_HandleTypeDef hspi1;
 
+/*!
+ * Below this many bytes, DMA setup costs more than polling the bytes out
+ */
+#define SPI_DMA_MIN_SIZE                            16
+
 void SpiInit( Spi_t *obj, SpiId_t spiId, PinNames mosi, PinNames miso, PinNames sclk, PinNames nss )
 {
     CRITICAL_SECTION_BEGIN( );
@@ -138,3 +144,72 @@ uint16_t SpiInOut(Spi_t *obj, uint16_t outData) {
     return rxData;
 }
 
+static void SpiInOutPolled( const uint8_t *txBuffer, uint8_t *rxBuffer, uint16_t size )
+{
+    uint8_t rxData;
+
+    __HAL_SPI_ENABLE( &hspi1 );
+
+    for( uint16_t i = 0; i < size; i++ )
+    {
+        while( __HAL_SPI_GET_FLAG( &hspi1, SPI_FLAG_TXE ) == RESET );
+        hspi1.Instance->DR = ( txBuffer != NULL ) ? txBuffer[i] : 0;
+
+        while( __HAL_SPI_GET_FLAG( &hspi1, SPI_FLAG_RXNE ) == RESET );
+        rxData = ( uint8_t )hspi1.Instance->DR;
+
+        if( rxBuffer != NULL )
+        {
+            rxBuffer[i] = rxData;
+        }
+    }
+}
+
+void SpiInOutBurst( Spi_t *obj, const uint8_t *txBuffer, uint8_t *rxBuffer, uint16_t size )
+{
+    HAL_StatusTypeDef status;
+
+    if( obj == NULL || hspi1.Instance == NULL )
+    {
+        assert_param( LMN_STATUS_ERROR );
+    }
+
+    // The DMA completion interrupt can't preempt us, poll instead
+    if( size < SPI_DMA_MIN_SIZE || hspi1.hdmatx == NULL || __get_PRIMASK( ) != 0 || __get_IPSR( ) != 0 )
+    {
+        SpiInOutPolled( txBuffer, rxBuffer, size );
+        return;
+    }
+
+    if( rxBuffer == NULL )
+    {
+        status = HAL_SPI_Transmit_DMA( &hspi1, ( uint8_t* )txBuffer, size );
+    }
+    else if( txBuffer == NULL )
+    {
+        // Each byte is sent before its slot is received, so clock out the zeroed rxBuffer
+        memset( rxBuffer, 0, size );
+        status = HAL_SPI_TransmitReceive_DMA( &hspi1, rxBuffer, rxBuffer, size );
+    }
+    else
+    {
+        status = HAL_SPI_TransmitReceive_DMA( &hspi1, ( uint8_t* )txBuffer, rxBuffer, size );
+    }
+
+    if( status != HAL_OK )
+    {
+        SpiInOutPolled( txBuffer, rxBuffer, size );
+        return;
+    }
+
+    // Sleep until the DMA completion callback marks the handle ready.
+    // WFI wakes on the pending interrupt even with PRIMASK set, closing the race.
+    __disable_irq( );
+    while( hspi1.State != HAL_SPI_STATE_READY )
+    {
+        __WFI( );
+        __enable_irq( );
+        __disable_irq( );
+    }
+    __enable_irq( );
+}
@@ -21,6 +21,7 @@
  * \author    Gregory Cristian ( Semtech )
  */
 #include <stdlib.h>
+#include "stm32l0xx_hal.h"
 #include "utilities.h"
 #include "boards/board-config.h"
 #include "boards/board.h"
@@ -49,6 +50,43 @@ static void SX126xDbgPinRxWrite( uint8_t state );
  */
 static RadioOperatingModes_t OperatingMode;
 
+SX126xBusyStats_t SX126xBusyStats;
+
+/*!
+ * \brief Routes the BUSY line falling edge to the event input, so WFE wakes on it.
+ *        No interrupt is raised. HAL_GPIO_Init of the plain input leaves EXTI alone.
+ */
+static void SX126xBusyEventInit( void )
+{
+    static bool initialized = false;
+
+    if( initialized == false )
+    {
+        __HAL_RCC_SYSCFG_CLK_ENABLE( );
+        MODIFY_REG( SYSCFG->EXTICR[2], SYSCFG_EXTICR3_EXTI11, SYSCFG_EXTICR3_EXTI11_PA );
+        EXTI->FTSR |= EXTI_FTSR_FT11;
+        EXTI->EMR |= EXTI_EMR_EM11;
+        initialized = true;
+    }
+}
+
+/*!
+ * \brief Microseconds from SysTick, which keeps running in Sleep mode
+ */
+static uint32_t SX126xGetUs( void )
+{
+    uint32_t ms;
+    uint32_t val;
+
+    do
+    {
+        ms = HAL_GetTick( );
+        val = SysTick->VAL;
+    }while( ms != HAL_GetTick( ) );
+
+    return ms * 1000 + ( SysTick->LOAD - val ) * 1000 / ( SysTick->LOAD + 1 );
+}
+
 void SX126xIoInit( void )
 {
     //GpioInit( &SX126x.Spi.Nss, RADIO_NSS, PIN_OUTPUT, PIN_PUSH_PULL, PIN_NO_PULL, 1 );
@@ -116,7 +154,45 @@ void SX126xReset( void )
 
 void SX126xWaitOnBusy( void )
 {
-    while( GpioRead( &SX126x.BUSY ) == 1 );
+    uint32_t start;
+    uint32_t elapsed;
+
+    if( GpioRead( &SX126x.BUSY ) == 0 )
+    {
+        SX126xBusyStats.LastUs = 0;
+        return;
+    }
+
+    // SysTick can't advance, nothing to time against
+    if( __get_PRIMASK( ) != 0 )
+    {
+        while( GpioRead( &SX126x.BUSY ) == 1 );
+        return;
+    }
+
+    SX126xBusyEventInit( );
+    SX126xBusyStats.Waits++;
+    start = SX126xGetUs( );
+
+    // A fall between the read and WFE latches the event, so WFE returns right away
+    while( GpioRead( &SX126x.BUSY ) == 1 )
+    {
+        if( SX126xGetUs( ) - start >= SX126X_BUSY_TIMEOUT_MS * 1000 )
+        {
+            SX126xBusyStats.Timeouts++;
+            break;
+        }
+        __WFE( );
+    }
+    EXTI->PR = EXTI_PR_PIF11;
+
+    elapsed = SX126xGetUs( ) - start;
+    SX126xBusyStats.LastUs = elapsed;
+    if( elapsed > SX126xBusyStats.MaxUs )
+    {
+        SX126xBusyStats.MaxUs = elapsed;
+        SX126xBusyStats.MaxOpcode = SX126xBusyStats.LastOpcode;
+    }
 }
 
 void SX126xWakeup( void )
@@ -130,13 +206,15 @@ void SX126xWakeup( void )
 
     GpioWrite( &SX126x.Spi.Nss, 1 );
 
-    // Wait for chip to be ready.
-    SX126xWaitOnBusy( );
-
     // Update operating mode context variable
     SX126xSetOperatingMode( MODE_STDBY_RC );
 
     CRITICAL_SECTION_END( );
+
+    // Wait for chip to be ready, outside the critical section so the core can sleep.
+    // Concurrent commands wait on BUSY as well.
+    SX126xBusyStats.LastOpcode = RADIO_GET_STATUS;
+    SX126xWaitOnBusy( );
 }
 
 void SX126xWriteCommand( RadioCommands_t command, uint8_t *buffer, uint16_t size )
@@ -146,14 +224,11 @@ void SX126xWriteCommand( RadioCommands_t command, uint8_t *buffer, uint16_t size
     GpioWrite( &SX126x.Spi.Nss, 0 );
 
     SpiInOut( &SX126x.Spi, ( uint8_t )command );
-
-    for( uint16_t i = 0; i < size; i++ )
-    {
-        SpiInOut( &SX126x.Spi, buffer[i] );
-    }
+    SpiInOutBurst( &SX126x.Spi, buffer, NULL, size );
 
     GpioWrite( &SX126x.Spi.Nss, 1 );
 
+    SX126xBusyStats.LastOpcode = command;
     if( command != RADIO_SET_SLEEP )
     {
         SX126xWaitOnBusy( );
@@ -170,13 +245,11 @@ uint8_t SX126xReadCommand( RadioCommands_t command, uint8_t *buffer, uint16_t si
 
     SpiInOut( &SX126x.Spi, ( uint8_t )command );
     status = SpiInOut( &SX126x.Spi, 0x00 );
-    for( uint16_t i = 0; i < size; i++ )
-    {
-        buffer[i] = SpiInOut( &SX126x.Spi, 0 );
-    }
+    SpiInOutBurst( &SX126x.Spi, NULL, buffer, size );
 
     GpioWrite( &SX126x.Spi.Nss, 1 );
 
+    SX126xBusyStats.LastOpcode = command;
     SX126xWaitOnBusy( );
 
     return status;
@@ -191,14 +264,11 @@ void SX126xWriteRegisters( uint16_t address, uint8_t *buffer, uint16_t size )
     SpiInOut( &SX126x.Spi, RADIO_WRITE_REGISTER );
     SpiInOut( &SX126x.Spi, ( address & 0xFF00 ) >> 8 );
     SpiInOut( &SX126x.Spi, address & 0x00FF );
-    
-    for( uint16_t i = 0; i < size; i++ )
-    {
-        SpiInOut( &SX126x.Spi, buffer[i] );
-    }
+    SpiInOutBurst( &SX126x.Spi, buffer, NULL, size );
 
     GpioWrite( &SX126x.Spi.Nss, 1 );
 
+    SX126xBusyStats.LastOpcode = RADIO_WRITE_REGISTER;
     SX126xWaitOnBusy( );
 }
 
@@ -217,12 +287,10 @@ void SX126xReadRegisters( uint16_t address, uint8_t *buffer, uint16_t size )
     SpiInOut( &SX126x.Spi, ( address & 0xFF00 ) >> 8 );
     SpiInOut( &SX126x.Spi, address & 0x00FF );
     SpiInOut( &SX126x.Spi, 0 );
-    for( uint16_t i = 0; i < size; i++ )
-    {
-        buffer[i] = SpiInOut( &SX126x.Spi, 0 );
-    }
+    SpiInOutBurst( &SX126x.Spi, NULL, buffer, size );
     GpioWrite( &SX126x.Spi.Nss, 1 );
 
+    SX126xBusyStats.LastOpcode = RADIO_READ_REGISTER;
     SX126xWaitOnBusy( );
 }
 
@@ -241,12 +309,10 @@ void SX126xWriteBuffer( uint8_t offset, uint8_t *buffer, uint8_t size )
 
     SpiInOut( &SX126x.Spi, RADIO_WRITE_BUFFER );
     SpiInOut( &SX126x.Spi, offset );
-    for( uint16_t i = 0; i < size; i++ )
-    {
-        SpiInOut( &SX126x.Spi, buffer[i] );
-    }
+    SpiInOutBurst( &SX126x.Spi, buffer, NULL, size );
     GpioWrite( &SX126x.Spi.Nss, 1 );
 
+    SX126xBusyStats.LastOpcode = RADIO_WRITE_BUFFER;
     SX126xWaitOnBusy( );
 }
 
@@ -259,12 +325,10 @@ void SX126xReadBuffer( uint8_t offset, uint8_t *buffer, uint8_t size )
     SpiInOut( &SX126x.Spi, RADIO_READ_BUFFER );
     SpiInOut( &SX126x.Spi, offset );
     SpiInOut( &SX126x.Spi, 0 );
-    for( uint16_t i = 0; i < size; i++ )
-    {
-        buffer[i] = SpiInOut( &SX126x.Spi, 0 );
-    }
+    SpiInOutBurst( &SX126x.Spi, NULL, buffer, size );
     GpioWrite( &SX126x.Spi.Nss, 1 );
 
+    SX126xBusyStats.LastOpcode = RADIO_READ_BUFFER;
     SX126xWaitOnBusy( );
 }
 
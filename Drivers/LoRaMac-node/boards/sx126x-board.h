@@ -32,6 +32,27 @@ extern "C"
 #include <stdbool.h>
 #include "sx126x.h"
 
+/*!
+ * \brief Longest wait on BUSY before the command is given up on, calibration
+ *        and wakeup from cold sleep stay below 4 ms
+ */
+#define SX126X_BUSY_TIMEOUT_MS                      20
+
+/*!
+ * \brief Radio command latency, i.e. BUSY high time after NSS rises
+ */
+typedef struct SX126xBusyStats_s
+{
+    uint32_t Waits;                                 //!< Commands that found BUSY high
+    uint32_t Timeouts;                              //!< Waits abandoned after SX126X_BUSY_TIMEOUT_MS
+    uint32_t LastUs;                                //!< Latency of the last command [us]
+    uint32_t MaxUs;                                 //!< Worst latency observed [us]
+    uint8_t  LastOpcode;                            //!< Opcode of the last command
+    uint8_t  MaxOpcode;                             //!< Opcode of the worst latency
+}SX126xBusyStats_t;
+
+extern SX126xBusyStats_t SX126xBusyStats;
+
 /*!
  * \brief Initializes the radio I/Os pins interface
  */
@@ -72,7 +93,10 @@ void SX126xIoDbgInit( void );
 void SX126xReset( void );
 
 /*!
- * \brief Blocking loop to wait while the Busy pin in high
+ * \brief Sleeps until the Busy pin falls, or SX126X_BUSY_TIMEOUT_MS
+ *
+ * \remark The core waits in WFE on an EXTI event of the BUSY line, and
+ *         SX126xBusyStats is updated.
  */
 void SX126xWaitOnBusy( void );
 
@@ -32,10 +32,12 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include "utilities.h"
 #include "system/nvmm.h"
 #include "LoRaMac.h"
 #include "NvmDataMgmt.h"
+#include "hardware.h"
 
 /*!
  * Enables/Disables the context storage management storage.
@@ -46,13 +48,227 @@
 #endif
 
 
+/*!
+ * Groups holding the frame counters. These are served by the journal as long
+ * as nothing but the counters changed.
+ */
+#define NVM_FCNT_JOURNAL_GROUPS            ( LORAMAC_NVM_NOTIFY_FLAG_CRYPTO | \
+                                             LORAMAC_NVM_NOTIFY_FLAG_MAC_GROUP1 )
+
+/*!
+ * Journal location, relative to the start of the NVM context.
+ */
+#define NVM_FCNT_JOURNAL_OFFSET            ( EEPROM_LORA_FCNT - EEPROM_LORA )
+
+/*!
+ * Number of journal slots.
+ */
+#define NVM_FCNT_JOURNAL_SLOTS             ( ( EEPROM_LORA_END - EEPROM_LORA_FCNT ) / \
+                                             sizeof( NvmFCntJournalEntry_t ) )
+
+/*!
+ * Frame counter journal entry.
+ *
+ * Entries are appended round robin, the valid entry with the highest Seq wins.
+ * An entry only applies to the Crypto/MacGroup1 image it was written against,
+ * identified by BaseCrc32. Rewriting the groups therefore compacts the journal
+ * without having to erase it.
+ */
+typedef struct sNvmFCntJournalEntry
+{
+    /*!
+     * Monotonic sequence number
+     */
+    uint32_t Seq;
+    /*!
+     * Crypto.Crc32 ^ MacGroup1.Crc32 of the stored groups
+     */
+    uint32_t BaseCrc32;
+    /*!
+     * Crypto counters
+     */
+    uint32_t FCntUp;
+    uint32_t NFCntDown;
+    uint32_t AFCntDown;
+    uint32_t FCntDown;
+    uint32_t LastDownFCnt;
+    /*!
+     * MacGroup1 counters
+     */
+    uint32_t AdrAckCounter;
+    TimerTime_t LastTxDoneTime;
+    TimerTime_t AggregatedTimeOff;
+    uint32_t LastRxMic;
+    /*!
+     * CRC32 value of the entry
+     */
+    uint32_t Crc32;
+}NvmFCntJournalEntry_t;
+
 static uint16_t NvmNotifyFlags = 0;
 
+/*!
+ * Slot and sequence number of the most recent journal entry. Seq 0 means the
+ * journal was not scanned yet.
+ */
+static uint16_t NvmFCntJournalSlot = 0;
+static uint32_t NvmFCntJournalSeq = 0;
+
+static void NvmFCntJournalFromGroups( NvmFCntJournalEntry_t* entry,
+                                      LoRaMacCryptoNvmData_t* crypto,
+                                      LoRaMacNvmDataGroup1_t* macGroup1 )
+{
+    entry->FCntUp = crypto->FCntList.FCntUp;
+    entry->NFCntDown = crypto->FCntList.NFCntDown;
+    entry->AFCntDown = crypto->FCntList.AFCntDown;
+    entry->FCntDown = crypto->FCntList.FCntDown;
+    entry->LastDownFCnt = crypto->LastDownFCnt;
+    entry->AdrAckCounter = macGroup1->AdrAckCounter;
+    entry->LastTxDoneTime = macGroup1->LastTxDoneTime;
+    entry->AggregatedTimeOff = macGroup1->AggregatedTimeOff;
+    entry->LastRxMic = macGroup1->LastRxMic;
+}
+
+static void NvmFCntJournalToGroups( NvmFCntJournalEntry_t* entry,
+                                    LoRaMacCryptoNvmData_t* crypto,
+                                    LoRaMacNvmDataGroup1_t* macGroup1 )
+{
+    crypto->FCntList.FCntUp = entry->FCntUp;
+    crypto->FCntList.NFCntDown = entry->NFCntDown;
+    crypto->FCntList.AFCntDown = entry->AFCntDown;
+    crypto->FCntList.FCntDown = entry->FCntDown;
+    crypto->LastDownFCnt = entry->LastDownFCnt;
+    macGroup1->AdrAckCounter = entry->AdrAckCounter;
+    macGroup1->LastTxDoneTime = entry->LastTxDoneTime;
+    macGroup1->AggregatedTimeOff = entry->AggregatedTimeOff;
+    macGroup1->LastRxMic = entry->LastRxMic;
+}
+
+/*!
+ * \brief Reads the Crypto and MacGroup1 groups as stored in NVM.
+ *
+ * \retval Crypto.Crc32 ^ MacGroup1.Crc32 of the stored groups.
+ */
+static uint32_t NvmFCntJournalReadBase( LoRaMacCryptoNvmData_t* crypto,
+                                        LoRaMacNvmDataGroup1_t* macGroup1 )
+{
+    NvmmRead( ( uint8_t* ) crypto, sizeof( LoRaMacCryptoNvmData_t ), 0 );
+    NvmmRead( ( uint8_t* ) macGroup1, sizeof( LoRaMacNvmDataGroup1_t ),
+              sizeof( LoRaMacCryptoNvmData_t ) );
+    return crypto->Crc32 ^ macGroup1->Crc32;
+}
+
+/*!
+ * \brief Finds the most recent valid journal entry.
+ *
+ * \param [OUT] entry Latest entry, if any.
+ *
+ * \retval Returns true, if a valid entry was found.
+ */
+static bool NvmFCntJournalScan( NvmFCntJournalEntry_t* entry )
+{
+    NvmFCntJournalEntry_t slot;
+    bool found = false;
+
+    NvmFCntJournalSlot = NVM_FCNT_JOURNAL_SLOTS - 1;
+    NvmFCntJournalSeq = 0;
+
+    for( uint16_t i = 0; i < NVM_FCNT_JOURNAL_SLOTS; i++ )
+    {
+        NvmmRead( ( uint8_t* ) &slot, sizeof( slot ),
+                  NVM_FCNT_JOURNAL_OFFSET + i * sizeof( slot ) );
+        if( Crc32( ( uint8_t* ) &slot, sizeof( slot ) - sizeof( slot.Crc32 ) ) != slot.Crc32 ||
+            slot.Seq <= NvmFCntJournalSeq )
+        {
+            continue;
+        }
+        NvmFCntJournalSlot = i;
+        NvmFCntJournalSeq = slot.Seq;
+        *entry = slot;
+        found = true;
+    }
+    return found;
+}
+
+/*!
+ * \brief Checks whether the pending Crypto/MacGroup1 changes are limited to
+ *        the journalled counters.
+ */
+static bool NvmFCntJournalCountersOnly( LoRaMacNvmData_t* nvm, uint16_t notifyFlags )
+{
+    LoRaMacCryptoNvmData_t crypto;
+    LoRaMacNvmDataGroup1_t macGroup1;
+    NvmFCntJournalEntry_t entry;
+
+    if( ( notifyFlags & NVM_FCNT_JOURNAL_GROUPS ) == 0 )
+    {
+        return false;
+    }
+
+    // Fold the live counters into the stored groups, then whatever differs
+    // is not a counter.
+    NvmFCntJournalReadBase( &crypto, &macGroup1 );
+    NvmFCntJournalFromGroups( &entry, &nvm->Crypto, &nvm->MacGroup1 );
+    NvmFCntJournalToGroups( &entry, &crypto, &macGroup1 );
+
+    return memcmp( &crypto, &nvm->Crypto, sizeof( crypto ) - sizeof( crypto.Crc32 ) ) == 0 &&
+           memcmp( &macGroup1, &nvm->MacGroup1, sizeof( macGroup1 ) - sizeof( macGroup1.Crc32 ) ) == 0;
+}
+
+/*!
+ * \brief Appends the live counters to the journal.
+ *
+ * \retval Number of bytes which were stored.
+ */
+static uint16_t NvmFCntJournalAppend( LoRaMacNvmData_t* nvm )
+{
+    LoRaMacCryptoNvmData_t crypto;
+    LoRaMacNvmDataGroup1_t macGroup1;
+    NvmFCntJournalEntry_t entry;
+    NvmFCntJournalEntry_t latest;
+
+    if( NvmFCntJournalSeq == 0 )
+    {
+        NvmFCntJournalScan( &latest );
+    }
+
+    entry.Seq = NvmFCntJournalSeq + 1;
+    entry.BaseCrc32 = NvmFCntJournalReadBase( &crypto, &macGroup1 );
+    NvmFCntJournalFromGroups( &entry, &nvm->Crypto, &nvm->MacGroup1 );
+    entry.Crc32 = Crc32( ( uint8_t* ) &entry, sizeof( entry ) - sizeof( entry.Crc32 ) );
+
+    NvmFCntJournalSlot = ( NvmFCntJournalSlot + 1 ) % NVM_FCNT_JOURNAL_SLOTS;
+    if( NvmmWrite( ( uint8_t* ) &entry, sizeof( entry ),
+                   NVM_FCNT_JOURNAL_OFFSET + NvmFCntJournalSlot * sizeof( entry ) ) != sizeof( entry ) )
+    {
+        return 0;
+    }
+    NvmFCntJournalSeq = entry.Seq;
+    return sizeof( entry );
+}
+
 void NvmDataMgmtEvent( uint16_t notifyFlags )
 {
     NvmNotifyFlags = notifyFlags;
 }
 
+bool NvmDataMgmtCountersOnly( uint16_t notifyFlags )
+{
+#if( CONTEXT_MANAGEMENT_ENABLED == 1 )
+    MibRequestConfirm_t mibReq;
+    mibReq.Type = MIB_NVM_CTXS;
+    LoRaMacMibGetRequestConfirm( &mibReq );
+
+    if( ( notifyFlags & ~NVM_FCNT_JOURNAL_GROUPS ) != 0 )
+    {
+        return false;
+    }
+    return NvmFCntJournalCountersOnly( mibReq.Param.Contexts, notifyFlags );
+#else
+    return false;
+#endif
+}
+
 uint16_t NvmDataMgmtStore( void )
 {
 #if( CONTEXT_MANAGEMENT_ENABLED == 1 )
@@ -74,6 +290,19 @@ uint16_t NvmDataMgmtStore( void )
         return 0;
     }
 
+    // Frame counters
+    if( NvmFCntJournalCountersOnly( nvm, NvmNotifyFlags ) == true )
+    {
+        dataSize += NvmFCntJournalAppend( nvm );
+        NvmNotifyFlags &= ~NVM_FCNT_JOURNAL_GROUPS;
+    }
+    else if( ( NvmNotifyFlags & NVM_FCNT_JOURNAL_GROUPS ) != 0 )
+    {
+        // Compaction, both groups take up the counters and thereby
+        // invalidate the journal.
+        NvmNotifyFlags |= NVM_FCNT_JOURNAL_GROUPS;
+    }
+
     // Crypto
     if( ( NvmNotifyFlags & LORAMAC_NVM_NOTIFY_FLAG_CRYPTO ) ==
         LORAMAC_NVM_NOTIFY_FLAG_CRYPTO )
@@ -209,6 +438,18 @@ uint16_t NvmDataMgmtRestore( void )
     if( NvmmRead( ( uint8_t* ) nvm, sizeof( LoRaMacNvmData_t ), 0 ) ==
                   sizeof( LoRaMacNvmData_t ) )
     {
+        NvmFCntJournalEntry_t entry;
+
+        // Frame counters
+        if( NvmFCntJournalScan( &entry ) == true &&
+            entry.BaseCrc32 == ( nvm->Crypto.Crc32 ^ nvm->MacGroup1.Crc32 ) )
+        {
+            NvmFCntJournalToGroups( &entry, &nvm->Crypto, &nvm->MacGroup1 );
+            nvm->Crypto.Crc32 = Crc32( ( uint8_t* ) &nvm->Crypto, sizeof( nvm->Crypto ) -
+                                                                  sizeof( nvm->Crypto.Crc32 ) );
+            nvm->MacGroup1.Crc32 = Crc32( ( uint8_t* ) &nvm->MacGroup1, sizeof( nvm->MacGroup1 ) -
+                                                                        sizeof( nvm->MacGroup1.Crc32 ) );
+        }
         return sizeof( LoRaMacNvmData_t );
     }
 #endif
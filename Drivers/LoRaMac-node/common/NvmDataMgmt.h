@@ -49,6 +49,17 @@ extern "C" {
  */
 void NvmDataMgmtEvent( uint16_t notifyFlags );
 
+/*!
+ * \brief Checks whether a NVM Management event only concerns the frame
+ *        counters, which are stored by the journal.
+ *
+ * \param [IN] notifyFlags Bitmap which contains the information about modules that
+ *                         changed.
+ *
+ * \retval Returns true, if no NVM group needs to be rewritten.
+ */
+bool NvmDataMgmtCountersOnly( uint16_t notifyFlags );
+
 /*!
  * \brief Function which stores the MAC data into NVM, if required.
  *
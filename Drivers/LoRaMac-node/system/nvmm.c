@@ -49,7 +49,7 @@ uint16_t NvmmRead( uint8_t* dest, uint16_t size, uint16_t offset )
 
 bool NvmmCrc32Check( uint16_t size, uint16_t offset )
 {
-    uint8_t data = 0;
+    uint8_t data[64];
     uint32_t calculatedCrc32 = 0;
     uint32_t readCrc32 = 0;
 
@@ -58,13 +58,15 @@ bool NvmmCrc32Check( uint16_t size, uint16_t offset )
     {
         // Calculate crc
         calculatedCrc32 = Crc32Init( );
-        for( uint16_t i = 0; i < ( size - sizeof( readCrc32 ) ); i++ )
+        for( uint16_t i = 0; i < ( size - sizeof( readCrc32 ) ); i += sizeof( data ) )
         {
-            if( NvmmRead( &data, 1, offset + i ) != 1 )
+            uint16_t chunk = MIN( sizeof( data ), size - sizeof( readCrc32 ) - i );
+
+            if( NvmmRead( data, chunk, offset + i ) != chunk )
             {
                 return false;
             }
-            calculatedCrc32 = Crc32Update( calculatedCrc32, &data, 1 );
+            calculatedCrc32 = Crc32Update( calculatedCrc32, data, chunk );
         }
         calculatedCrc32 = Crc32Finalize( calculatedCrc32 );
 
@@ -95,6 +95,20 @@ void SpiFrequency( Spi_t *obj, uint32_t hz );
  */
 uint16_t SpiInOut( Spi_t *obj, uint16_t outData );
 
+/*!
+ * \brief Sends and receives a buffer in one burst
+ *
+ * \remark Transfers of at least SPI_DMA_MIN_SIZE bytes go through DMA while
+ *         the CPU sleeps. Shorter ones, and calls from interrupt context or
+ *         with interrupts masked, are polled.
+ *
+ * \param [IN] obj       SPI object
+ * \param [IN] txBuffer  Data to send, NULL sends zeros (NOP)
+ * \param [OUT] rxBuffer Received data, NULL discards it
+ * \param [IN] size      Number of bytes to transfer
+ */
+void SpiInOutBurst( Spi_t *obj, const uint8_t *txBuffer, uint8_t *rxBuffer, uint16_t size );
+
 #ifdef __cplusplus
 }
 #endif
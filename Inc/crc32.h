@@ -0,0 +1,31 @@
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __CRC32_H
+#define __CRC32_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stddef.h>
+#include <stdint.h>
+
+/* Exported functions ------------------------------------------------------- */
+/*
+ * DESCRIPTION
+ *        CRC-32 (CCITT 0x04C11DB7, reflected, as in Ethernet/zlib). Use as:
+ *
+ *            crc = CRC32_Finalize(CRC32_Update(CRC32_INIT, buf, len));
+ *
+ *        Backed by the CRC peripheral, or a slicing-by-4 table when the
+ *        peripheral is in use (e.g. CRC requested from interrupt context).
+ */
+#define CRC32_INIT  ((uint32_t)0xFFFFFFFF)
+
+uint32_t CRC32_Update(uint32_t crc, const void *buf, size_t len);
+uint32_t CRC32_UpdateSW(uint32_t crc, const void *buf, size_t len);
+#define CRC32_Finalize(crc)  (~(uint32_t)(crc))
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __CRC32_H */
@@ -37,6 +37,7 @@ struct DeviceConfig {
     unsigned hdc2080 :1;
     unsigned sfh7776 :1;
     unsigned resched :1;
+    unsigned history :1;
   } changed;
 
   /*******************************************/
@@ -66,21 +67,30 @@ struct DeviceConfig {
   uint32_t                sendInterval;            // rw-- 21: uint32_t  Send interval of LoRa Messages
   enum Send_Trigger       sendTrigger;             // rw-- 22: uint32_t  Send Trigger
   enum Send_Strategy      sendStrategy;            // rw-- 23: uint32_t  Send Strategy
+#ifdef HISTORY
+  uint32_t                history_interval;        // rw-- 36: uint32_t  Sampling interval of on-device history, 0 disables
+#endif
 
 #if defined(STX)
   /*******************************************/
   /*             STX Multi Sensor            */
   /*******************************************/
-  enum HDC2080_Threshold  hdc2080_mode;            // rw-- 24:  int32_t  Send LoRa Message on humidity upper threshold
+  int32_t                 hdc2080_threshold[4];    // rw-- 24:  int32_t  Send LoRa Message on humidity upper threshold
                                                    // rw-- 25:  int32_t  Send LoRa Message on humidity lower threshold
                                                    // rw-- 26:  int32_t  Send LoRa Message on temperature upper threshold
                                                    // rw-- 27:  int32_t  Send LoRa Message on temperature lower threshold
-  int32_t                 hdc2080_threshold;       // case humidity:    n / 1000 = 5 %rH
+                                                   // Indexed by enum HDC2080_Threshold
+                                                   // case humidity:    n        = 5 %rH
                                                    // case temperature: n /  100 = -22.23 C
+  uint8_t                 hdc2080_windows;         // HDC2080_WINDOW bits of thresholds in use
+  uint32_t                hdc2080_config;          // rw-- 34: uint32_t  Measurement rate and window hysteresis
   uint32_t                bma400_threshold;        // rw-- 30: uint32_t  Send LoRa Message on axis acceleration above threshold
   uint16_t                bma400_config;           // rw-- 31: uint16_t  Send LoRa Message on axis acceleration configuration
+  uint32_t                bma400_events;           // rw-- 32: uint32_t  Send LoRa Message on orientation, activity and steps
   uint16_t                sfh7776_threshold_upper; // rw-- 28: uint16_t  Send LoRa Message on luminance upper threshold
   uint16_t                sfh7776_threshold_lower; // rw-- 29: uint16_t  Send LoRa Message on luminance lower threshold
+  struct SFH7776_Band     sfh7776_cal[SFH7776_BANDS]; // rw-- 33: char[36]  Luminance calibration of housing or cover
+  uint32_t                event_limit;             // rw-- 35: uint32_t  Event rate limit and luminance hysteresis, LRW_LIMIT_*
   struct {
     unsigned bma400  :1;
     unsigned sfh7776 :1;
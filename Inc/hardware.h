@@ -45,6 +45,20 @@ enum WakeUpReason {
   WAKEUP_LRW_SCHEDMSG,
   WAKEUP_LRW_DUTYCYCLE,
   WAKEUP_BSEC_SAMPLE,
+  WAKEUP_HISTORY_SAMPLE,
+  WAKEUP_HISTORY_HOLD,
+};
+
+enum BootPhase {
+  BOOT_START,
+  BOOT_I2C,
+  BOOT_EEPROM,
+  BOOT_LRW,
+  BOOT_NFC,
+  BOOT_ATECC,
+  BOOT_SENSORS,
+  BOOT_FIRST_UPLINK,
+  BOOT_PHASES
 };
 
 struct WakeUpHandler {
@@ -53,6 +67,8 @@ struct WakeUpHandler {
   uint32_t schedmsg_due;
   uint32_t dutycycle_due;
   uint32_t bsec_due;
+  uint32_t history_due;
+  uint32_t hold_due;
 };
 
 /* Exported constants --------------------------------------------------------*/
@@ -71,25 +87,41 @@ struct WakeUpHandler {
 /* EEPROM Layout */
 #define EEPROM_BOOTMODE           (DATA_EEPROM_BASE)
 #define EEPROM_BOOTMODE_END       (DATA_EEPROM_BASE + 0x4)
-#define EEPROM_UNUSED0            (DATA_EEPROM_BASE + 0x4)
-#define EEPROM_UNUSED0_END        (DATA_EEPROM_BASE + 0x8)
+#define EEPROM_I2CMAP             (DATA_EEPROM_BASE + 0x4)        // I2C presence map of last boot, complement in upper half
+#define EEPROM_I2CMAP_END         (DATA_EEPROM_BASE + 0x8)
 #define EEPROM_PW                 (DATA_EEPROM_BASE + 0x8)
 #define EEPROM_PW_END             (DATA_EEPROM_BASE + 0xc)
 #define EEPROM_PW_COMPLEMENT      (DATA_EEPROM_BASE + 0xc)
 #define EEPROM_PW_COMPLEMENT_END  (DATA_EEPROM_BASE + 0x10)
 #define EEPROM_LORA               (DATA_EEPROM_BASE + 0x10)       // start flash adress to store lorawan context
+#define EEPROM_LORA_FCNT          (DATA_EEPROM_BASE + 0xc00)      // frame counter journal, tail of lorawan context
 #define EEPROM_LORA_END           (DATA_EEPROM_BASE + 0x1000)
 #define EEPROM_APP                (DATA_EEPROM_BASE + 0x1000)
 #define EEPROM_APP_END            (DATA_EEPROM_BASE + 0x1400)
+#define EEPROM_APP_BANK_SIZE      (0x200)                         // two banks of the config log
 #define EEPROM_LOG                (DATA_EEPROM_BASE + 0x1400)
 
 #define EEPROM_LOG_REBOTS         (DATA_EEPROM_BASE + 0x1400)
 #define EEPROM_LOG_EVENTS         (DATA_EEPROM_BASE + 0x1404)
 #define EEPROM_LOG_SENDED         (DATA_EEPROM_BASE + 0x1408)
 #define EEPROM_LOG_VOLTYR         (DATA_EEPROM_BASE + 0x140c)
+#define EEPROM_HISTORY            (DATA_EEPROM_BASE + 0x1440)     // daily sensor rollups, past the debug counters
 
-#define EEPROM_LOG_END            (DATA_EEPROM_BASE + 0x1800)
-static_assert(sizeof(LoRaMacNvmData_t) < EEPROM_LORA_END - EEPROM_LORA, "LoRaMac-node overstepping EEPROM boundaries.");
+#define EEPROM_LOG_END            (DATA_EEPROM_BASE + 0x1600)
+#ifdef HISTORY
+#define EEPROM_LOG_VOLTYR_SIZE    (0x34)                          // voltage log stops short of the rollups
+#else
+#define EEPROM_LOG_VOLTYR_SIZE    (0x1f4)
+#endif
+#define EEPROM_LOG_VOLTYR_END     (EEPROM_LOG_VOLTYR + EEPROM_LOG_VOLTYR_SIZE)
+#define EEPROM_BSEC               (DATA_EEPROM_BASE + 0x1600)     // BSEC calibration state slots
+#define EEPROM_BSEC_END           (DATA_EEPROM_BASE + 0x1800)
+static_assert(sizeof(LoRaMacNvmData_t) < EEPROM_LORA_FCNT - EEPROM_LORA, "LoRaMac-node overstepping EEPROM boundaries.");
+#ifdef HISTORY
+static_assert(EEPROM_LOG_VOLTYR + EEPROM_LOG_VOLTYR_SIZE <= EEPROM_HISTORY, "Voltage log overlapping sensor history.");
+#else
+static_assert(EEPROM_LOG_VOLTYR + EEPROM_LOG_VOLTYR_SIZE <= EEPROM_LOG_END, "Voltage log overstepping EEPROM boundaries.");
+#endif
 
 /* Bootloader BOOTMODES */
 #define BOOTMODE_MAINFW           ((uint32_t)0x0)
@@ -108,12 +140,16 @@ static_assert(sizeof(LoRaMacNvmData_t) < EEPROM_LORA_END - EEPROM_LORA, "LoRaMac
 #define LRW_B0_TRIGGER_HUMIDITY_HIGH     (0x06U)
 #define LRW_B0_TRIGGER_HUMIDITY_LOW      (0x07U)
 #define LRW_B0_TRIGGER_REED_SWITCH       (0x08U)
+#define LRW_B0_TRIGGER_ORIENTATION       (0x09U)
+#define LRW_B0_TRIGGER_ACTIVITY          (0x0AU)
+#define LRW_B0_TRIGGER_STEPS             (0x0BU)
 #endif
 
 /* External variables --------------------------------------------------------*/
 extern uint8_t detectedGesture; // Currently detected gesture
 extern struct WakeUpHandler wuh;
 extern bool hwSlept;
+extern uint32_t bootPhase[BOOT_PHASES];
 extern volatile int adcConvDone;
 
 /* Exported macros -----------------------------------------------------------*/
@@ -130,13 +166,14 @@ extern volatile int adcConvDone;
 #endif
 
 /* Exported functions ------------------------------------------------------- */
-void getBatteryVoltageAndTemperature(float *voltage, float *temperature);
+void getBatteryVoltageAndTemperature(uint16_t *millivolts, int16_t *centicelsius);
+uint32_t HW_ADCAge(void);
 void enqueueToSend(enum MsgType msg_type, uint8_t trigger_type);
 void hal_deinit();
 
 void HW_GPIO_PostInit(void);
 void HW_ReadEEPROM(const void *addr, void *buf, size_t size);
-void HW_WriteEEPROM(void *addr, const void *buf, size_t size);
+bool HW_WriteEEPROM(void *addr, const void *buf, size_t size);
 void HW_ChangePW(uint32_t password);
 void HW_EnterStandbyMode();
 void HW_EnterStopMode();
@@ -148,10 +185,16 @@ uint32_t HW_RTCGetSTime(void);
 uint32_t HW_RTCGetMsTime(void);
 int64_t HW_RTCGetNsTime(void);
 void HW_RTCWUTSet(uint32_t seconds);
+void HW_StopUntil(uint32_t due);
+void HW_BootPhase(enum BootPhase phase);
 void Breakpoint(void);
 
 void PrepareWakeup(enum WakeUpReason reason, uint32_t duration);
 uint32_t I2C_Scan(void);
+uint32_t I2C_Probe(void);
+bool I2C_Present(uint8_t addr);
+void I2C_RequestProbe(void);
+void I2C_Process(void);
 uint32_t LEDBlink(enum LEDBlinkPattern pattern);
 void LEDBlinkSync(uint8_t times, uint16_t led);
 
@@ -0,0 +1,65 @@
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __HISTORY_H
+#define __HISTORY_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Exported constants --------------------------------------------------------*/
+#define HISTORY_CHANNELS      3     /* Sensor channels tracked, see History_Key */
+#define HISTORY_QUARTER_N     8     /* 15 minute rollups kept, in RAM */
+#define HISTORY_HOUR_N        24    /* Hourly rollups kept, in RAM */
+#define HISTORY_DAY_N         8     /* Daily rollup slots, in EEPROM, one is being rewritten */
+#define HISTORY_MIN_INTERVAL  10    /* Seconds, keeps a day's sum within int32_t */
+#define HISTORY_HOLD          10000 /* ms rollups stay put for an NFC download */
+
+/* Exported types ------------------------------------------------------------*/
+enum HistoryLevel {
+  HISTORY_QUARTER,
+  HISTORY_HOUR,
+  HISTORY_DAY,
+  HISTORY_LEVELS
+};
+
+/* Samples are in DeviceSensors units, e.g. centi-Celsius */
+struct HistoryStat {
+  int32_t min;
+  int32_t max;
+  int32_t sum;
+};
+
+/*
+ * DESCRIPTION
+ *        Rollup of the samples taken within one 15 minute, hour or day slot
+ *        of HW_RTCGetSTime. The RTC restarts at boot, so end is meaningful
+ *        for buckets of the running boot only.
+ */
+struct HistoryBucket {
+  uint32_t end;    /* HW_RTCGetSTime of last sample */
+  uint16_t boot;   /* History_Boot the samples were taken in */
+  uint16_t count;  /* Samples, 0 if empty */
+  struct HistoryStat stat[HISTORY_CHANNELS];
+};
+
+/* Exported functions ------------------------------------------------------- */
+void History_Init(void);
+void History_Add(uint32_t now, const int32_t v[HISTORY_CHANNELS]);
+void History_Request(void);
+bool History_Pending(void);
+uint32_t History_Deferred(void);
+void History_Process(void);
+void History_Hold(uint32_t ms);
+uint32_t History_Now(void);
+uint16_t History_Boot(void);
+uint32_t History_Key(unsigned i);
+unsigned History_Count(enum HistoryLevel level);
+const struct HistoryBucket *History_Get(enum HistoryLevel level, unsigned i, bool *partial);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __HISTORY_H */
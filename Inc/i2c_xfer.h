@@ -0,0 +1,58 @@
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __I2C_XFER_H
+#define __I2C_XFER_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include "stm32l0xx_hal.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/*
+ * DESCRIPTION
+ *        One I2C1 transaction, owned by the caller until it completes. With
+ *        reg_size of I2C_MEMADD_SIZE_8BIT/16BIT it's a register (memory)
+ *        access, with 0 a plain master transmit/receive (e.g. ATECC608A).
+ *
+ *        The done callback, if any, runs in interrupt context, after status
+ *        is final and before the next queued transaction starts.
+ */
+struct I2C_Xfer {
+  uint16_t dev;        /* 8-bit (shifted) slave address */
+  uint16_t reg;
+  uint16_t reg_size;   /* I2C_MEMADD_SIZE_8BIT, I2C_MEMADD_SIZE_16BIT or 0 */
+  uint16_t len;
+  uint8_t *buf;
+  bool write;
+  volatile int32_t status;  /* I2C_XFER_PENDING, then HAL_StatusTypeDef */
+  void (*done)(struct I2C_Xfer *xfer);
+  void *ctx;
+  struct I2C_Xfer *next;
+};
+
+/* Exported constants --------------------------------------------------------*/
+#define I2C_XFER_PENDING  0x80
+#define I2C_XFER_IDLE     0x81  /* Never submitted, or cancelled */
+#define I2C_DMA_MIN_SIZE  4     /* Shorter transfers use interrupts only */
+
+#define I2C_XFER_READ(d, r, rs, b, l)   { .dev = (d), .reg = (r), .reg_size = (rs), .len = (l), .buf = (b), .write = false, .status = I2C_XFER_IDLE }
+#define I2C_XFER_WRITE(d, r, rs, b, l)  { .dev = (d), .reg = (r), .reg_size = (rs), .len = (l), .buf = (b), .write = true,  .status = I2C_XFER_IDLE }
+
+/* Exported functions ------------------------------------------------------- */
+int32_t I2C_Submit(struct I2C_Xfer *xfer);
+int32_t I2C_Wait(struct I2C_Xfer *xfer, uint32_t timeout);
+void I2C_Cancel(struct I2C_Xfer *xfer);
+bool I2C_Idle(void);
+
+HAL_StatusTypeDef I2C_MemRead(uint16_t dev, uint16_t reg, uint16_t reg_size, uint8_t *buf, uint16_t len, uint32_t timeout);
+HAL_StatusTypeDef I2C_MemWrite(uint16_t dev, uint16_t reg, uint16_t reg_size, const uint8_t *buf, uint16_t len, uint32_t timeout);
+HAL_StatusTypeDef I2C_Transmit(uint16_t dev, const uint8_t *buf, uint16_t len, uint32_t timeout);
+HAL_StatusTypeDef I2C_Receive(uint16_t dev, uint8_t *buf, uint16_t len, uint32_t timeout);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __I2C_XFER_H */
@@ -14,6 +14,13 @@ extern "C" {
 /* Exported macros -----------------------------------------------------------*/
 #define LORAWAN_APP_PORT                            1
 #define LRW_QUEUE_LEN                               3
+#define LRW_TRIGGERS                                16
+
+/* DevCfg.event_limit fields */
+#define LRW_LIMIT_BURST                             0x000000ffU  /* Events in a row, 0 disables limiter */
+#define LRW_LIMIT_REFILL                            0x0000ff00U  /* Minutes per regained event, 0 as 1 */
+#define LRW_LIMIT_REARM                             0x00ff0000U  /* 10 s units between events of a trigger */
+#define LRW_LIMIT_HYST_LIGHT                        0xff000000U  /* Luminance hysteresis, % of threshold */
 
 /* Exported types ------------------------------------------------------------*/
 
@@ -37,12 +44,25 @@ extern "C" {
 struct LRW_Msg {
   uint8_t volatile msg_type;
   uint8_t len;
-  uint8_t msg[12];
+  uint8_t msg[17];
 #if defined(STX)
   uint8_t trigger_type;
+#elif defined(STA)
+  uint8_t gesture;  /* detectedGesture at enqueue time */
 #endif
 };
 
+/*
+ * DESCRIPTION
+ *        Token bucket of one trigger, as its theoretical arrival time (GCRA):
+ *        an event is let through while tat is at most burst - 1 refill
+ *        periods ahead of now, and pushes tat one period further.
+ */
+struct LRW_Gate {
+  uint32_t tat;   /* HW_RTCGetSTime, 0 if never sent */
+  uint32_t last;  /* HW_RTCGetSTime of last event let through */
+};
+
 struct LRW_Handle {
   uint8_t retrans_left;
   uint8_t retrans_index;
@@ -50,6 +70,10 @@ struct LRW_Handle {
   bool retrans_txp_override;
   bool retrans_txp_internal;
   struct LRW_Msg queue[LRW_QUEUE_LEN];
+#if defined(STX)
+  struct LRW_Gate gate[LRW_TRIGGERS];
+  uint16_t suppressed;  /* Events dropped by gate since last message */
+#endif
 };
 
 
@@ -137,8 +137,13 @@ void Error_Handler(void);
 #define USE_ATECC608A
 
 #define NFC
+#define NFC_NDEF       /* Sensor values as NDEF record in ST25DV user memory, phones read it without waking MCU */
+//#define NFC_NDEF_ONLY /* No GPO interrupt at all, mailbox commands (config, password, firmware upload) go unanswered! */
 #define LORAWAN
+#define SENSORS_MAX_AGE 30000 /* ms a cached sensor sample serves NFC and LoRa consumers */
+#define ADC_MAX_AGE     60000 /* ms a battery voltage and MCU temperature measurement is reused */
 //#define EEDBGLOG
+//#define I2C_DIAGNOSTIC /* Full I2C bus scan at boot, on top of the cached presence check */
 
 /* Password
  * --------
@@ -166,11 +171,14 @@ void Error_Handler(void);
 #define HDC2080 /* Temperature, Humidity */
 #define BMA400 /* Acceleration (X/Y/Z Acis) */
 #define SFH7776 /* Luminance */
+#define HISTORY /* Temperature, humidity, luminance rollups for NFC download */
 #endif
 
 #ifdef STE /* Environment Sensor */
 #define BME680 /* Temperature, Humidity, Pressure */
 #define BSEC /* AQI (Air Quality Index), VOC (Volatile Organic Compounds), CO2 */
+#define BSEC_STATE_SAVE_INTERVAL (4 * 3600) /* Seconds between BSEC calibration state saves to EEPROM, 0 disables */
+#define HISTORY /* Temperature, humidity, pressure rollups for NFC download */
 #endif
 
 #ifdef STA /* Button */
@@ -12,6 +12,7 @@ extern "C" {
 #include <assert.h>
 #include <stdalign.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* Exported types ------------------------------------------------------------*/
@@ -146,6 +147,7 @@ enum {MB_NOTCHAINED, MB_CHAINED};
 #define MB_CH_NBCHUNK         11
 #define MB_CH_LENGTH          12
 #define MB_CH_DATA            13
+#define MB_CH_MAXLENGTH       (256 - MB_CH_DATA)
 
 #define MB_MAXFUNCTION        0xFF
 #define MB_R2HSIMPLETRANSFER  0x01
@@ -163,6 +165,7 @@ enum {MB_NOTCHAINED, MB_CHAINED};
 #define MB_R2HGETCONFIG       0x20
 #define MB_R2HSETCONFIG       0x21
 #define MB_R2HGETSENSOR       0x22
+#define MB_R2HGETHISTORY      0x23
 
 #define MB_CANCELCOMMAND      0xF0
 #define MB_RESETCOMMUNICATION 0xF1
@@ -184,11 +187,23 @@ enum {MB_NOTCHAINED, MB_CHAINED};
 #define ST25_RETRY_DELAY       ((uint8_t)  4)  /* milliseconds */
 #define BUS_I2C1_POLL_TIMEOUT             100  /* milliseconds */
 #define NFC_PWTIMEOUT                  120000  /* 2 minute */
+#define NFC_CHAIN_RX_MAX                  512  /* Largest H2D chained transfer */
+#define NFC_NDEF_SIZE                     128  /* Bytes of user memory for CC file and NDEF record */
+
+/* GPO events waking the MCU, just the mailbox ones with NDEF */
+#if defined(NFC_NDEF_ONLY)
+#define NFC_GPO_MASK          0
+#elif defined(NFC_NDEF)
+#define NFC_GPO_MASK          (ST25DV_GPO_ENABLE_MASK | ST25DV_GPO_RFPUTMSG_MASK | ST25DV_GPO_RFGETMSG_MASK)
+#else
+#define NFC_GPO_MASK          ST25DV_GPO_ALL_MASK
+#endif
 
 
 /* External variables --------------------------------------------------------*/
 extern ST25DV_Object_t St25Dv_Obj;
 extern uint32_t nfc_activity;
+extern uint32_t nfc_throughput;
 
 /* Exported macros -----------------------------------------------------------*/
 #ifdef DEBUG
@@ -205,6 +220,12 @@ void MBDecodeHeader(const uint8_t * const pData, MB_HEADER_T * const mb_header);
 void NFC_ClearMailbox(void);
 void NFC_DeInit(void);
 int32_t NFC_HasActivity(void);
+void NFC_ChainSend(uint8_t *mb, uint8_t fct, size_t (*encode)(uint8_t *msg, size_t len, size_t offset));
+bool NFC_ChainNext(uint8_t *mb);
+const uint8_t *NFC_ChainReceive(uint8_t *mb, size_t mb_len, size_t *len);
+void NFC_ChainAbort(void);
+void NFC_NdefRequest(void);
+void NFC_NdefProcess(void);
 
 #ifdef __cplusplus
 }
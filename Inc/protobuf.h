@@ -31,6 +31,7 @@ extern "C" {
 
 #define PBMSGID_DEVICE_CONFIGURATION  0
 #define PBMSGID_DEVICE_SENSORS        1
+#define PBMSGID_DEVICE_HISTORY        2
 
 /* message DeviceConfiguration
  * --------------------------- */
@@ -132,6 +133,21 @@ extern "C" {
 #define PBMSG_BX_SENSOR_AXIS_CONFIGURE_ID                 31
 #define PBMSG_BX_SENSOR_AXIS_CONFIGURE_TYPE               PB_TAGTYPE_VARINT
 #define PBMSG_BX_SENSOR_AXIS_CONFIGURE                    ((uint32_t)PBMSG_BX_SENSOR_AXIS_CONFIGURE_ID << 3 | PBMSG_BX_SENSOR_AXIS_CONFIGURE_TYPE)
+#define PBMSG_BX_SENSOR_AXIS_EVENTS_ID                    32
+#define PBMSG_BX_SENSOR_AXIS_EVENTS_TYPE                  PB_TAGTYPE_VARINT
+#define PBMSG_BX_SENSOR_AXIS_EVENTS                       ((uint32_t)PBMSG_BX_SENSOR_AXIS_EVENTS_ID << 3 | PBMSG_BX_SENSOR_AXIS_EVENTS_TYPE)
+#define PBMSG_BX_SENSOR_LUMINANCE_CALIBRATION_ID          33
+#define PBMSG_BX_SENSOR_LUMINANCE_CALIBRATION_TYPE        PB_TAGTYPE_BYTES
+#define PBMSG_BX_SENSOR_LUMINANCE_CALIBRATION             ((uint32_t)PBMSG_BX_SENSOR_LUMINANCE_CALIBRATION_ID << 3 | PBMSG_BX_SENSOR_LUMINANCE_CALIBRATION_TYPE)
+#define PBMSG_BX_SENSOR_CLIMATE_CONFIGURE_ID              34
+#define PBMSG_BX_SENSOR_CLIMATE_CONFIGURE_TYPE            PB_TAGTYPE_VARINT
+#define PBMSG_BX_SENSOR_CLIMATE_CONFIGURE                 ((uint32_t)PBMSG_BX_SENSOR_CLIMATE_CONFIGURE_ID << 3 | PBMSG_BX_SENSOR_CLIMATE_CONFIGURE_TYPE)
+#define PBMSG_BX_SENSOR_EVENT_LIMIT_ID                    35
+#define PBMSG_BX_SENSOR_EVENT_LIMIT_TYPE                  PB_TAGTYPE_VARINT
+#define PBMSG_BX_SENSOR_EVENT_LIMIT                       ((uint32_t)PBMSG_BX_SENSOR_EVENT_LIMIT_ID << 3 | PBMSG_BX_SENSOR_EVENT_LIMIT_TYPE)
+#define PBMSG_BX_SENSOR_HISTORY_INTERVAL_ID               36
+#define PBMSG_BX_SENSOR_HISTORY_INTERVAL_TYPE             PB_TAGTYPE_VARINT
+#define PBMSG_BX_SENSOR_HISTORY_INTERVAL                  ((uint32_t)PBMSG_BX_SENSOR_HISTORY_INTERVAL_ID << 3 | PBMSG_BX_SENSOR_HISTORY_INTERVAL_TYPE)
 
 #define PBEEPROM_BUTTON_SINGLE_COUNT_ID                   2047
 #define PBEEPROM_BUTTON_SINGLE_COUNT_TYPE                 PB_TAGTYPE_VARINT
@@ -163,6 +179,9 @@ extern "C" {
 #define PBSMSG_TX_DEVICE_BATTERY_VOLTAGE_ID         2
 #define PBSMSG_TX_DEVICE_BATTERY_VOLTAGE_TYPE       PB_TAGTYPE_VARINT
 #define PBSMSG_TX_DEVICE_BATTERY_VOLTAGE            ((uint32_t)PBSMSG_TX_DEVICE_BATTERY_VOLTAGE_ID << 3 | PBSMSG_TX_DEVICE_BATTERY_VOLTAGE_TYPE)
+#define PBSMSG_TX_DEVICE_NFC_THROUGHPUT_ID          19
+#define PBSMSG_TX_DEVICE_NFC_THROUGHPUT_TYPE        PB_TAGTYPE_VARINT
+#define PBSMSG_TX_DEVICE_NFC_THROUGHPUT             ((uint32_t)PBSMSG_TX_DEVICE_NFC_THROUGHPUT_ID << 3 | PBSMSG_TX_DEVICE_NFC_THROUGHPUT_TYPE)
 
 #define PBSMSG_TX_SENSOR_TEMPERATURE_ID             3
 #define PBSMSG_TX_SENSOR_TEMPERATURE_TYPE           PB_TAGTYPE_VARINT
@@ -198,6 +217,12 @@ extern "C" {
 #define PBSMSG_TX_SENSOR_Z_AXIS_ID                  10
 #define PBSMSG_TX_SENSOR_Z_AXIS_TYPE                PB_TAGTYPE_VARINT
 #define PBSMSG_TX_SENSOR_Z_AXIS                     ((uint32_t)PBSMSG_TX_SENSOR_Z_AXIS_ID << 3 | PBSMSG_TX_SENSOR_Z_AXIS_TYPE)
+#define PBSMSG_TX_SENSOR_STEPS_ID                   17
+#define PBSMSG_TX_SENSOR_STEPS_TYPE                 PB_TAGTYPE_VARINT
+#define PBSMSG_TX_SENSOR_STEPS                      ((uint32_t)PBSMSG_TX_SENSOR_STEPS_ID << 3 | PBSMSG_TX_SENSOR_STEPS_TYPE)
+#define PBSMSG_TX_SENSOR_ACTIVITY_ID                18
+#define PBSMSG_TX_SENSOR_ACTIVITY_TYPE              PB_TAGTYPE_VARINT
+#define PBSMSG_TX_SENSOR_ACTIVITY                   ((uint32_t)PBSMSG_TX_SENSOR_ACTIVITY_ID << 3 | PBSMSG_TX_SENSOR_ACTIVITY_TYPE)
 
 #define PBSMSG_TX_SENSOR_GESTURE_SINGLE_COUNT_ID    11
 #define PBSMSG_TX_SENSOR_GESTURE_SINGLE_COUNT_TYPE  PB_TAGTYPE_VARINT
@@ -209,6 +234,56 @@ extern "C" {
 #define PBSMSG_TX_SENSOR_GESTURE_LONG_COUNT_TYPE    PB_TAGTYPE_VARINT
 #define PBSMSG_TX_SENSOR_GESTURE_LONG_COUNT         ((uint32_t)PBSMSG_TX_SENSOR_GESTURE_LONG_COUNT_ID << 3 | PBSMSG_TX_SENSOR_GESTURE_LONG_COUNT_TYPE)
 
+/* message DeviceHistory
+ * --------------------- */
+#define PBHMSG_TX_HISTORY_INTERVAL_ID               1
+#define PBHMSG_TX_HISTORY_INTERVAL_TYPE             PB_TAGTYPE_VARINT
+#define PBHMSG_TX_HISTORY_INTERVAL                  ((uint32_t)PBHMSG_TX_HISTORY_INTERVAL_ID << 3 | PBHMSG_TX_HISTORY_INTERVAL_TYPE)
+#define PBHMSG_TX_HISTORY_UPTIME_ID                 2
+#define PBHMSG_TX_HISTORY_UPTIME_TYPE               PB_TAGTYPE_VARINT
+#define PBHMSG_TX_HISTORY_UPTIME                    ((uint32_t)PBHMSG_TX_HISTORY_UPTIME_ID << 3 | PBHMSG_TX_HISTORY_UPTIME_TYPE)
+#define PBHMSG_TX_HISTORY_ROLLUP_ID                 3
+#define PBHMSG_TX_HISTORY_ROLLUP_TYPE               PB_TAGTYPE_BYTES
+#define PBHMSG_TX_HISTORY_ROLLUP                    ((uint32_t)PBHMSG_TX_HISTORY_ROLLUP_ID << 3 | PBHMSG_TX_HISTORY_ROLLUP_TYPE)
+
+/* message DeviceHistory.Rollup */
+#define PBHMSG_TX_ROLLUP_RESOLUTION_ID              1
+#define PBHMSG_TX_ROLLUP_RESOLUTION_TYPE            PB_TAGTYPE_VARINT
+#define PBHMSG_TX_ROLLUP_RESOLUTION                 ((uint32_t)PBHMSG_TX_ROLLUP_RESOLUTION_ID << 3 | PBHMSG_TX_ROLLUP_RESOLUTION_TYPE)
+#define PBHMSG_TX_ROLLUP_AGE_ID                     2
+#define PBHMSG_TX_ROLLUP_AGE_TYPE                   PB_TAGTYPE_VARINT
+#define PBHMSG_TX_ROLLUP_AGE                        ((uint32_t)PBHMSG_TX_ROLLUP_AGE_ID << 3 | PBHMSG_TX_ROLLUP_AGE_TYPE)
+#define PBHMSG_TX_ROLLUP_BOOTS_AGO_ID               3
+#define PBHMSG_TX_ROLLUP_BOOTS_AGO_TYPE             PB_TAGTYPE_VARINT
+#define PBHMSG_TX_ROLLUP_BOOTS_AGO                  ((uint32_t)PBHMSG_TX_ROLLUP_BOOTS_AGO_ID << 3 | PBHMSG_TX_ROLLUP_BOOTS_AGO_TYPE)
+#define PBHMSG_TX_ROLLUP_SAMPLES_ID                 4
+#define PBHMSG_TX_ROLLUP_SAMPLES_TYPE               PB_TAGTYPE_VARINT
+#define PBHMSG_TX_ROLLUP_SAMPLES                    ((uint32_t)PBHMSG_TX_ROLLUP_SAMPLES_ID << 3 | PBHMSG_TX_ROLLUP_SAMPLES_TYPE)
+#define PBHMSG_TX_ROLLUP_PARTIAL_ID                 5
+#define PBHMSG_TX_ROLLUP_PARTIAL_TYPE               PB_TAGTYPE_VARINT
+#define PBHMSG_TX_ROLLUP_PARTIAL                    ((uint32_t)PBHMSG_TX_ROLLUP_PARTIAL_ID << 3 | PBHMSG_TX_ROLLUP_PARTIAL_TYPE)
+#define PBHMSG_TX_ROLLUP_STAT_ID                    6
+#define PBHMSG_TX_ROLLUP_STAT_TYPE                  PB_TAGTYPE_BYTES
+#define PBHMSG_TX_ROLLUP_STAT                       ((uint32_t)PBHMSG_TX_ROLLUP_STAT_ID << 3 | PBHMSG_TX_ROLLUP_STAT_TYPE)
+
+/* message DeviceHistory.Stat */
+#define PBHMSG_TX_STAT_SENSOR_ID                    1
+#define PBHMSG_TX_STAT_SENSOR_TYPE                  PB_TAGTYPE_VARINT
+#define PBHMSG_TX_STAT_SENSOR                       ((uint32_t)PBHMSG_TX_STAT_SENSOR_ID << 3 | PBHMSG_TX_STAT_SENSOR_TYPE)
+#define PBHMSG_TX_STAT_MIN_ID                       2
+#define PBHMSG_TX_STAT_MIN_TYPE                     PB_TAGTYPE_VARINT
+#define PBHMSG_TX_STAT_MIN                          ((uint32_t)PBHMSG_TX_STAT_MIN_ID << 3 | PBHMSG_TX_STAT_MIN_TYPE)
+#define PBHMSG_TX_STAT_MAX_ID                       3
+#define PBHMSG_TX_STAT_MAX_TYPE                     PB_TAGTYPE_VARINT
+#define PBHMSG_TX_STAT_MAX                          ((uint32_t)PBHMSG_TX_STAT_MAX_ID << 3 | PBHMSG_TX_STAT_MAX_TYPE)
+#define PBHMSG_TX_STAT_MEAN_ID                      4
+#define PBHMSG_TX_STAT_MEAN_TYPE                    PB_TAGTYPE_VARINT
+#define PBHMSG_TX_STAT_MEAN                         ((uint32_t)PBHMSG_TX_STAT_MEAN_ID << 3 | PBHMSG_TX_STAT_MEAN_TYPE)
+
+#define PBENUM_RESOLUTION_QUARTER_HOUR  ((uint64_t)1)  // 15 minutes
+#define PBENUM_RESOLUTION_HOUR          ((uint64_t)2)
+#define PBENUM_RESOLUTION_DAY           ((uint64_t)3)
+
 /* External variables --------------------------------------------------------*/
 /* Exported macros -----------------------------------------------------------*/
 #define PBEncodeMsgField(msg, len, pos, ...)                                   \
@@ -218,13 +293,15 @@ extern "C" {
 
 /* Exported functions ------------------------------------------------------- */
 size_t PBEncodeMsg_DeviceConfiguration(uint8_t *msg, size_t len, bool pw_valid);
+void PBInvalidate_DeviceConfiguration(void);
 size_t PBEncodeMsg_DeviceSensors(uint8_t *msg, size_t len, bool pw_valid);
+size_t PBEncodeMsg_DeviceHistory(uint8_t *msg, size_t len, size_t offset, uint32_t now);
 uint8_t PBDecodeVarint(const uint8_t* varint, uint8_t maxbits, void* value);
 uint64_t PBEncodeSInt(int64_t val);
 int64_t PBDecodeSInt(uint64_t val);
 size_t PBEncodeField(uint8_t * restrict out, size_t len, uint32_t key, ...);
-void PBDecodeMsg(const uint8_t *msg, uint8_t len);
-uint64_t u64(uint8_t b[static 8]);
+void PBDecodeMsg(const uint8_t *msg, size_t len);
+uint64_t u64(const uint8_t b[static 8]);
 void b64(uint8_t b[static 8], uint64_t v);
 
 
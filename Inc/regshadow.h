@@ -0,0 +1,53 @@
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __REGSHADOW_H
+#define __REGSHADOW_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Exported types ------------------------------------------------------------*/
+/*
+ * DESCRIPTION
+ *        Copy of an I2C device's 8-bit register range [first, last], as last
+ *        read from or written to the device. Bitmaps hold a bit per register:
+ *
+ *            valid    value known to match the device
+ *            dirty    value staged by RegShadow_Set, not yet written
+ *            nocache  updated by hardware, always read from and written to
+ *                     the device (NULL if none)
+ */
+struct RegShadow {
+  uint16_t dev;      /* 8-bit (shifted) slave address */
+  uint8_t first;
+  uint8_t last;
+  uint8_t *val;
+  uint8_t *valid;
+  uint8_t *dirty;
+  const uint8_t *nocache;
+  uint16_t writes;   /* Write transactions issued */
+  uint16_t skipped;  /* Register writes dropped, value already on device */
+};
+
+/* Exported macro ------------------------------------------------------------*/
+/* Defines struct RegShadow name and its storage, for registers first..last */
+#define REGSHADOW_BITMAP(first, last)  (((last) - (first)) / 8 + 1)
+#define REGSHADOW(name, d, f, l, nc) \
+  static uint8_t name##_val[(l) - (f) + 1], name##_valid[REGSHADOW_BITMAP(f, l)], name##_dirty[REGSHADOW_BITMAP(f, l)]; \
+  static struct RegShadow name = { .dev = (d), .first = (f), .last = (l), .val = name##_val, .valid = name##_valid, .dirty = name##_dirty, .nocache = (nc) }
+
+/* Exported functions ------------------------------------------------------- */
+void RegShadow_Invalidate(struct RegShadow *s);
+bool RegShadow_Known(const struct RegShadow *s);
+void RegShadow_Set(struct RegShadow *s, uint8_t reg, const uint8_t *buf, uint16_t len);
+int32_t RegShadow_Flush(struct RegShadow *s);
+int32_t RegShadow_Write(struct RegShadow *s, uint8_t reg, const uint8_t *buf, uint16_t len);
+int32_t RegShadow_Read(struct RegShadow *s, uint8_t reg, uint8_t *buf, uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __REGSHADOW_H */
@@ -17,15 +17,94 @@ enum Send_Strategy {
   SEND_STRATEGY_BOTH,
 };
 
+/*
+ * DESCRIPTION
+ *        Sensor registry, a NULL terminated list of the device's sensors.
+ *        Sensors_Read starts all of them, then collects each once ready, so
+ *        conversion times and bus transfers overlap.
+ *
+ *            start   Begin conversion or result transfer, mustn't block
+ *            ready   HW_RTCGetMsTime the result can be collected
+ *            read    Collect the result into the driver globals
+ *
+ *        Any hook may be NULL: nothing to start, ready right away, or sampled
+ *        elsewhere (BSEC on its own schedule).
+ *
+ *        Channels describe the results for PBEncodeMsg_DeviceSensors. The
+ *        driver globals they point to double as the latest-sample cache,
+ *        Sensors_Update only resamples sensors older than max_age.
+ */
+enum SensorFormat {
+  SENSOR_FMT_U8,
+  SENSOR_FMT_U16,
+  SENSOR_FMT_U32,
+  SENSOR_FMT_S16,
+  SENSOR_FMT_S32,
+  SENSOR_FMT_FLOAT,
+};
+
+struct SensorChannel {
+  uint32_t pbkey;            /* PBSMSG_TX_SENSOR_* field, its tag type picks varint or fixed32 */
+  enum SensorFormat format;  /* Of *value, signed ones are zigzag encoded */
+  const void *value;
+};
+
+struct Sensor {
+  const char *name;
+  uint8_t addr;      /* 8-bit I2C address, absent ones are skipped, see I2C_Present */
+  void (*start)(void);
+  uint32_t (*ready)(void);
+  void (*read)(void);
+  uint32_t max_age;  /* ms a sample stays fresh */
+  const struct SensorChannel *channels;
+  uint8_t channels_n;
+};
+
+extern const struct Sensor *const sensors[];
+
+void Sensors_Read(void);
+void Sensors_Update(void);
+void Sensors_Process(void);
+uint32_t Sensors_Age(unsigned i);
+
 #ifdef BMA400
+/* bma400_config: batch 100 Hz samples in FIFO, wake on watermark for vibration features */
+#define BMA400_CONFIG_VIBRATION   0x400
+
+/* bma400_events: IC engines waking on meaningful change, see BMA400_Init */
+#define BMA400_EVENT_ORIENTATION  0x1
+#define BMA400_EVENT_ACTIVITY     0x2
+#define BMA400_EVENT_STEPS        0x4
+
 void BMA400_ForeverTest(void);
-void BMA400_Init(uint16_t, uint16_t);
+void BMA400_Init(uint16_t, uint16_t, uint32_t);
 void BMA400_Read(void);
 void BMA400_Reset(void);
+void BMA400_Interrupt(void);
+void BMA400_Process(void);
+
+/* Features of the last FIFO batch, AC part (mean removed) of acceleration */
+struct BMA400_Vibration {
+  uint16_t rms_x;    /* scale 100 fixed-point value representation, m/s^2 */
+  uint16_t rms_y;    /* scale 100 fixed-point value representation, m/s^2 */
+  uint16_t rms_z;    /* scale 100 fixed-point value representation, m/s^2 */
+  uint16_t peak;     /* scale 100 fixed-point value representation, m/s^2, of any axis */
+  uint16_t crest;    /* scale 100 fixed-point, peak / RMS of the peak's axis */
+  uint16_t freq;     /* scale 10 fixed-point value representation, Hz, of strongest axis */
+  uint16_t frames;   /* Samples in batch */
+  uint32_t batches;  /* Batches since vibration mode was configured */
+};
 
 extern struct BMA400_Handle bma400;
 struct BMA400_Handle {
   struct bma400_dev *p;
+  bool vibration;           /* BMA400_CONFIG_VIBRATION in effect */
+  volatile bool irq;        /* FIFO watermark or event awaits BMA400_Process */
+  struct BMA400_Vibration vib;
+  uint32_t events;          /* bma400_events in effect */
+  uint32_t steps;           /* Step counter of IC */
+  uint32_t steps_sent;      /* Step counter at last step event */
+  uint8_t activity;         /* BMA400_STILL_ACT, BMA400_WALK_ACT or BMA400_RUN_ACT */
   uint16_t status;  /* Interrupt status, not quite IC register representation */
   int16_t fix_x;    /* scale 100 fixed-point value representation, m/s^2 */
   int16_t fix_y;    /* scale 100 fixed-point value representation, m/s^2 */
@@ -43,10 +122,29 @@ struct BMA400_Handle {
 #endif
 
 #ifdef SFH7776
+/*
+ * DESCRIPTION
+ *        Lux calibration of the housing or cover, for a light source band:
+ *
+ *            lux = (vis * ALS_VIS - ir * ALS_IR) / 1000 / gain
+ *
+ *        The first band with ALS_IR * 1000 / ALS_VIS below ratio applies,
+ *        bands with ratio 0 are unused, beyond the last one used it applies.
+ */
+struct SFH7776_Band {
+  uint16_t ratio;  /* IR/VIS upper bound, scale 1000 */
+  uint16_t vis;    /* ALS_VIS coefficient, scale 1000 */
+  uint16_t ir;     /* ALS_IR coefficient, scale 1000 */
+};
+#define SFH7776_BANDS  6
+
 void SFH7776_ForeverTest(void);
-void SFH7776_Init(uint16_t, uint16_t);
+void SFH7776_Init(uint16_t, uint16_t, uint8_t);
 void SFH7776_Read(void);
 void SFH7776_Reset(void);
+void SFH7776_Interrupt(void);
+void SFH7776_Process(void);
+size_t SFH7776_CalibrationSize(const struct SFH7776_Band *);
 
 extern struct SFH7776_Handle sfh7776;
 struct SFH7776_Handle {
@@ -54,6 +152,14 @@ struct SFH7776_Handle {
 	uint16_t als_ir;
 	uint16_t als_vis_tl;
 	uint16_t lux;
+	uint8_t gain;       /* 1 or 64, of ALS_VIS and ALS_IR */
+	int32_t k;          /* lux per ALS_VIS count at x1 of last sample's band, scale 1000 */
+	uint32_t settle;    /* HW_RTCGetMsTime samples are of the new gain */
+	uint16_t upper;     /* lux thresholds */
+	uint16_t lower;
+	uint8_t hyst;       /* % of the exceeded threshold to come back by */
+	int8_t state;       /* -1 below, 0 within, 1 above thresholds */
+	volatile bool irq;  /* INT fell, awaits SFH7776_Process */
 };
 #endif
 
@@ -61,6 +167,8 @@ struct SFH7776_Handle {
 #ifdef BSEC
 #include "bsec_datatypes.h"
 void BSEC_Init(float sample_rate);
+bool BSEC_Start(void);
+void BSEC_Complete(void);
 void BSEC_Read(void);
 void BSEC_ForeverTest(void);
 uint16_t BSEC_float(float);
@@ -68,20 +176,28 @@ uint16_t BSEC_float(float);
 
 #include "bme680_defs.h"
 void BME680_Init(void);
+void BME680_Start(void);
+int8_t BME680_Complete(void);
 void BME680_Read(void);
 void BME680_ReadOld(void);
 
 extern struct BME680_Handle bme680;
+#ifdef BSEC
 struct BSEC_Handle {
+  bsec_bme_settings_t settings; /* Of the last bsec_sensor_control */
+  int64_t timestamp;
   int64_t next_call;
   float iaq;
   float co2;
   float voc;
   unsigned acc;
 };
+#endif
 struct BME680_Handle {
   struct bme680_dev dev;
   struct bme680_field_data data;
+  uint32_t due;   /* HW_RTCGetMsTime the forced measurement completes */
+  bool pending;   /* Measurement started, not yet read */
 #ifdef BSEC
   struct BSEC_Handle bsec;
 #endif
@@ -97,16 +213,41 @@ enum HDC2080_Threshold {
   HDC2080_HUMIDITY_HIGH,
 };
 
+#define HDC2080_WINDOW(type)  (1U << (type))
+
+#define HDC2080_CONFIG_RATE   0x000007U  /* AMM code, 0 as 5 (1 Hz), 1 (1/120 Hz) .. 7 (5 Hz) */
+#define HDC2080_CONFIG_HYST_T 0x00ff00U  /* Temperature hysteresis, N x 0.1 C */
+#define HDC2080_CONFIG_HYST_H 0xff0000U  /* Humidity hysteresis, N x 0.1 %rH */
+
+/* One quantity, in raw 8-bit threshold (register MSB) representation */
+struct HDC2080_Window {
+  uint8_t lower;   /* Valid with bit 0 of windows */
+  uint8_t upper;   /* Valid with bit 1 of windows */
+  uint8_t hyst;    /* Return into window this far past the exceeded threshold */
+  uint8_t min;     /* Since last scheduled send, 0xff if none yet */
+  uint8_t max;     /* Since last scheduled send, IC peak detector, 0 if none yet */
+  uint8_t windows; /* Bit 0 lower, bit 1 upper threshold enabled */
+  int8_t state;    /* -1 below, 0 within, 1 above window */
+};
+
 void HDC2080_ForeverTest(void);
-void HDC2080_Init(enum HDC2080_Threshold type, int32_t thres);
+void HDC2080_Init(const int32_t thres[4], uint8_t windows, uint32_t config);
 void HDC2080_Read(void);
 void HDC2080_Reset(void);
+void HDC2080_Interrupt(void);
+void HDC2080_Process(void);
+void HDC2080_Extremes(uint8_t out[4]);
 
 extern struct HDC2080_Handle hdc2080;
 struct HDC2080_Handle {
+  volatile bool irq;          /* Threshold crossed or peaks restarted, awaits HDC2080_Process */
+  bool armed;                 /* Windows or config set, INT pin in use */
+  struct HDC2080_Window temp_win;
+  struct HDC2080_Window humid_win;
   uint16_t raw_temp;   /* IC register raw byte representation, unsigned ratio   C = RAW / 65536.0 * 165 - 40 */
   uint16_t raw_humid;  /* IC register raw byte representation, unsigned ratio, rH = RAW / 65536.0 * 100 */
   int16_t fix_temp;  /* scale 100 fixed-point value representation, [-4000, 12499] Celsius */
+  uint32_t fix_humid; /* scale 1000 fixed-point value representation, [0, 99998] %rH */
   uint8_t humid;     /* integer value representation, [0, 99] */
   uint8_t status;
 };
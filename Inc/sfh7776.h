@@ -22,8 +22,11 @@
 
 //-----------------Lux Calculation Settings------------------------
 
-#define GAIN_VIS   64
-#define GAIN_IR    64
+#define GAIN_X1    0x00   /* ALS_PS_CONTROL: ALS_VIS x1, ALS_IR x1 */
+#define GAIN_X64   0x28   /* ALS_PS_CONTROL: ALS_VIS x64, ALS_IR x64 */
+#define GAIN_DOWN  0xf000 /* Switch x64 to x1 at ALS_VIS or ALS_IR counts above */
+#define GAIN_UP    0x0300 /* Switch x1 to x64 at ALS_VIS and ALS_IR counts below */
 #define T_INT_ALS  100
+#define T_ALS      400    /* ALS measurement cycle, ms */
 
 //------------------------------------------------------------------
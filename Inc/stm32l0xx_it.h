@@ -74,6 +74,7 @@ void EXTI2_3_IRQHandler(void);
 void EXTI4_15_IRQHandler(void);
 void DMA1_Channel1_IRQHandler(void);
 void DMA1_Channel2_3_IRQHandler(void);
+void DMA1_Channel4_5_6_7_IRQHandler(void);
 void LPTIM1_IRQHandler(void);
 void I2C1_IRQHandler(void);
 void SPI1_IRQHandler(void);
@@ -5,6 +5,7 @@
 #include "hardware.h"
 #include "stm32l0xx_hal_conf.h"
 #include "i2c.h"
+#include "i2c_xfer.h"
 #include "cryptoauthlib.h"
 #include "atca_devtypes.h"
 
@@ -128,7 +129,7 @@ ATCA_STATUS hal_i2c_send(ATCAIface iface, uint8_t word_address, uint8_t *txdata,
 
 //    int r = hal_data->i2c->write(hal_data->slave_address, (char*)txdata, txlength);
       int r;
-    r = HAL_I2C_Master_Transmit(&hi2c1, 0xC0, txdata, txlength, 100);
+    r = I2C_Transmit(0xC0, txdata, txlength, 100);
 //    DBG_PRINTF("hal_i2c_send returned %x", r);
     if (r != 0) {
         return ATCA_TX_FAIL;
@@ -148,7 +149,7 @@ ATCA_STATUS hal_i2c_receive(ATCAIface iface, uint8_t word_address, uint8_t *rxda
     int retries = hal_data->rx_retries;
     while (--retries > 0 && r != 0) {
         //r = hal_data->i2c->read(hal_data->slave_address, lengthPackage, 1);
-    	r = HAL_I2C_Master_Receive(&hi2c1, 0xC0, lengthPackage, 1, 100);
+    	r = I2C_Receive(0xC0, lengthPackage, 1, 100);
     }
 
     if (r != 0) {
@@ -169,7 +170,7 @@ ATCA_STATUS hal_i2c_receive(ATCAIface iface, uint8_t word_address, uint8_t *rxda
     retries = hal_data->rx_retries;
     while (--retries > 0 && r != 0) {
         //r = hal_data->i2c->read(hal_data->slave_address, (char*)rxdata + 1, bytesToRead);
-    	r = HAL_I2C_Master_Receive(&hi2c1, 0xC0, rxdata+1, bytesToRead, 100);
+    	r = I2C_Receive(0xC0, rxdata+1, bytesToRead, 100);
     }
 
     if (r != 0) {
@@ -184,6 +185,7 @@ ATCA_STATUS hal_i2c_receive(ATCAIface iface, uint8_t word_address, uint8_t *rxda
 
 ATCA_STATUS hal_i2c_wake(ATCAIface iface)
 {
+   /* Wake pulse to general call address, NACK expected, no buffer to queue */
    HAL_I2C_Master_Transmit(&hi2c1, 0x00, 0x00, 1, 100);
    return ATCA_SUCCESS;
 }
@@ -194,7 +196,7 @@ ATCA_STATUS hal_i2c_idle(ATCAIface iface)
 
 	 uint8_t buffer[1] = { 0x2 }; // idle word address value
 	 HAL_StatusTypeDef r;
-     r = HAL_I2C_Master_Transmit(&hi2c1, 0xC0, buffer, 1, 100);
+     r = I2C_Transmit(0xC0, buffer, 1, 100);
 
     return ATCA_SUCCESS;
 }
@@ -205,7 +207,7 @@ ATCA_STATUS hal_i2c_sleep(ATCAIface iface)
 
 	uint8_t buffer[1] = { 0x1 };  // sleep word address value
 	HAL_StatusTypeDef r;
-	r = HAL_I2C_Master_Transmit(&hi2c1, 0xC0, buffer, 1, 100);
+	r = I2C_Transmit(0xC0, buffer, 1, 100);
 
     return ATCA_SUCCESS;
 }
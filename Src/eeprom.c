@@ -1,9 +1,11 @@
 #include "eeprom.h"
 #include "protobuf.h"
-#include "LoRaMac-node/boards/utilities.h"  // Crc32*
+#include "crc32.h"           // CRC32_*
 #include "LoRaMac-node/boards/board.h"      // BoardGetUniqueId
 #include "hardware.h"          // EEPROM_APP
 #include <string.h>            // memcpy
+#include <stddef.h>            // offsetof
+#include <assert.h>
 
 struct DeviceConfig DevCfg = {
   /* LoRaWAN Defaults */
@@ -24,6 +26,9 @@ struct DeviceConfig DevCfg = {
   .sendInterval = 86400, /* 24 hours */
   .sendTrigger = SEND_TRIGGER_ALWAYS,
   .sendStrategy = SEND_STRATEGY_PERIODIC,
+#ifdef HISTORY
+  .history_interval = 300, /* 5 minutes, three samples per 15 minute rollup */
+#endif
 
 #if defined(STX)
   /* BMA400 Defaults (Accelerometer) */
@@ -34,6 +39,10 @@ struct DeviceConfig DevCfg = {
 
   /* SFH7776 Defaults (Luminance) */
   .useSensor.sfh7776 = false,
+  .sfh7776_cal = {{0xffff, 32000, 0}}, /* VIS only, hand measured for the stock cover */
+
+  /* Event Rate Limit Defaults: off (burst 0), 15 min refill and 1 min apart once enabled, 10% luminance hysteresis */
+  .event_limit = 0x0a060f00,
 
 #endif
 };
@@ -50,30 +59,209 @@ static void DebugLE(const uint8_t *buf, uint16_t len) {
   } while(len);
 }
 
-void EEPROM_Load(void) {
-  uint32_t crc = ((uint32_t*)EEPROM_APP)[0];
-  uint32_t len = ((uint32_t*)EEPROM_APP)[1];
-  uint8_t *msg = (uint8_t*)EEPROM_APP + 8;
-  uint8_t pos = 0;
-  const char *debug_msg = "\n";
-  uint8_t debug_fieldpos = 0;
+/*
+ * DESCRIPTION
+ *        EEPROM_APP holds a log-structured key-value store, so a change costs
+ *        a single appended record instead of a full rewrite.
+ *
+ *        The region is split in two banks. A bank holds a header followed by
+ *        records, each record being one or more protobuf key-value fields.
+ *        Records are appended and replayed in order, later fields overriding
+ *        earlier ones. A record holds all fields changed by one save, so a
+ *        multi-field change (e.g. session keys after a join) applies whole
+ *        or not at all.
+ *
+ *            Bank     [gen][~gen][record][record]...
+ *            Record   [seq:16 len:8 rsvd:8][crc32][fields, padded to word]
+ *
+ *        The record CRC covers the bank generation, seq, len and fields.
+ *        Leftovers of older generations thus fail the check and terminate the
+ *        replay, no erase is needed. Fields and CRC are written before the
+ *        seq/len word, so a torn append is simply absent.
+ *
+ *        Once a bank is full, or a field disappears, the whole DevCfg is
+ *        written as one record to the other bank and its header is written
+ *        last. Until then the old bank stays valid.
+ *
+ * NOTES
+ *        The NFC protobuf message is reused. Though we need to store more
+ *        than NFC provides. So IDs of 2047 and downwards are used.
+ */
+struct EEPROM_BankHeader {
+  uint32_t gen;
+  uint32_t gen_complement;
+};
 
-  if(len > EEPROM_APP_END - EEPROM_APP - 8 || len < 10 || *msg || crc != EEPROM_CRC(msg, len)) {
-    DEBUG_MSG("EEPROM ERR Missing. Saving defaults...\n");
+struct EEPROM_RecordHeader {
+  uint16_t seq;
+  uint8_t  len;
+  uint8_t  rsvd;
+  uint32_t crc;
+};
 
-    // Set the MCU's chip ID as DevEUI
-    // TODO: Insert in #PRODUCTION. Helps developing multiple devices under same DevEUI.
-    BoardGetUniqueId(DevCfg.devEui);
+static struct EEPROM_Log {
+  uint32_t bank;  /* Active bank, 0 if none */
+  uint32_t gen;
+  uint32_t tail;  /* Address of next record */
+  uint16_t seq;
+} elog;
+
+/* DevCfg as found in EEPROM */
+static struct DeviceConfig EepromCfg;
+
+#define EEPROM_BANK_HEADER_SIZE  sizeof(struct EEPROM_BankHeader)
+#define EEPROM_RECORD_SIZE(len)  (sizeof(struct EEPROM_RecordHeader) + ((len) + 3) / 4 * 4)
+#define EEPROM_MAX_FIELDS        40
+static_assert(EEPROM_MAX_FIELDS <= 64, "EEPROM_Save tracks changed fields in a uint64_t.");
+
+static uint32_t EEPROM_RecordCRC(uint32_t gen, const struct EEPROM_RecordHeader *hdr, const uint8_t *fields) {
+  uint32_t crc = CRC32_INIT;
+  crc = CRC32_Update(crc, &gen, sizeof gen);
+  crc = CRC32_Update(crc, hdr, offsetof(struct EEPROM_RecordHeader, crc));
+  crc = CRC32_Update(crc, fields, hdr->len);
+  return CRC32_Finalize(crc);
+}
 
-    EEPROM_Save();
+static bool EEPROM_Append(const uint8_t *fields, uint8_t len) {
+  struct EEPROM_RecordHeader hdr = {.seq = elog.seq + 1, .len = len};
+
+  if(!len || elog.tail + EEPROM_RECORD_SIZE(len) > elog.bank + EEPROM_APP_BANK_SIZE)
+    return false;
+
+  hdr.crc = EEPROM_RecordCRC(elog.gen, &hdr, fields);
+
+  /* seq/len last, it's what makes the record visible */
+  if(!HW_WriteEEPROM((void*)(elog.tail + sizeof hdr), fields, len)) return false;
+  if(!HW_WriteEEPROM((void*)(elog.tail + offsetof(struct EEPROM_RecordHeader, crc)), &hdr.crc, sizeof hdr.crc)) return false;
+  if(!HW_WriteEEPROM((void*)elog.tail, &hdr, offsetof(struct EEPROM_RecordHeader, crc))) return false;
+
+  elog.tail += EEPROM_RECORD_SIZE(len);
+  elog.seq++;
+  return true;
+}
+
+/* NAME
+ *        EEPROM_Compact - Write all fields into the other bank
+ *
+ * DESCRIPTION
+ *        Until the bank header is written, the active bank is still the old
+ *        one, so elog is restored on failure.
+ *
+ * RETURN VALUE
+ *        true if the other bank is active.
+ */
+static bool EEPROM_Compact(const uint8_t *fields, uint8_t len) {
+  const struct EEPROM_Log prev = elog;
+  uint32_t bank = elog.bank == EEPROM_APP ? EEPROM_APP + EEPROM_APP_BANK_SIZE : EEPROM_APP;
+  struct EEPROM_BankHeader hdr = {.gen = elog.gen + 1, .gen_complement = ~(elog.gen + 1)};
+
+  elog.bank = bank;
+  elog.gen = hdr.gen;
+  elog.tail = bank + EEPROM_BANK_HEADER_SIZE;
+  elog.seq = 0;
+
+  if(!EEPROM_Append(fields, len)) goto err;
+
+  /* Switch banks */
+  if(!HW_WriteEEPROM((void*)bank, &hdr, sizeof hdr)) goto err;
+
+  DEBUG_PRINTF("EEPROM Compacted gen:%u size:%u\n", elog.gen, elog.tail - elog.bank);
+  return true;
+err:
+  elog = prev;
+  DEBUG_MSG("EEPROM ERR Compaction failed\n");
+  return false;
+}
+
+/* NAME
+ *        EEPROM_Serialize - Serialize DevCfg into protobuf fields
+ *
+ * RETURN VALUE
+ *        Number of fields. ends[i] is the offset past field i, keys[i] its
+ *        protobuf key.
+ */
+static uint8_t EEPROM_Serialize(const struct DeviceConfig *cfg, uint8_t *msg, size_t len, uint8_t *ends, uint32_t *keys) {
+  size_t size = 0;
+  uint8_t n = 0;
+
+#define FIELD(key, ...) do {                                                    \
+    assert(n < EEPROM_MAX_FIELDS);                                              \
+    if(n == EEPROM_MAX_FIELDS) break;                                           \
+    keys[n] = (key);                                                            \
+    size += PBEncodeMsgField(msg, len, size, key, __VA_ARGS__);                 \
+    ends[n++] = size;                                                           \
+  } while(0)
+  FIELD(PBMSG_BX_LORA_OTAA, (uint64_t)cfg->isOtaa);
+  FIELD(PBMSG_BX_LORA_DEV_EUI, u64(cfg->devEui));
+  FIELD(PBMSG_BX_LORA_APP_EUI, u64(cfg->appEui));
+  FIELD(PBMSG_BX_LORA_APP_KEY, PBMSG_BX_LORA_APP_KEY_SIZE, cfg->appKey);
+  FIELD(PBMSG_BX_LORA_DEV_ADDR, cfg->devAddr);
+  FIELD(PBMSG_BX_LORA_MAC_NET_SESSION_KEY, PBMSG_BX_LORA_MAC_NET_SESSION_KEY_SIZE, cfg->nwkSKey);
+  FIELD(PBMSG_BX_LORA_MAC_APP_SESSION_KEY, PBMSG_BX_LORA_MAC_APP_SESSION_KEY_SIZE, cfg->appSKey);
+  FIELD(PBMSG_TX_LORA_FP, (uint64_t)(cfg->region == LORAMAC_REGION_EU868 ? PBENUM_FP_EU868 : PBENUM_FP_US915));
+  FIELD(PBMSG_BX_LORA_PORT, (uint64_t)cfg->txPort);
+  FIELD(PBMSG_TX_LORA_TXP, (uint64_t)cfg->txPower);
+  FIELD(PBMSG_TX_LORA_SF, (uint64_t)cfg->sf);
+  FIELD(PBMSG_TX_LORA_BW, (uint64_t)cfg->bw);
+  FIELD(PBMSG_TX_LORA_CONFIRMED_MESSAGES, (uint64_t)cfg->confirmedMsgs);
+  FIELD(PBMSG_TX_LORA_ADAPTIVE_DATA_RATE, (uint64_t)cfg->adaptiveDatarate);
+  FIELD(PBMSG_TX_LORA_RESPECT_DUTY_CYCLE, (uint64_t)cfg->dutyCycle);
+
+  FIELD(PBMSG_BX_SENSOR_TIMEBASE, (uint64_t)cfg->sendInterval);
+  FIELD(PBMSG_BX_SENSOR_SEND_TRIGGER, (uint64_t)cfg->sendTrigger);
+  FIELD(PBMSG_BX_SENSOR_SEND_STRATEGY, (uint64_t)cfg->sendStrategy);
+#ifdef HISTORY
+  FIELD(PBMSG_BX_SENSOR_HISTORY_INTERVAL, (uint64_t)cfg->history_interval);
+#endif
+
+#if defined(STX)
+  if(cfg->useSensor.hdc2080) {
+    if(cfg->hdc2080_windows & HDC2080_WINDOW(HDC2080_TEMPERATURE_HIGH))
+      FIELD(PBMSG_BX_SENSOR_TEMPERATURE_UPPER_THRESHOLD, PBEncodeSInt(cfg->hdc2080_threshold[HDC2080_TEMPERATURE_HIGH]));
+    if(cfg->hdc2080_windows & HDC2080_WINDOW(HDC2080_TEMPERATURE_LOW))
+      FIELD(PBMSG_BX_SENSOR_TEMPERATURE_LOWER_THRESHOLD, PBEncodeSInt(cfg->hdc2080_threshold[HDC2080_TEMPERATURE_LOW]));
+    if(cfg->hdc2080_windows & HDC2080_WINDOW(HDC2080_HUMIDITY_HIGH))
+      FIELD(PBMSG_BX_SENSOR_HUMIDITY_UPPER_THRESHOLD, (uint64_t)cfg->hdc2080_threshold[HDC2080_HUMIDITY_HIGH]);
+    if(cfg->hdc2080_windows & HDC2080_WINDOW(HDC2080_HUMIDITY_LOW))
+      FIELD(PBMSG_BX_SENSOR_HUMIDITY_LOWER_THRESHOLD, (uint64_t)cfg->hdc2080_threshold[HDC2080_HUMIDITY_LOW]);
+    FIELD(PBMSG_BX_SENSOR_CLIMATE_CONFIGURE, (uint64_t)cfg->hdc2080_config);
+  }
+
+  FIELD(PBMSG_BX_SENSOR_EVENT_LIMIT, (uint64_t)cfg->event_limit);
+
+  if(cfg->useSensor.sfh7776) {
+    FIELD(PBMSG_BX_SENSOR_LUMINANCE_UPPER_THRESHOLD, (uint64_t)cfg->sfh7776_threshold_upper);
+    FIELD(PBMSG_BX_SENSOR_LUMINANCE_LOWER_THRESHOLD, (uint64_t)cfg->sfh7776_threshold_lower);
+    FIELD(PBMSG_BX_SENSOR_LUMINANCE_CALIBRATION, SFH7776_CalibrationSize(cfg->sfh7776_cal), (const uint8_t *)cfg->sfh7776_cal);
+  }
+  if(cfg->useSensor.bma400) {
+    FIELD(PBMSG_BX_SENSOR_AXIS_THRESHOLD, (uint64_t)cfg->bma400_threshold);
+    FIELD(PBMSG_BX_SENSOR_AXIS_CONFIGURE, (uint64_t)cfg->bma400_config);
+    FIELD(PBMSG_BX_SENSOR_AXIS_EVENTS, (uint64_t)cfg->bma400_events);
   }
 
-  crc = ((uint32_t*)EEPROM_APP)[0];
-  len = ((uint32_t*)EEPROM_APP)[1];
+#elif defined(STA)
+  FIELD(PBEEPROM_BUTTON_SINGLE_COUNT, (uint64_t)cfg->singleCount);
+  FIELD(PBEEPROM_BUTTON_DOUBLE_COUNT, (uint64_t)cfg->doubleCount);
+  FIELD(PBEEPROM_BUTTON_LONG_COUNT, (uint64_t)cfg->longCount);
+#endif
+#undef FIELD
+
+  assert(size < len);
+  return n;
+}
 
-  pos++;
+/* NAME
+ *        EEPROM_Apply - Deserialize protobuf fields into DevCfg
+ *
+ * RETURN VALUE
+ *        true on success.
+ */
+static bool EEPROM_Apply(const uint8_t *msg, uint8_t len) {
+  uint8_t pos = 0;
+  const char *debug_msg = "\n";
+  uint8_t debug_fieldpos = 0;
 
-  /* Deserialize EEPROM protobuf into DevCfg */
   /* Each iteration is 1 key-value field */
   while(pos != len) {
     /*
@@ -96,7 +284,7 @@ void EEPROM_Load(void) {
       if(!tagnr_bytes) {
         debug_msg = ", Out-of-bounds varint tagnr\n";
         Breakpoint();
-        goto err;
+        goto abort;
       }
 
       /* Merge value of 1st byte with value of subsequent 1 to 4 bytes. */
@@ -114,7 +302,7 @@ void EEPROM_Load(void) {
     if(!tagnr) {
       debug_msg = ", Ill-formed tagnr\n";
       Breakpoint();
-      goto err;
+      goto abort;
     }
 
     /*
@@ -124,7 +312,7 @@ void EEPROM_Load(void) {
     /* Key without value is ill-formed. */
     if(!(len - pos)) {
       debug_msg = ", Out-of-bounds tag w/o value\n";
-      goto err;
+      goto abort;
     }
 
     /* Need size in case to skip unknown field. */
@@ -163,7 +351,7 @@ void EEPROM_Load(void) {
     default: {
       debug_msg = ", Ill-formed tagtype\n";
       Breakpoint();
-      goto err;
+      goto abort;
       break;
     }
     }
@@ -172,7 +360,7 @@ void EEPROM_Load(void) {
     if(!val_rawbytes) {
       debug_msg = ", Ill-formed value\n";
       Breakpoint();
-      goto err;
+      goto abort;
     }
 
     /*
@@ -214,35 +402,51 @@ void EEPROM_Load(void) {
       DevCfg.sendTrigger = val_int;
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_SEND_STRATEGY) {
       DevCfg.sendStrategy = val_int;
+#ifdef HISTORY
+    } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_HISTORY_INTERVAL) {
+      DevCfg.history_interval = val_int;
+#endif
 #if defined(STX)
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_HUMIDITY_UPPER_THRESHOLD) {
-      DevCfg.hdc2080_threshold = val_int;
-      DevCfg.hdc2080_mode = HDC2080_HUMIDITY_HIGH;
+      DevCfg.hdc2080_threshold[HDC2080_HUMIDITY_HIGH] = val_int;
+      DevCfg.hdc2080_windows |= HDC2080_WINDOW(HDC2080_HUMIDITY_HIGH);
       DevCfg.useSensor.hdc2080 = true;
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_HUMIDITY_LOWER_THRESHOLD) {
-      DevCfg.hdc2080_threshold = val_int;
-      DevCfg.hdc2080_mode = HDC2080_HUMIDITY_LOW;
+      DevCfg.hdc2080_threshold[HDC2080_HUMIDITY_LOW] = val_int;
+      DevCfg.hdc2080_windows |= HDC2080_WINDOW(HDC2080_HUMIDITY_LOW);
       DevCfg.useSensor.hdc2080 = true;
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_TEMPERATURE_UPPER_THRESHOLD) {
-      DevCfg.hdc2080_threshold = PBDecodeSInt(val_int);
-      DevCfg.hdc2080_mode = HDC2080_TEMPERATURE_HIGH;
+      DevCfg.hdc2080_threshold[HDC2080_TEMPERATURE_HIGH] = PBDecodeSInt(val_int);
+      DevCfg.hdc2080_windows |= HDC2080_WINDOW(HDC2080_TEMPERATURE_HIGH);
       DevCfg.useSensor.hdc2080 = true;
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_TEMPERATURE_LOWER_THRESHOLD) {
-      DevCfg.hdc2080_threshold = PBDecodeSInt(val_int);
-      DevCfg.hdc2080_mode = HDC2080_TEMPERATURE_LOW;
+      DevCfg.hdc2080_threshold[HDC2080_TEMPERATURE_LOW] = PBDecodeSInt(val_int);
+      DevCfg.hdc2080_windows |= HDC2080_WINDOW(HDC2080_TEMPERATURE_LOW);
+      DevCfg.useSensor.hdc2080 = true;
+    } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_CLIMATE_CONFIGURE) {
+      DevCfg.hdc2080_config = val_int;
       DevCfg.useSensor.hdc2080 = true;
+    } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_EVENT_LIMIT) {
+      DevCfg.event_limit = val_int;
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_LUMINANCE_UPPER_THRESHOLD) {
       DevCfg.sfh7776_threshold_upper = val_int;
       DevCfg.useSensor.sfh7776 = true;
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_LUMINANCE_LOWER_THRESHOLD) {
       DevCfg.sfh7776_threshold_lower = val_int;
       DevCfg.useSensor.sfh7776 = true;
+    } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_LUMINANCE_CALIBRATION && val_rawbytes && val_rawbytes <= sizeof DevCfg.sfh7776_cal && val_rawbytes % sizeof *DevCfg.sfh7776_cal == 0) {
+      memset(DevCfg.sfh7776_cal, 0, sizeof DevCfg.sfh7776_cal);
+      memcpy(DevCfg.sfh7776_cal, msg + pos, val_rawbytes);
+      DevCfg.useSensor.sfh7776 = true;
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_AXIS_THRESHOLD) {
       DevCfg.bma400_threshold = val_int;
       DevCfg.useSensor.bma400 = true;
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_AXIS_CONFIGURE) {
       DevCfg.bma400_config = val_int;
       DevCfg.useSensor.bma400 = true;
+    } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_AXIS_EVENTS) {
+      DevCfg.bma400_events = val_int;
+      DevCfg.useSensor.bma400 = true;
 #elif defined(STA)
     } else if((tagnr << 3 | tagtype) == PBEEPROM_BUTTON_SINGLE_COUNT) {
       DevCfg.singleCount = val_int;
@@ -263,11 +467,80 @@ void EEPROM_Load(void) {
     pos += val_rawbytes;
   }
 
+  return true;
+abort:
+  DEBUG_MSG("EEPROM ERR <RD Undefined 0x"), DebugLE(msg + debug_fieldpos, len - debug_fieldpos), DBG_PRINTF("%s", debug_msg);
+  return false;
+}
+
+/* NAME
+ *        EEPROM_LoadLegacy - Load the pre-log [crc][len][msg] format
+ *
+ * DESCRIPTION
+ *        Keeps device configs across the firmware update introducing the log.
+ *        The legacy image sits where bank 0 starts, so the next compaction
+ *        goes to bank 1 and overwrites it only afterwards.
+ */
+static bool EEPROM_LoadLegacy(void) {
+  uint32_t crc = ((uint32_t*)EEPROM_APP)[0];
+  uint32_t len = ((uint32_t*)EEPROM_APP)[1];
+  uint8_t *msg = (uint8_t*)EEPROM_APP + 8;
+
+  if(len > EEPROM_APP_END - EEPROM_APP - 8 || len < 10 || *msg || crc != EEPROM_CRC(msg, len))
+    return false;
+
+  DEBUG_MSG("EEPROM Migrating legacy config...\n");
+  return EEPROM_Apply(msg + 1, len - 1);
+}
+
+void EEPROM_Load(void) {
+  /* Find the newest bank */
+  for(uint32_t bank = EEPROM_APP; bank < EEPROM_APP_END; bank += EEPROM_APP_BANK_SIZE) {
+    const struct EEPROM_BankHeader *hdr = (const struct EEPROM_BankHeader*)bank;
+    if(hdr->gen != ~hdr->gen_complement) continue;
+    if(elog.bank && (int32_t)(hdr->gen - elog.gen) <= 0) continue;
+    elog.bank = bank;
+    elog.gen = hdr->gen;
+  }
+
+  if(!elog.bank) {
+    elog.bank = EEPROM_APP;
+    if(!EEPROM_LoadLegacy()) {
+      DEBUG_MSG("EEPROM ERR Missing. Saving defaults...\n");
+
+      // Set the MCU's chip ID as DevEUI
+      // TODO: Insert in #PRODUCTION. Helps developing multiple devices under same DevEUI.
+      BoardGetUniqueId(DevCfg.devEui);
+    }
+
+    /* Nothing in the log yet, EEPROM_Save compacts */
+    elog.gen = 0;
+    elog.tail = EEPROM_APP_END;
+    EEPROM_Save();
+  } else {
+    /* Replay records */
+    elog.tail = elog.bank + EEPROM_BANK_HEADER_SIZE;
+    elog.seq = 0;
+    while(elog.tail + sizeof(struct EEPROM_RecordHeader) <= elog.bank + EEPROM_APP_BANK_SIZE) {
+      const struct EEPROM_RecordHeader *hdr = (const struct EEPROM_RecordHeader*)elog.tail;
+      const uint8_t *fields = (const uint8_t*)(hdr + 1);
+
+      if(!hdr->len || hdr->seq != (uint16_t)(elog.seq + 1)) break;
+      if(elog.tail + EEPROM_RECORD_SIZE(hdr->len) > elog.bank + EEPROM_APP_BANK_SIZE) break;
+      if(hdr->crc != EEPROM_RecordCRC(elog.gen, hdr, fields)) break;
+      if(!EEPROM_Apply(fields, hdr->len)) goto err;
+
+      elog.tail += EEPROM_RECORD_SIZE(hdr->len);
+      elog.seq++;
+    }
+    EepromCfg = DevCfg;
+  }
+
   // Trigger events that apply changes to sensors, lrw and etc.
   memset(&DevCfg.changed, ~0, sizeof DevCfg.changed);
 
   /* Log configs */
-  DEBUG_PRINTF("EEPROM Loaded size:%3d crc32:0x%08x\n", len, crc);
+  DEBUG_PRINTF("EEPROM Loaded gen:%u records:%u size:%u\n", elog.gen, elog.seq, elog.tail - elog.bank);
   DEBUG_PRINTF("EEPROM DevCfg.isOtaa            %x\n", DevCfg.isOtaa);
   DEBUG_MSG(   "EEPROM DevCfg.devEui            "), DebugArr(DevCfg.devEui, sizeof DevCfg.devEui), DEBUG_MSG("\n");
   DEBUG_MSG(   "EEPROM DevCfg.appEui            "), DebugArr(DevCfg.appEui, sizeof DevCfg.appEui), DEBUG_MSG("\n");
@@ -286,80 +559,70 @@ void EEPROM_Load(void) {
 
   return;
 err:
-  DEBUG_MSG("EEPROM ERR <RD Undefined 0x"), DebugLE(msg + debug_fieldpos, len - debug_fieldpos), DBG_PRINTF("%s", debug_msg);;
   DEBUG_MSG("EEPROM Invalidating and rebooting.");
   HW_EraseEEPROM(EEPROM_APP);
   HW_EraseEEPROM(EEPROM_APP + 4);
+  HW_EraseEEPROM(EEPROM_APP + EEPROM_APP_BANK_SIZE);
+  HW_EraseEEPROM(EEPROM_APP + EEPROM_APP_BANK_SIZE + 4);
   NVIC_SystemReset();
 }
 
 /*
  * DESCRIPTION
- *        The NFC protobuf message is reused for EEPROM store. Though we need
- *        to store more than NFC provides. So IDs of 2047 and downwards are
- *        used.
+ *        Appends the fields which differ from what EEPROM holds as a single
+ *        record. Compacts when out of space, or when a field was dropped
+ *        (e.g. sensor disabled, threshold window swapped), as replay can't
+ *        express removal.
  */
 void EEPROM_Save(void) {
-  uint8_t msg[256];
-  size_t len = sizeof msg;
-  size_t size = 1;
-
-  /* 1st byte always zero, to allow future (unlikely) breaking changes */
-  msg[0] = 0;
-
-  /* Serialize DevCfg into a protobuf */
-  size += PBEncodeMsgField(msg, len, size, PBMSG_BX_LORA_OTAA, (uint64_t)DevCfg.isOtaa);
-  size += PBEncodeMsgField(msg, len, size, PBMSG_BX_LORA_DEV_EUI, u64(DevCfg.devEui));
-  size += PBEncodeMsgField(msg, len, size, PBMSG_BX_LORA_APP_EUI, u64(DevCfg.appEui));
-  size += PBEncodeMsgField(msg, len, size, PBMSG_BX_LORA_APP_KEY, PBMSG_BX_LORA_APP_KEY_SIZE, DevCfg.appKey);
-  size += PBEncodeMsgField(msg, len, size, PBMSG_BX_LORA_DEV_ADDR, DevCfg.devAddr);
-  size += PBEncodeMsgField(msg, len, size, PBMSG_BX_LORA_MAC_NET_SESSION_KEY, PBMSG_BX_LORA_MAC_NET_SESSION_KEY_SIZE, DevCfg.nwkSKey);
-  size += PBEncodeMsgField(msg, len, size, PBMSG_BX_LORA_MAC_APP_SESSION_KEY, PBMSG_BX_LORA_MAC_APP_SESSION_KEY_SIZE, DevCfg.appSKey);
-  size += PBEncodeMsgField(msg, len, size, PBMSG_TX_LORA_FP, (uint64_t)(DevCfg.region == LORAMAC_REGION_EU868 ? PBENUM_FP_EU868 : PBENUM_FP_US915));
-  size += PBEncodeMsgField(msg, len, size, PBMSG_BX_LORA_PORT, (uint64_t)DevCfg.txPort);
-  size += PBEncodeMsgField(msg, len, size, PBMSG_TX_LORA_TXP, (uint64_t)DevCfg.txPower);
-  size += PBEncodeMsgField(msg, len, size, PBMSG_TX_LORA_SF, (uint64_t)DevCfg.sf);
-  size += PBEncodeMsgField(msg, len, size, PBMSG_TX_LORA_BW, (uint64_t)DevCfg.bw);
-  size += PBEncodeMsgField(msg, len, size, PBMSG_TX_LORA_CONFIRMED_MESSAGES, (uint64_t)DevCfg.confirmedMsgs);
-  size += PBEncodeMsgField(msg, len, size, PBMSG_TX_LORA_ADAPTIVE_DATA_RATE, (uint64_t)DevCfg.adaptiveDatarate);
-  size += PBEncodeMsgField(msg, len, size, PBMSG_TX_LORA_RESPECT_DUTY_CYCLE, (uint64_t)DevCfg.dutyCycle);
-
-  size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_TIMEBASE, (uint64_t)DevCfg.sendInterval);
-  size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_SEND_TRIGGER, (uint64_t)DevCfg.sendTrigger);
-  size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_SEND_STRATEGY, (uint64_t)DevCfg.sendStrategy);
-
-#if defined(STX)
-  if(DevCfg.useSensor.hdc2080) switch(DevCfg.hdc2080_mode) {
-  case HDC2080_TEMPERATURE_HIGH:  size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_TEMPERATURE_UPPER_THRESHOLD, PBEncodeSInt(DevCfg.hdc2080_threshold)); break;
-  case HDC2080_TEMPERATURE_LOW:   size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_TEMPERATURE_LOWER_THRESHOLD, PBEncodeSInt(DevCfg.hdc2080_threshold)); break;
-  case HDC2080_HUMIDITY_HIGH:     size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_HUMIDITY_UPPER_THRESHOLD, PBEncodeSInt(DevCfg.hdc2080_threshold));    break;
-  case HDC2080_HUMIDITY_LOW:      size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_HUMIDITY_LOWER_THRESHOLD, DevCfg.hdc2080_threshold);                  break;
+  uint8_t msg[256], old[256];
+  uint8_t ends[EEPROM_MAX_FIELDS], oldends[EEPROM_MAX_FIELDS];
+  uint32_t keys[EEPROM_MAX_FIELDS], oldkeys[EEPROM_MAX_FIELDS];
+  uint8_t n = EEPROM_Serialize(&DevCfg, msg, sizeof msg, ends, keys);
+  uint8_t oldn = EEPROM_Serialize(&EepromCfg, old, sizeof old, oldends, oldkeys);
+  uint64_t changed = 0;
+  uint8_t size = 0;
+
+  if(elog.tail >= elog.bank + EEPROM_APP_BANK_SIZE)
+    goto compact;
+
+  /* Any old key missing from the new fields would be resurrected on replay */
+  for(uint8_t j = 0; j < oldn; j++) {
+    uint8_t i = 0;
+    while(i < n && keys[i] != oldkeys[j]) i++;
+    if(i == n) goto compact;
   }
 
-  if(DevCfg.useSensor.sfh7776) {
-    size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_LUMINANCE_UPPER_THRESHOLD, (uint64_t)DevCfg.sfh7776_threshold_upper);
-    size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_LUMINANCE_LOWER_THRESHOLD, (uint64_t)DevCfg.sfh7776_threshold_lower);
-  }
-  if(DevCfg.useSensor.bma400) {
-    size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_AXIS_THRESHOLD, (uint64_t)DevCfg.bma400_threshold);
-    size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_AXIS_CONFIGURE, (uint64_t)DevCfg.bma400_config);
+  for(uint8_t i = 0; i < n; i++) {
+    uint8_t start = i ? ends[i - 1] : 0, fieldsize = ends[i] - start;
+    bool found = false;
+
+    for(uint8_t j = 0; j < oldn && !found; j++) {
+      uint8_t oldstart = j ? oldends[j - 1] : 0;
+      found = oldends[j] - oldstart == fieldsize && !memcmp(msg + start, old + oldstart, fieldsize);
+    }
+
+    if(!found) changed |= 1ULL << i;
   }
 
-#elif defined(STA)
-  size += PBEncodeMsgField(msg, len, size, PBEEPROM_BUTTON_SINGLE_COUNT, (uint64_t)DevCfg.singleCount);
-  size += PBEncodeMsgField(msg, len, size, PBEEPROM_BUTTON_DOUBLE_COUNT, (uint64_t)DevCfg.doubleCount);
-  size += PBEncodeMsgField(msg, len, size, PBEEPROM_BUTTON_LONG_COUNT, (uint64_t)DevCfg.longCount);
-#endif
+  /* Gather the changed fields into old, no longer needed */
+  for(uint8_t i = 0; i < n; i++) {
+    uint8_t start = i ? ends[i - 1] : 0;
+    if(!(changed & 1ULL << i)) continue;
+    memcpy(old + size, msg + start, ends[i] - start);
+    size += ends[i] - start;
+  }
 
-  /* Erase EEPROM */
-  HW_ResetEEPROM((void*)(EEPROM_APP + 8), size);
+  if(size && !EEPROM_Append(old, size))
+    goto compact;
 
-  /* Save CRC, length and protobuf to EEPROM */
-  HW_ProgramEEPROM(EEPROM_APP, EEPROM_CRC(msg, size));
-  HW_ProgramEEPROM(EEPROM_APP + 4, size);
-  HW_WriteEEPROM((void*)(EEPROM_APP + 8), msg, size);
+  EepromCfg = DevCfg;
+  return;
+compact:
+  if(EEPROM_Compact(msg, ends[n - 1]))
+    EepromCfg = DevCfg;
 }
 
 uint32_t EEPROM_CRC(const uint8_t *buf, size_t size) {
-  return Crc32Finalize(Crc32Update(Crc32Init(), buf, size));
+  return CRC32_Finalize(CRC32_Update(CRC32_INIT, buf, size));
 }
@@ -3,6 +3,7 @@
 #include "gpio.h"
 #include "hardware.h"
 #include "i2c.h"
+#include "i2c_xfer.h"
 #include "lptim.h"
 #include "main.h"
 #include "nfc.h"
@@ -13,11 +14,12 @@
 #include "st25dv.h"
 #include "task_mgr.h"
 #include "eeprom.h"
+#include "LoRaMac-node/boards/utilities.h"
+#include "LoRaMac-node/boards/rtc-board.h"
 #include <assert.h>
 #include <inttypes.h>
 #include <stdarg.h>
 #include <string.h>
-#include <time.h>
 
 extern ADC_HandleTypeDef hadc;
 extern LPTIM_HandleTypeDef hlptim1;
@@ -25,6 +27,28 @@ struct WakeUpHandler wuh;
 volatile int adcConvDone = 0;
 bool hwSlept;
 
+/* RTC ticks HW_StopUntil keeps awake for, Alarm B programming and
+ * Stop entry outweigh shorter naps. At most HW_STOP_MAX_TICKS per alarm, as
+ * it only compares seconds and sub-seconds. */
+#define HW_STOP_MIN_TICKS   3
+#define HW_STOP_MAX_TICKS   (59 << N_PREDIV_S)
+#define HW_TICKS_SUBSECOND  ((1U << N_PREDIV_S) - 1)  /* Sub-second register counts down from it */
+static_assert(1000000000 % (1 << N_PREDIV_S) == 0, "HW_RTCGetNsTime multiplies by ns per tick.");
+
+/* Centi-degC the MCU may drift from the last ADC calibration */
+#define HW_ADC_CAL_BAND     1000
+
+/* Last battery voltage and MCU temperature measurement */
+static struct {
+  uint32_t ts;                /* HW_RTCGetMsTime of measurement */
+  uint16_t millivolts;
+  int16_t centicelsius;
+  int16_t cal_centicelsius;   /* MCU temperature at last calibration */
+  uint16_t calibrations;
+  bool calibrated;
+  bool valid;
+} hwADC;
+
 /* NAME
  *        PrepareWakeup - Schedules RTC WUT to soonest event
  *
@@ -37,16 +61,20 @@ void PrepareWakeup(enum WakeUpReason reason, uint32_t duration) {
 
   /* Apply settings */
   switch(reason) {
-  case WAKEUP_LRW_NONE:      wuh.dutycycle_due = wuh.schedmsg_due = wuh.bsec_due = 0;  break;
-  case WAKEUP_LRW_DUTYCYCLE: wuh.dutycycle_due = duration ? now + duration : 0;        break;
-  case WAKEUP_LRW_SCHEDMSG:  wuh.schedmsg_due  = duration ? now + duration : 0;        break;
-  case WAKEUP_BSEC_SAMPLE:   wuh.bsec_due      = duration ? now + duration : 0;        break;
+  case WAKEUP_LRW_NONE:        wuh.dutycycle_due = wuh.schedmsg_due = wuh.bsec_due = wuh.history_due = wuh.hold_due = 0;  break;
+  case WAKEUP_LRW_DUTYCYCLE:   wuh.dutycycle_due = duration ? now + duration : 0;        break;
+  case WAKEUP_LRW_SCHEDMSG:    wuh.schedmsg_due  = duration ? now + duration : 0;        break;
+  case WAKEUP_BSEC_SAMPLE:     wuh.bsec_due      = duration ? now + duration : 0;        break;
+  case WAKEUP_HISTORY_SAMPLE:  wuh.history_due   = duration ? now + duration : 0;        break;
+  case WAKEUP_HISTORY_HOLD:    wuh.hold_due      = duration ? now + duration : 0;        break;
   }
 
   /* Fix overdue dues */
   if(wuh.dutycycle_due && wuh.dutycycle_due < now) wuh.dutycycle_due = now;
   if(wuh.schedmsg_due  && wuh.schedmsg_due  < now) wuh.schedmsg_due  = now;
   if(wuh.bsec_due      && wuh.bsec_due      < now) wuh.bsec_due      = now;
+  if(wuh.history_due   && wuh.history_due   < now) wuh.history_due   = now;
+  if(wuh.hold_due      && wuh.hold_due      < now) wuh.hold_due      = now;
 
   /* Conclude wakeup timer state */
   wuh.reason = WAKEUP_LRW_NONE;
@@ -62,6 +90,14 @@ void PrepareWakeup(enum WakeUpReason reason, uint32_t duration) {
     due = wuh.bsec_due;
     wuh.reason = WAKEUP_BSEC_SAMPLE;
   }
+  if(wuh.history_due && (!due || wuh.history_due < due)) {
+    due = wuh.history_due;
+    wuh.reason = WAKEUP_HISTORY_SAMPLE;
+  }
+  if(wuh.hold_due && (!due || wuh.hold_due < due)) {
+    due = wuh.hold_due;
+    wuh.reason = WAKEUP_HISTORY_HOLD;
+  }
 
   if(due) {
     HW_RTCWUTSet(due - now);
@@ -87,45 +123,252 @@ uint32_t I2C_Scan(void) {
   return device_count;
 }
 
-/*
+/* Known I2C devices by 8-bit address, the index is the bit in the presence map.
+ * ATECC608A is left out, it sleeps and NACKs until woken by cryptoauthlib. */
+static const uint8_t I2C_Known[] = {
+  ST25DV_ADDR_DATA_I2C,
+#ifdef HDC2080
+  0x80,
+#endif
+#ifdef SFH7776
+  0x72,
+#endif
+#ifdef BMA400
+  0x14 << 1,
+#endif
+#ifdef BME680
+  0x76 << 1,
+#endif
+};
+static_assert(sizeof I2C_Known <= 16, "I2C presence map is a half-word.");
+
+/* Presence map by I2C_Known index, see I2C_Probe */
+static uint16_t i2c_present;
+static volatile bool i2c_reprobe;
+
+/* NAME
+ *        I2C_Probe - Boot-time presence check of the known I2C devices.
+ *
+ * DESCRIPTION
+ *        The presence map of the last boot is kept at EEPROM_I2CMAP, with its
+ *        complement in the upper half-word. Devices the map lists as present get
+ *        a single probe each. Only when the map is invalid or a device went missing,
+ *        the remaining known devices are probed too and the map rewritten.
+ *
+ * NOTES
+ *        Replaces the boot-time I2C_Scan, which probes all 127 addresses twice.
+ *        Define I2C_DIAGNOSTIC to have main() run the full scan anyway.
+ *
+ * RETURN VALUE
+ *        Number of known devices present.
+ */
+uint32_t I2C_Probe(void) {
+  uint32_t cached, device_count = 0;
+  uint16_t map, present = 0;
+
+  HW_ReadEEPROM((void*)EEPROM_I2CMAP, &cached, sizeof cached);
+  map = cached;
+  if((uint16_t)(cached >> 16) != (uint16_t)~map)
+    map = (1U << sizeof I2C_Known) - 1;
+
+  for(uint32_t i = 0; i < sizeof I2C_Known; i++) {
+    if((map & 1U << i) && HAL_I2C_IsDeviceReady(&hi2c1, I2C_Known[i], 1, 2) == HAL_OK)
+      present |= 1U << i;
+  }
+
+  /* Cache miss, take a closer look at the ones assumed absent */
+  if(present != map) {
+    for(uint32_t i = 0; i < sizeof I2C_Known; i++) {
+      if(!(map & 1U << i) && HAL_I2C_IsDeviceReady(&hi2c1, I2C_Known[i], 1, 2) == HAL_OK)
+        present |= 1U << i;
+    }
+    DBG_PRINTF("I2C presence map 0x%04x -> 0x%04x\n", map, present);
+    HW_ProgramEEPROM(EEPROM_I2CMAP, (uint32_t)(uint16_t)~present << 16 | present);
+  }
+
+  i2c_present = present;
+  for(uint32_t i = 0; i < sizeof I2C_Known; i++)
+    device_count += present >> i & 1;
+  return device_count;
+}
+
+/* NAME
+ *        I2C_Present - Whether I2C_Probe found the device at 8-bit addr
+ *
+ * NOTES
+ *        Devices I2C_Known doesn't list are assumed present.
+ */
+bool I2C_Present(uint8_t addr) {
+  for(uint32_t i = 0; i < sizeof I2C_Known; i++)
+    if(I2C_Known[i] == addr)
+      return i2c_present & 1U << i;
+  return true;
+}
+
+/* NAME
+ *        I2C_RequestProbe - Have the main loop re-run I2C_Probe, ISR safe
+ *
+ * DESCRIPTION
+ *        Bus recovery happens in the NFC interrupt, where probing every known
+ *        device and programming EEPROM would stall it.
+ */
+void I2C_RequestProbe(void) {
+  i2c_reprobe = true;
+}
+
+/* NAME
+ *        I2C_Process - Run a requested I2C_Probe
+ */
+void I2C_Process(void) {
+  if(!i2c_reprobe)
+    return;
+  i2c_reprobe = false;
+  if(!I2C_Probe())
+    DEBUG_MSG("I2C ERR Reprobe found no devices!\n");
+}
+
+/* NAME
+ *        HW_BootPhase - Timestamp a boot phase, up to the first uplink.
+ *
+ * DESCRIPTION
+ *        Records milliseconds since BOOT_START into bootPhase[], once per boot.
+ *        RTC time is used since SysTick halts in Stop mode, which the device
+ *        enters before the first uplink completes.
+ */
+uint32_t bootPhase[BOOT_PHASES];
+void HW_BootPhase(enum BootPhase phase) {
+  static const char *const name[BOOT_PHASES] = {
+    [BOOT_START]        = "START",
+    [BOOT_I2C]          = "I2C",
+    [BOOT_EEPROM]       = "EEPROM",
+    [BOOT_LRW]          = "LRW",
+    [BOOT_NFC]          = "NFC",
+    [BOOT_ATECC]        = "ATECC",
+    [BOOT_SENSORS]      = "SENSORS",
+    [BOOT_FIRST_UPLINK] = "UPLINK",
+  };
+  static uint32_t start, recorded;
+  uint32_t now = HW_RTCGetMsTime();
+
+  if(recorded & 1U << phase)
+    return;
+  recorded |= 1U << phase;
+  if(phase == BOOT_START)
+    start = now;
+
+  bootPhase[phase] = now - start;
+  DBG_PRINTF("BOOT %s %d ms\n", name[phase], bootPhase[phase]);
+}
+
+/* NAME
+ *        HW_ADCMeasure - Convert VREFINT and the temperature sensor once
+ *
+ * DESCRIPTION
+ *        The ADC oversamples each channel 16x, DMA stores both and the MCU
+ *        sleeps until the transfer completes. The temperature sensor and
+ *        VREFINT are only connected to the ADC for the conversion.
+ *
+ *        Calibration is kept in the ADC, which retains it through Stop mode,
+ *        and only redone when the MCU temperature has drifted more than
+ *        HW_ADC_CAL_BAND from the last calibration.
+ *
  * RETURN VALUE
- *        Millivolts, e.g. 3263, 3293 is 3.263V and 3.293V respectively.
+ *        False if the ADC couldn't be calibrated or started.
  */
-void getBatteryVoltageAndTemperature(float *voltage, float *temperature) {
-  // ADC self calibration, has to be done before any ADC Start/Enable
-  while (HAL_ADCEx_Calibration_Start(&hadc, ADC_SINGLE_ENDED) != HAL_OK);
+static bool HW_ADCMeasure(void) {
+  const uint32_t VREFINT_CAL = *VREFINT_CAL_ADDR;
+  const int32_t TEMP30_CAL   = *TEMPSENSOR_CAL1_ADDR;
+  const int32_t TEMP130_CAL  = *TEMPSENSOR_CAL2_ADDR;
+  const int32_t TEMP30       = TEMPSENSOR_CAL1_TEMP;
+  const int32_t TEMP130      = TEMPSENSOR_CAL2_TEMP;
+  const uint32_t FACTORY_MV  = 3000;
+  const bool calibrate       = !hwADC.calibrated;
+  volatile uint16_t raw[2] = { 0, 0 };
+  int32_t ts, drift;
+
+  /* ADC self calibration, has to be done while ADC is disabled */
+  if(calibrate) {
+    if(HAL_ADCEx_Calibration_Start(&hadc, ADC_SINGLE_ENDED) != HAL_OK)
+      return false;
+    hwADC.calibrated = true;
+    hwADC.calibrations++;
+  }
 
-  // values for calculation of actually VDDA-supply and reference voltage
-  const uint16_t VREFINT_CAL  = *VREFINT_CAL_ADDR;
-  const uint16_t TEMP30_CAL   = *TEMPSENSOR_CAL1_ADDR;
-  const uint16_t TEMP130_CAL  = *TEMPSENSOR_CAL2_ADDR;
-  const uint16_t TEMP30       = TEMPSENSOR_CAL1_TEMP;
-  const uint16_t TEMP130      = TEMPSENSOR_CAL2_TEMP;
-  const float    FACTORY_VOLT = 3.0;
+  /* Both need 10 us to start up */
+  ADC->CCR |= ADC_CCR_TSEN | ADC_CCR_VREFEN;
+  HAL_Delay(1);
 
-  // Start ADC with DMA support
-  volatile uint16_t adc_value[2] = { 0, 0 };
-  HAL_ADC_Start_DMA(&hadc, (uint32_t*) adc_value, 2);
+  adcConvDone = 0;
+  if(HAL_ADC_Start_DMA(&hadc, (uint32_t*) raw, 2) != HAL_OK) {
+    ADC->CCR &= ~(ADC_CCR_TSEN | ADC_CCR_VREFEN);
+    return false;
+  }
 
-  // Wait for ADC-DMA to finish (note the volatile global)
-  for(adcConvDone = 0; !adcConvDone;);
+  /* Sleep until ADC-DMA finishes. An ISR spins, DMA IRQ may not preempt it */
+  if(__get_IPSR()) {
+    while(!adcConvDone);
+  } else {
+    __disable_irq();
+    while(!adcConvDone) {
+      __WFI();
+      __enable_irq();
+      __disable_irq();
+    }
+    __enable_irq();
+  }
 
   HAL_ADC_Stop_DMA(&hadc);
+  ADC->CCR &= ~(ADC_CCR_TSEN | ADC_CCR_VREFEN);
+
+  if(!raw[0])
+    return false;
+
+  /* VDDA from VREFINT, factory calibrated at 3.0 V */
+  hwADC.millivolts = FACTORY_MV * VREFINT_CAL / raw[0];
 
-  // Calculate
-  float vdda = (FACTORY_VOLT * VREFINT_CAL) / adc_value[0];
-  float temp = (float)adc_value[1] * ((float)vdda / FACTORY_VOLT) - (float)TEMP30_CAL;
-  temp *= TEMP130     - TEMP30;
-  temp /= TEMP130_CAL - TEMP30_CAL;
-  temp += 30;
+  /* Temperature sensor reading scaled to 3.0 V VDDA, then linear between
+   * the factory points at 30 and 130 degC */
+  ts = (int32_t)(raw[1] * hwADC.millivolts / FACTORY_MV);
+  hwADC.centicelsius = (ts - TEMP30_CAL) * (TEMP130 - TEMP30) * 100 / (TEMP130_CAL - TEMP30_CAL) + TEMP30 * 100;
 
-  *voltage = vdda;
-  *temperature = temp;
+  /* Drifted out of band, next measurement recalibrates */
+  drift = hwADC.centicelsius - hwADC.cal_centicelsius;
+  if(calibrate)
+    hwADC.cal_centicelsius = hwADC.centicelsius;
+  else if(drift > HW_ADC_CAL_BAND || drift < -HW_ADC_CAL_BAND)
+    hwADC.calibrated = false;
+
+  hwADC.ts = HW_RTCGetMsTime();
+  hwADC.valid = true;
+  return true;
+}
+
+/* NAME
+ *        getBatteryVoltageAndTemperature - Battery voltage and MCU temperature
+ *
+ * DESCRIPTION
+ *        Served from the last measurement while it's younger than ADC_MAX_AGE
+ *        milliseconds. In an ISR any earlier measurement is served, the ADC
+ *        is only used if there's none.
+ *
+ * RETURN VALUE
+ *        Millivolts, e.g. 3263, 3293 is 3.263V and 3.293V respectively, and
+ *        hundredths of degC. Zero if the ADC has failed.
+ */
+void getBatteryVoltageAndTemperature(uint16_t *millivolts, int16_t *centicelsius) {
+  if(!hwADC.valid || (!__get_IPSR() && HW_ADCAge() >= ADC_MAX_AGE))
+    if(!HW_ADCMeasure())
+      DBG_PRINTF("ADC ERR measure\n");
+
+  *millivolts = hwADC.valid ? hwADC.millivolts : 0;
+  *centicelsius = hwADC.valid ? hwADC.centicelsius : 0;
 }
 
-void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c) {
-  // I2C DMA Complete transfer callback
-  HAL_GPIO_WritePin(LED_1_GPIO_Port, LED_1_Pin, GPIO_PIN_RESET);
+/* NAME
+ *        HW_ADCAge - Milliseconds since battery voltage was last measured
+ */
+uint32_t HW_ADCAge(void) {
+  return hwADC.valid ? HW_RTCGetMsTime() - hwADC.ts : UINT32_MAX;
 }
 
 void LEDBlinkSync(uint8_t times, uint16_t led) {
@@ -405,7 +648,6 @@ void HW_EnterStopMode() {
   // TODO: Remove in #PRODUCTION. Helps development, as Stop Mode disconnects GDB.
   // return;
 
-  HAL_ADC_DeInit(&hadc);
   //HAL_LPTIM_Counter_Stop_IT(&hlptim1);
   //HAL_LPTIM_MspDeInit(&hlptim1);
 
@@ -435,7 +677,6 @@ void HW_ExitStopMode() {
 
   HAL_NVIC_ClearPendingIRQ(EXTI4_15_IRQn);
   HAL_NVIC_ClearPendingIRQ(EXTI0_1_IRQn);
-  HAL_ADC_Init(&hadc);
 
   hal_reinit();
 
@@ -451,18 +692,41 @@ void HW_ExitStopMode() {
   //HAL_LPTIM_Counter_Start_IT(&hlptim1, TIMER_COUNT);
 }
 
+/* NAME
+ *        HW_ProgramEEPROMWord - Program a word, unless it already holds data
+ *
+ * DESCRIPTION
+ *        Data EEPROM must be unlocked. Word programming on the STM32L0
+ *        erases implicitly, so no separate erase is needed beforehand.
+ *
+ *        Interrupts are held off for a single word (~3.2 ms erase + program)
+ *        at most, rather than for the whole buffer.
+ *
+ * NOTES
+ *        Unchanged words cost neither time nor wear.
+ */
+static HAL_StatusTypeDef HW_ProgramEEPROMWord(uint32_t address, uint32_t data) {
+  HAL_StatusTypeDef status;
+
+  if(*(volatile uint32_t*)address == data)
+    return HAL_OK;
+
+  CRITICAL_SECTION_BEGIN();
+  status = HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_WORD, address, data);
+  CRITICAL_SECTION_END();
+  return status;
+}
+
 void HW_EraseEEPROM(uint32_t address) {
-  HAL_FLASHEx_DATAEEPROM_Unlock();
-  if (HAL_FLASHEx_DATAEEPROM_Erase(address) != HAL_OK) {
-    DBG_PRINTF("ERROR ERASING EEPROM: 0x%02X!\n", address);
-  }
-  HAL_FLASHEx_DATAEEPROM_Lock();
+  HW_ProgramEEPROM(address, 0);
 }
 
 void HW_ProgramEEPROM(uint32_t address, uint32_t data) {
+  if(*(volatile uint32_t*)address == data)
+    return;
+
   HAL_FLASHEx_DATAEEPROM_Unlock();
-  if (HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_WORD, address, data)
-      != HAL_OK) {
+  if (HW_ProgramEEPROMWord(address, data) != HAL_OK) {
     DBG_PRINTF("ERROR PROGRAMMING EEPROM: 0x%02X!\n", address);
   }
   HAL_FLASHEx_DATAEEPROM_Lock();
@@ -472,7 +736,7 @@ void HW_ResetEEPROM(void *addr, size_t size) {
   HAL_FLASHEx_DATAEEPROM_Unlock();
   // (size + 3) / 4 is a method of rounding up integer division
   for(size_t i = 0; i < (size + 3) / 4; i++) {
-    if (HAL_FLASHEx_DATAEEPROM_Erase((uint32_t)addr + i * 4) != HAL_OK) {
+    if (HW_ProgramEEPROMWord((uint32_t)addr + i * 4, 0) != HAL_OK) {
       DBG_PRINTF("ERROR CLEARING EEPROM: 0x%02X!\n", addr);
       Breakpoint();
     }
@@ -481,34 +745,47 @@ void HW_ResetEEPROM(void *addr, size_t size) {
 
 }
 
-void HW_WriteEEPROM(void *addr, const void *buf, size_t size) {
+/* NAME
+ *        HW_WriteEEPROM - Write buffer to data EEPROM, word by word
+ *
+ * DESCRIPTION
+ *        Unaligned head and tail are merged with the surrounding EEPROM
+ *        contents, so any address and size work. Only words whose contents
+ *        differ are programmed.
+ *
+ * RETURN VALUE
+ *        true on success.
+ */
+bool HW_WriteEEPROM(void *addr, const void *buf, size_t size) {
   assert_param(IS_FLASH_DATA_ADDRESS(addr));
   assert_param(IS_FLASH_DATA_ADDRESS(addr + size));
   if(HAL_FLASHEx_DATAEEPROM_Unlock()) goto err;
 
   /* Store to initial non-word address */
-  if((uintptr_t)addr % 4) {
+  if((uintptr_t)addr % 4 && size) {
     size_t off = (uintptr_t)addr % 4, len = 4 - off > size ? size : 4 - off;
     uint32_t *prev = (uint32_t*)((uintptr_t)addr >> 2 << 2), word = *prev;
     memcpy((char*)&word + off, buf, len);
-    if(HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_WORD, (uint32_t)prev, word)) goto err;
+    if(HW_ProgramEEPROMWord((uint32_t)prev, word)) goto err;
     addr = prev + 1, buf = (char*)buf + len, size -= len;
   }
 
-  assert((uintptr_t)addr % 4 == 0);
+  assert((uintptr_t)addr % 4 == 0 || !size);
 
   /* Store to word aligned addresses */
   for(size_t i = 0; i * 4 < size; i++) {
     uint32_t word;
     memcpy(&word, (char*)buf + i * 4, i * 4 + 4 > size ? (word = ((uint32_t*)addr)[i], size % 4) : 4);
-    if(HAL_FLASHEx_DATAEEPROM_Program(FLASH_TYPEPROGRAMDATA_WORD, (uint32_t)addr + i * 4, word)) goto err;
+    if(HW_ProgramEEPROMWord((uint32_t)addr + i * 4, word)) goto err;
   }
 
   if(HAL_FLASHEx_DATAEEPROM_Lock()) goto err;
 
-  return;
+  return true;
 err:
+  HAL_FLASHEx_DATAEEPROM_Lock();
   DBG_PRINTF("EEPROM <WR ERR %p buf:%p size:%zu err:%" PRIx32 "\n", addr, buf, size, HAL_FLASH_GetError());
+  return false;
 }
 
 void HW_ReadEEPROM(const void *addr, void *buf, size_t size) {
@@ -526,8 +803,6 @@ void HW_ReadEEPROM(const void *addr, void *buf, size_t size) {
  *            12345678 is 0x78563412 passed as argument.
  */
 void HW_ChangePW(uint32_t password) {
-  HW_EraseEEPROM(EEPROM_PW);
-  HW_EraseEEPROM(EEPROM_PW_COMPLEMENT);
   HW_ProgramEEPROM(EEPROM_PW,             password);
   HW_ProgramEEPROM(EEPROM_PW_COMPLEMENT, ~password);
 }
@@ -536,95 +811,44 @@ void HW_ChangePW(uint32_t password) {
  *        HW_RTCGetMsTime - millisecond time wraps ~49 days with 256 Hz fidelity.
  *
  * DESCRIPTION
- *        RTC sub-second register default frequency is 256 Hz. The .SubSeconds
- *        is a downcounter, e.g. 255 is 0 ms and 254 is aprox 3 ms further.
+ *        RTC sub-second register frequency is 1 << N_PREDIV_S, 256 Hz,
+ *        RtcGetTicks counts these ticks monotonically since RtcInit.
  *
- *               ms = (.SecondFraction - .SubSeconds) * 1000 / (.SecondFraction + 1)
+ *               ms = ticks * 1000 >> N_PREDIV_S
  *
  *        Cortex System Timer (SysTick 1000 Hz) is stopped in STOP MODE,
  *        whereas RTC keeps ticking. SysTick powers HAL_Delay.
  *
  * NOTES
  *        The timestamp should only be used for distance calculations, not as
- *        calendar time.  The time_t type and value is implementation-defined
- *        by linked libc, and we're using it in a freestanding environment.
+ *        calendar time.
  *
- *        | ISO C              | HAL                 | Notes                          |
- *        |--------------------+---------------------+--------------------------------|
- *        | .tm_sec[0, 60]     | .Seconds[0, 59]     |                                |
- *        | .tm_min[0, 59]     | .Minutes[0, 59]     |                                |
- *        | .tm_hour[0, 23]    | .Hours[0, 23 or 12] |                                |
- *        | .tm_wday[0, 6]     | .WeekDay[1, 7]      | See RTC_WeekDay_Definitions    |
- *        | .tm_mday[1, 31]    | .Date[1, 31]        |                                |
- *        | .tm_mon[0, 11]     | .Month[1, 12]       | See RTC_Month_Date_Definitions |
- *        | .tm_year[1970 + x] | .Year[0, 99]        |                                |
+ *        Called from the button, reed switch and NFC ISRs, so keep it free of
+ *        libc time conversions and divisions. RtcGetTicks only redoes the
+ *        calendar day arithmetic when the date changes.
  */
 uint32_t HW_RTCGetMsTime(void) {
-  RTC_TimeTypeDef ts;
-  RTC_DateTypeDef ds;
-  struct tm timeinfo;
-  time_t seconds;
-
-  HAL_RTC_GetTime(&hrtc, &ts, FORMAT_BIN);
-  HAL_RTC_GetDate(&hrtc, &ds, FORMAT_BIN);
-  timeinfo.tm_sec  = ts.Seconds;
-  timeinfo.tm_min  = ts.Minutes;
-  timeinfo.tm_hour = ts.Hours;
-  timeinfo.tm_mday = ds.Date;
-  timeinfo.tm_mon  = ds.Month - 1;
-  timeinfo.tm_year = ds.Year + 70;
-  seconds = mktime(&timeinfo);
-  return seconds * 1000 + (ts.SecondFraction - ts.SubSeconds) * 1000 / (ts.SecondFraction + 1);
+  return RtcGetTicks() * 1000 >> N_PREDIV_S;
 }
 
 /* NAME
- *        HW_RTCGetNsTime - nanosecond time wraps 100 years (RTC defined).
+ *        HW_RTCGetNsTime - nanosecond time, monotonic since RtcInit.
  *
  * SEE ALSO
  *        HW_RTC_GetMsTime
  */
 int64_t HW_RTCGetNsTime(void) {
-  RTC_TimeTypeDef ts;
-  RTC_DateTypeDef ds;
-  struct tm timeinfo;
-  time_t seconds;
-  int64_t ns;
-
-  HAL_RTC_GetTime(&hrtc, &ts, FORMAT_BIN);
-  HAL_RTC_GetDate(&hrtc, &ds, FORMAT_BIN);
-  timeinfo.tm_sec  = ts.Seconds;
-  timeinfo.tm_min  = ts.Minutes;
-  timeinfo.tm_hour = ts.Hours;
-  timeinfo.tm_mday = ds.Date;
-  timeinfo.tm_mon  = ds.Month - 1;
-  timeinfo.tm_year = ds.Year + 70;
-  seconds = mktime(&timeinfo);
-  ns = (int64_t)seconds * 1000 * 1000 * 1000 + (uint64_t)(ts.SecondFraction - ts.SubSeconds) * 1000 * 1000 * 1000 / (ts.SecondFraction + 1);
-  return ns;
+  return RtcGetTicks() * (1000000000 >> N_PREDIV_S);
 }
 
 /* NAME
- *        HW_RTCGetSTime - seconds time wraps 100 years (RTC defined).
+ *        HW_RTCGetSTime - seconds time, monotonic since RtcInit.
  *
  * SEE ALSO
  *        HW_RTC_GetMsTime
  */
 uint32_t HW_RTCGetSTime(void) {
-  RTC_TimeTypeDef ts;
-  RTC_DateTypeDef ds;
-  struct tm timeinfo;
-  time_t seconds;
-
-  HAL_RTC_GetTime(&hrtc, &ts, FORMAT_BIN);
-  HAL_RTC_GetDate(&hrtc, &ds, FORMAT_BIN);
-  timeinfo.tm_hour = ts.Hours;
-  timeinfo.tm_min  = ts.Minutes;
-  timeinfo.tm_sec  = ts.Seconds;
-  timeinfo.tm_mday = ds.Date;
-  timeinfo.tm_mon  = ds.Month - 1;
-  timeinfo.tm_year = ds.Year + 70;
-  seconds = mktime(&timeinfo);
-  return seconds;
+  return RtcGetTicks() >> N_PREDIV_S;
 }
 
 void HW_RTCWUTSet(uint32_t seconds) {
@@ -633,6 +857,79 @@ void HW_RTCWUTSet(uint32_t seconds) {
       RTC_WAKEUPCLOCK_CK_SPRE_16BITS : RTC_WAKEUPCLOCK_CK_SPRE_17BITS);
 }
 
+/* NAME
+ *        HW_StopUntil - Stop mode until HW_RTCGetMsTime reaches due
+ *
+ * DESCRIPTION
+ *        Light alternative to HW_EnterStopMode for waits of tens to hundreds
+ *        of milliseconds, e.g. a BME680 gas heater profile. Peripherals stay
+ *        initialised, RTC Alarm B wakes the MCU. Alarm A is LoRaMac-node's
+ *        and the WUT belongs to PrepareWakeup, so neither is disturbed.
+ *
+ *        Other interrupts (LPTIM tasks, buttons, NFC) are serviced as usual,
+ *        then the MCU stops again until due.
+ *
+ * NOTES
+ *        SYSCLK is MSI, which Stop mode wakes up on, so no clock restore is
+ *        needed. SysTick doesn't count in Stop mode, HAL_GetTick lags behind.
+ *
+ *        While an I2C1 or SPI1 transfer is in flight the MCU only sleeps,
+ *        their clocks must keep running.
+ */
+void HW_StopUntil(uint32_t due) {
+  RTC_AlarmTypeDef alarm = {
+    .Alarm = RTC_ALARM_B,
+    .AlarmMask = RTC_ALARMMASK_DATEWEEKDAY | RTC_ALARMMASK_HOURS | RTC_ALARMMASK_MINUTES,
+    .AlarmSubSecondMask = N_PREDIV_S << RTC_ALRMASSR_MASKSS_Pos,
+    .AlarmDateWeekDaySel = RTC_ALARMDATEWEEKDAYSEL_DATE,
+    .AlarmDateWeekDay = 1,
+  };
+  int32_t left = (int32_t)(due - HW_RTCGetMsTime());
+  uint64_t now, at, target;
+
+  if(left <= 0)
+    return;
+
+  now = RtcGetTicks();
+  target = now + (((uint64_t)left << N_PREDIV_S) + 999) / 1000; /* ms to ticks, rounded up */
+
+  HAL_PWREx_EnableUltraLowPower();
+  HAL_PWREx_EnableFastWakeUp();
+
+  while(now < target) {
+    if(target - now < HW_STOP_MIN_TICKS) {
+      while(RtcGetTicks() < target);
+      break;
+    }
+
+    at = target - now > HW_STOP_MAX_TICKS ? now + HW_STOP_MAX_TICKS : target;
+    alarm.AlarmTime.Seconds = (at >> N_PREDIV_S) % 60;
+    alarm.AlarmTime.SubSeconds = HW_TICKS_SUBSECOND - (at & HW_TICKS_SUBSECOND);
+    if(HAL_RTC_SetAlarm_IT(&hrtc, &alarm, RTC_FORMAT_BIN) != HAL_OK) {
+      HAL_Delay((target - now) * 1000 >> N_PREDIV_S);
+      break;
+    }
+
+    /* WFI wakes on the pending interrupt even with PRIMASK set, closing the race */
+    __disable_irq();
+    while((now = RtcGetTicks()) < at) {
+      if(I2C_Idle() && hspi1.State == HAL_SPI_STATE_READY)
+        HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+      else
+        __WFI();
+      __enable_irq();
+      __disable_irq();
+    }
+    __enable_irq();
+  }
+
+  HAL_RTC_DeactivateAlarm(&hrtc, RTC_ALARM_B);
+}
+
+void HAL_RTCEx_AlarmBEventCallback(RTC_HandleTypeDef *hrtc) {
+  /* HW_StopUntil only needs the wake up */
+}
+
 void Breakpoint(void) {
   asm("nop");
   // asm("bkpt 0x44");
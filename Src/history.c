@@ -0,0 +1,417 @@
+//bin/true; export WFLAGS="-Wall -Wextra -Wpedantic -Wformat=2 -Wwrite-strings -Wswitch-default -Wold-style-definition -Wstrict-prototypes -Wc++-compat -Wcast-align=strict -Wcast-qual"
+//usr/bin/env gcc -DUNITTEST -ggdb3 $WFLAGS -O2 -fsanitize=address,undefined -std=iso9899:2018 -I"${0%/*}/../Inc" -o "${o=`mktemp`}" "$0" && exec setarch -R -- sh -c 'set -x; exec -a "$0" "$@"' "$0" "$o" "$@";
+//bin/true; exit 1
+
+/* Includes ------------------------------------------------------------------*/
+#include "history.h"
+#include <string.h>
+
+/* Hosted environment only */
+#ifdef UNITTEST
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CRITICAL_SECTION_BEGIN()
+#define CRITICAL_SECTION_END()
+#define DEBUG_MSG(msg)  fputs(msg, stderr)
+static bool HW_WriteEEPROM(void *addr, const void *buf, size_t size);
+#else
+#include "main.h"
+#include "hardware.h"
+#include "eeprom.h"
+#include "protobuf.h"
+#include "sensors.h"
+#include "LoRaMac-node/boards/utilities.h"
+#include <assert.h>
+#endif
+
+/* Private types -------------------------------------------------------------*/
+/*
+ * DESCRIPTION
+ *        Daily rollups survive reboots in EEPROM_HISTORY. A bucket is written
+ *        to slot days % HISTORY_DAY_N before days is bumped, and readers only
+ *        see the HISTORY_DAY_N - 1 slots before it, so a torn or in-progress
+ *        write is never read. Erased EEPROM (factory reset) is empty history.
+ */
+struct HistoryEeprom {
+  uint32_t boots;  /* History_Init calls */
+  uint32_t days;   /* Daily rollups ever written */
+  struct HistoryBucket day[HISTORY_DAY_N];
+};
+
+/* Private variables ---------------------------------------------------------*/
+#ifdef UNITTEST
+static struct HistoryEeprom Usage_Eeprom;
+#define EEPROM_HISTORY      ((uintptr_t)&Usage_Eeprom)
+#define EEPROM_HISTORY_END  (EEPROM_HISTORY + sizeof Usage_Eeprom)
+#else
+#define EEPROM_HISTORY_END  EEPROM_LOG_END
+#endif
+#define HISTORY_EEPROM  ((struct HistoryEeprom *)EEPROM_HISTORY)
+
+#ifndef UNITTEST
+static_assert(sizeof(struct HistoryEeprom) <= EEPROM_HISTORY_END - EEPROM_HISTORY, "History overstepping EEPROM boundaries.");
+#endif
+static_assert(sizeof(struct HistoryBucket) % 4 == 0, "EEPROM is written word by word.");
+
+/* Seconds of a bucket, per level */
+static const uint32_t history_span[HISTORY_LEVELS] = {15 * 60, 60 * 60, 24 * 60 * 60};
+
+static struct {
+  struct HistoryBucket open[HISTORY_LEVELS];  /* Buckets being filled */
+  struct HistoryBucket quarter[HISTORY_QUARTER_N];
+  struct HistoryBucket hour[HISTORY_HOUR_N];
+  uint32_t head[HISTORY_DAY];  /* Closed buckets ever pushed to quarter and hour */
+  uint32_t hold;               /* HW_RTCGetMsTime the hold expires */
+  uint32_t now;                /* HW_RTCGetSTime the hold began */
+  uint16_t boot;
+  bool held;
+  volatile bool requested;     /* Sample due, set by RTC wakeup */
+} history;
+
+#ifndef UNITTEST
+/* Channels tracked, found by DeviceSensors field in the sensor registry */
+static const uint32_t history_keys[HISTORY_CHANNELS] = {
+  PBSMSG_TX_SENSOR_TEMPERATURE,
+  PBSMSG_TX_SENSOR_HUMIDITY,
+#ifdef STX
+  PBSMSG_TX_SENSOR_LUMINANCE,
+#else
+  PBSMSG_TX_SENSOR_PRESSURE,
+#endif
+};
+static const struct SensorChannel *history_channels[HISTORY_CHANNELS];
+#endif
+
+/* Private functions ---------------------------------------------------------*/
+static struct HistoryBucket *History_Ring(unsigned level, unsigned *n) {
+  if(level == HISTORY_QUARTER)
+    return *n = HISTORY_QUARTER_N, history.quarter;
+  return *n = HISTORY_HOUR_N, history.hour;
+}
+
+/* NAME
+ *        History_Merge - Fold bucket src into dst
+ */
+static void History_Merge(struct HistoryBucket *dst, const struct HistoryBucket *src) {
+  for(unsigned i = 0; i < HISTORY_CHANNELS; i++) {
+    struct HistoryStat *d = &dst->stat[i];
+    const struct HistoryStat *s = &src->stat[i];
+
+    if(!dst->count || s->min < d->min)
+      d->min = s->min;
+    if(!dst->count || s->max > d->max)
+      d->max = s->max;
+    d->sum = dst->count ? d->sum + s->sum : s->sum;
+  }
+  dst->count += src->count;
+  dst->end = src->end;
+  dst->boot = src->boot;
+}
+
+/* NAME
+ *        History_Store - Append a daily rollup to EEPROM
+ */
+static void History_Store(const struct HistoryBucket *b) {
+  const uint32_t days = HISTORY_EEPROM->days + 1;
+
+  if(!HW_WriteEEPROM(&HISTORY_EEPROM->day[(days - 1) % HISTORY_DAY_N], b, sizeof *b)) goto err;
+  if(!HW_WriteEEPROM(&HISTORY_EEPROM->days, &days, sizeof days)) goto err;
+  return;
+err:
+  DEBUG_MSG("HIS ERR Daily rollup not stored\n");
+}
+
+/* Exported functions --------------------------------------------------------*/
+/* NAME
+ *        History_Add - Account a sample taken at now to the rollups
+ *
+ * DESCRIPTION
+ *        Buckets are slots of history_span seconds. A sample beyond the slot
+ *        of the open 15 minute bucket closes it, folding it into the open
+ *        hourly bucket, which may close in turn, and so on up to the daily
+ *        bucket going to EEPROM. Slots without samples leave no bucket.
+ *
+ *        Closed buckets are published inside a critical section, NFC reads
+ *        them from interrupt context.
+ */
+void History_Add(uint32_t now, const int32_t v[HISTORY_CHANNELS]) {
+  struct HistoryBucket sample = {.end = now, .boot = history.boot, .count = 1}, day;
+  bool day_closed = false;
+
+  for(unsigned i = 0; i < HISTORY_CHANNELS; i++)
+    sample.stat[i] = (struct HistoryStat){v[i], v[i], v[i]};
+
+  CRITICAL_SECTION_BEGIN();
+  for(unsigned level = HISTORY_QUARTER; level < HISTORY_LEVELS; level++) {
+    struct HistoryBucket *b = &history.open[level], *ring;
+    unsigned n;
+
+    if(!b->count || b->end / history_span[level] == now / history_span[level])
+      break;
+
+    if(level == HISTORY_DAY) {
+      day = *b, day_closed = true;
+    } else {
+      ring = History_Ring(level, &n);
+      ring[history.head[level]++ % n] = *b;
+      History_Merge(&history.open[level + 1], b);
+    }
+    memset(b, 0, sizeof *b);
+  }
+  History_Merge(&history.open[HISTORY_QUARTER], &sample);
+  CRITICAL_SECTION_END();
+
+  if(day_closed)
+    History_Store(&day);
+}
+
+/* NAME
+ *        History_Count - Buckets of a level, the open one included
+ */
+unsigned History_Count(enum HistoryLevel level) {
+  unsigned n, closed;
+
+  if(level == HISTORY_DAY) {
+    closed = HISTORY_EEPROM->days < HISTORY_DAY_N - 1 ? HISTORY_EEPROM->days : HISTORY_DAY_N - 1;
+  } else {
+    History_Ring(level, &n);
+    closed = history.head[level] < n ? history.head[level] : n;
+  }
+  return closed + !!history.open[level].count;
+}
+
+/* NAME
+ *        History_Get - Bucket i of a level, oldest first
+ *
+ * DESCRIPTION
+ *        The last one, if partial is set, is still being filled.
+ */
+const struct HistoryBucket *History_Get(enum HistoryLevel level, unsigned i, bool *partial) {
+  const unsigned count = History_Count(level);
+  const unsigned closed = count - !!history.open[level].count;
+  const struct HistoryBucket *ring;
+  unsigned n;
+
+  assert(i < count);
+  *partial = i == closed;
+  if(*partial)
+    return &history.open[level];
+  if(level == HISTORY_DAY)
+    return &HISTORY_EEPROM->day[(HISTORY_EEPROM->days - closed + i) % HISTORY_DAY_N];
+  ring = History_Ring(level, &n);
+  return &ring[(history.head[level] - closed + i) % n];
+}
+
+/* NAME
+ *        History_Boot - Boot count, telling buckets of past boots
+ */
+uint16_t History_Boot(void) {
+  return history.boot;
+}
+
+#ifndef UNITTEST
+/* NAME
+ *        History_Init - Count the boot, find the tracked sensor channels
+ */
+void History_Init(void) {
+  const uint32_t boots = HISTORY_EEPROM->boots + 1;
+
+  HW_WriteEEPROM(&HISTORY_EEPROM->boots, &boots, sizeof boots);
+  history.boot = boots;
+
+  for(unsigned k = 0; k < HISTORY_CHANNELS; k++)
+    for(unsigned i = 0; sensors[i]; i++)
+      for(unsigned j = 0; j < sensors[i]->channels_n && I2C_Present(sensors[i]->addr); j++)
+        if(sensors[i]->channels[j].pbkey == history_keys[k])
+          history_channels[k] = &sensors[i]->channels[j];
+
+  DEBUG_PRINTF("HIS INIT boot:%u days:%u\n", boots, HISTORY_EEPROM->days);
+}
+
+/* NAME
+ *        History_Key - DeviceSensors field of channel i
+ */
+uint32_t History_Key(unsigned i) {
+  return history_keys[i];
+}
+
+/* NAME
+ *        History_Request - Have the main loop take a sample, ISR safe
+ */
+void History_Request(void) {
+  history.requested = true;
+}
+
+/* NAME
+ *        History_Held - Milliseconds a hold still defers samples, 0 if none
+ */
+static uint32_t History_Held(void) {
+  const int32_t left = history.hold - HW_RTCGetMsTime();
+
+  return history.held && left > 0 ? left : 0;
+}
+
+/* NAME
+ *        History_Pending - A requested sample can be taken now
+ *
+ * DESCRIPTION
+ *        A sample deferred by History_Hold isn't pending, so the MCU may stop
+ *        meanwhile, see History_Deferred.
+ */
+bool History_Pending(void) {
+  return history.requested && !History_Held();
+}
+
+/* NAME
+ *        History_Deferred - Seconds until a held sample can be taken, 0 if none
+ */
+uint32_t History_Deferred(void) {
+  return history.requested ? (History_Held() + 999) / 1000 : 0;
+}
+
+/* NAME
+ *        History_Hold - Defer samples for ms, 0 releases
+ *
+ * DESCRIPTION
+ *        Keeps buckets put while NFC streams them in several chunks. The
+ *        sample is only deferred, and a forgotten hold expires by itself.
+ *        Starting a hold also snapshots the time, see History_Now.
+ */
+void History_Hold(uint32_t ms) {
+  if(ms && !history.held)
+    history.now = HW_RTCGetSTime();
+  history.hold = HW_RTCGetMsTime() + ms;
+  history.held = ms;
+}
+
+/* NAME
+ *        History_Now - HW_RTCGetSTime the buckets are held at
+ *
+ * DESCRIPTION
+ *        Ages encoded relative to it stay the same for the whole hold, so do
+ *        their varint lengths.
+ */
+uint32_t History_Now(void) {
+  return history.held ? history.now : HW_RTCGetSTime();
+}
+
+/* NAME
+ *        History_Process - Take a requested sample
+ */
+void History_Process(void) {
+  int32_t v[HISTORY_CHANNELS] = {0};
+
+  if(!History_Pending())
+    return;
+  history.requested = history.held = false;
+
+  Sensors_Update();
+  for(unsigned i = 0; i < HISTORY_CHANNELS; i++) {
+    const struct SensorChannel *ch = history_channels[i];
+    if(!ch)
+      continue;
+    switch(ch->format) {
+    case SENSOR_FMT_U8:   v[i] = *(const uint8_t *)ch->value;   break;
+    case SENSOR_FMT_U16:  v[i] = *(const uint16_t *)ch->value;  break;
+    case SENSOR_FMT_U32:  v[i] = *(const uint32_t *)ch->value;  break;
+    case SENSOR_FMT_S16:  v[i] = *(const int16_t *)ch->value;   break;
+    case SENSOR_FMT_S32:  v[i] = *(const int32_t *)ch->value;   break;
+    default: break;
+    }
+  }
+  History_Add(HW_RTCGetSTime(), v);
+}
+#endif
+
+#if UNITTEST
+static bool HW_WriteEEPROM(void *addr, const void *buf, size_t size) {
+  assert((uintptr_t)addr >= EEPROM_HISTORY && (uintptr_t)addr + size <= EEPROM_HISTORY_END);
+  memcpy(addr, buf, size);
+  return true;
+}
+
+static void Usage_Expect(enum HistoryLevel level, unsigned i, int32_t min, int32_t max, int32_t mean, uint16_t count) {
+  bool partial;
+  const struct HistoryBucket *b = History_Get(level, i, &partial);
+
+  assert(b->count == count);
+  assert(b->stat[0].min == min && b->stat[0].max == max && b->stat[0].sum / b->count == mean);
+}
+
+/* A ramp sampled every 5 minutes, rolling up through all levels */
+static void Usage_Ramp(void) {
+  int32_t v[HISTORY_CHANNELS];
+  bool partial;
+  uint32_t t;
+
+  memset(&history, 0, sizeof history);
+  memset(&Usage_Eeprom, 0, sizeof Usage_Eeprom);
+
+  for(t = 0; t < 2 * 86400; t += 300) {
+    v[0] = t / 300, v[1] = -v[0], v[2] = 7;
+    History_Add(t, v);
+  }
+
+  /* Rings hold the latest, open buckets are partial */
+  assert(History_Count(HISTORY_QUARTER) == HISTORY_QUARTER_N + 1);
+  assert(History_Count(HISTORY_HOUR) == HISTORY_HOUR_N + 1);
+  assert(History_Count(HISTORY_DAY) == 1 + 1);
+  assert(Usage_Eeprom.days == 1);
+  History_Get(HISTORY_QUARTER, HISTORY_QUARTER_N, &partial);
+  assert(partial);
+  History_Get(HISTORY_QUARTER, HISTORY_QUARTER_N - 1, &partial);
+  assert(!partial);
+
+  /* Samples 0..287 on day one, 552..563 in the last closed hour */
+  Usage_Expect(HISTORY_DAY, 0, 0, 287, 143, 288);
+  Usage_Expect(HISTORY_QUARTER, HISTORY_QUARTER_N - 1, 570, 572, 571, 3);
+  Usage_Expect(HISTORY_HOUR, HISTORY_HOUR_N - 1, 552, 563, 557, 12);
+  assert(History_Get(HISTORY_DAY, 0, &partial)->stat[1].min == -287);
+  assert(History_Get(HISTORY_DAY, 0, &partial)->stat[2].sum == 7 * 288);
+
+  /* Nothing in between, a late sample closes every level at once */
+  v[0] = v[1] = v[2] = 0;
+  History_Add(5 * 86400, v);
+  assert(Usage_Eeprom.days == 2);
+  assert(History_Count(HISTORY_DAY) == 2);
+  assert(History_Count(HISTORY_HOUR) == HISTORY_HOUR_N);
+  Usage_Expect(HISTORY_DAY, 1, 288, 575, 431, 288);
+
+  /* Higher levels only see closed 15 minute buckets */
+  Usage_Expect(HISTORY_QUARTER, HISTORY_QUARTER_N, 0, 0, 0, 1);
+}
+
+/* EEPROM keeps all but the slot being written */
+static void Usage_Wrap(void) {
+  int32_t v[HISTORY_CHANNELS] = {0};
+  bool partial;
+
+  memset(&history, 0, sizeof history);
+  memset(&Usage_Eeprom, 0, sizeof Usage_Eeprom);
+
+  for(uint32_t d = 0; d < 3 * HISTORY_DAY_N; d++) {
+    v[0] = d;
+    History_Add(d * 86400, v);
+  }
+  assert(History_Count(HISTORY_DAY) == HISTORY_DAY_N - 1);
+  for(unsigned i = 0; i < HISTORY_DAY_N - 1; i++)
+    assert(History_Get(HISTORY_DAY, i, &partial)->stat[0].max == (int32_t)(2 * HISTORY_DAY_N + i));
+
+  /* Buckets of a previous boot are told apart */
+  history.boot++;
+  v[0] = 100;
+  History_Add(3 * HISTORY_DAY_N * 86400, v);
+  assert(History_Get(HISTORY_DAY, HISTORY_DAY_N - 2, &partial)->boot == 0);
+  assert(History_Get(HISTORY_QUARTER, HISTORY_QUARTER_N, &partial)->boot == 1 && partial);
+}
+
+int main(void) {
+  Usage_Ramp();
+  Usage_Wrap();
+  puts("history ok");
+  return EXIT_SUCCESS;
+}
+#endif
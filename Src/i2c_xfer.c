@@ -0,0 +1,381 @@
+#include "hardware.h"
+#include "i2c.h"
+#include "i2c_xfer.h"
+#include <stddef.h>
+
+/* Queue of submitted transactions, head is the one on the bus when running */
+static struct I2C_Xfer *volatile i2cHead, *i2cTail;
+static volatile bool i2cRunning;
+
+/* Register address of the head, sent ahead of its data */
+static uint8_t i2cMemAddr[2];
+static volatile bool i2cAddressing;
+
+static HAL_StatusTypeDef I2C_Begin(struct I2C_Xfer *x);
+static HAL_StatusTypeDef I2C_BeginData(struct I2C_Xfer *x);
+static void I2C_Finish(int32_t status);
+static void I2C_Dispatch(void);
+static void I2C_Complete(I2C_HandleTypeDef *hi2c, int32_t status);
+static void I2C_Abort(void);
+static bool I2C_CanSleep(void);
+static HAL_StatusTypeDef I2C_Transfer(struct I2C_Xfer *x, uint32_t timeout);
+
+/* NAME
+ *        I2C_Submit - Queue a transaction on I2C1, start it if bus is idle
+ *
+ * DESCRIPTION
+ *        Transactions run back to back in submission order, the next one
+ *        started from the completion interrupt of the previous. Transfers of
+ *        I2C_DMA_MIN_SIZE bytes or more go through DMA, shorter ones through
+ *        the I2C interrupt alone. Either way the CPU is free meanwhile.
+ *
+ *        Nothing here polls the bus, so submitting with interrupts masked or
+ *        from the completion handler is safe.
+ *
+ *        The xfer and its buffer must stay valid until status leaves
+ *        I2C_XFER_PENDING, or I2C_Cancel returns.
+ *
+ * RETURN VALUE
+ *        HAL_OK if queued (or already finished), HAL_BUSY if xfer is still
+ *        pending from an earlier submit, or the HAL error of an immediate
+ *        failure to start (e.g. I2C1 not initialized).
+ *
+ * SEE ALSO
+ *        I2C_Wait, I2C_Cancel
+ */
+int32_t I2C_Submit(struct I2C_Xfer *xfer) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  if(xfer->status == I2C_XFER_PENDING) {
+    __set_PRIMASK(primask);
+    return HAL_BUSY;
+  }
+
+  xfer->status = I2C_XFER_PENDING;
+  xfer->next = NULL;
+  if(i2cTail)
+    i2cTail->next = xfer;
+  else
+    i2cHead = xfer;
+  i2cTail = xfer;
+
+  I2C_Dispatch();
+  __set_PRIMASK(primask);
+
+  return xfer->status == I2C_XFER_PENDING ? HAL_OK : xfer->status;
+}
+
+/* NAME
+ *        I2C_Wait - Sleep until a submitted transaction completes
+ *
+ * DESCRIPTION
+ *        Waits in WFI, woken by I2C/DMA completion or SysTick. On timeout,
+ *        the transaction is cancelled (aborted if on the bus), so the
+ *        caller may release its buffer.
+ *
+ * NOTES
+ *    Interrupt Context
+ *        Completion needs the I2C1 and DMA1 channel 6/7 interrupts. When
+ *        those can't preempt the caller (PRIMASK set, or same or higher
+ *        priority handler), waiting would deadlock. The transaction is then
+ *        cancelled and HAL_BUSY returned, unless it has already completed.
+ *
+ * RETURN VALUE
+ *        Final status of xfer, HAL_TIMEOUT if it didn't complete in time.
+ */
+int32_t I2C_Wait(struct I2C_Xfer *xfer, uint32_t timeout) {
+  uint32_t ts = HAL_GetTick();
+
+  if(xfer->status != I2C_XFER_PENDING)
+    return xfer->status;
+
+  if(!I2C_CanSleep()) {
+    I2C_Cancel(xfer);
+    return xfer->status = HAL_BUSY;
+  }
+
+  /* WFI wakes on the pending interrupt even with PRIMASK set, closing the race */
+  __disable_irq();
+  while(xfer->status == I2C_XFER_PENDING && HAL_GetTick() - ts < timeout) {
+    __WFI();
+    __enable_irq();
+    __disable_irq();
+  }
+  __enable_irq();
+
+  if(xfer->status == I2C_XFER_PENDING) {
+    DBG_PRINTF("I2C ERR Timeout dev:0x%02x reg:0x%04x len:%d dur:%d\n", xfer->dev, xfer->reg, xfer->len, HAL_GetTick() - ts);
+    I2C_Cancel(xfer);
+    xfer->status = HAL_TIMEOUT;
+  }
+  return xfer->status;
+}
+
+/* NAME
+ *        I2C_Cancel - Remove a transaction from the queue, abort it if on bus
+ *
+ * DESCRIPTION
+ *        A cancelled xfer ends in I2C_XFER_IDLE, without its done callback.
+ *        A no-op on completed transactions.
+ */
+void I2C_Cancel(struct I2C_Xfer *xfer) {
+  struct I2C_Xfer *it, *prev = NULL;
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  if(xfer->status == I2C_XFER_PENDING) {
+    if(xfer == i2cHead && i2cRunning) {
+      I2C_Abort();
+      i2cRunning = false;
+    }
+
+    for(it = i2cHead; it && it != xfer; prev = it, it = it->next);
+    if(it) {
+      if(prev)
+        prev->next = xfer->next;
+      else
+        i2cHead = xfer->next;
+      if(i2cTail == xfer)
+        i2cTail = prev;
+    }
+    xfer->next = NULL;
+    xfer->status = I2C_XFER_IDLE;
+
+    I2C_Dispatch();
+  }
+  __set_PRIMASK(primask);
+}
+
+/* NAME
+ *        I2C_Idle - Whether no transaction is queued or on the bus
+ */
+bool I2C_Idle(void) {
+  return !i2cHead;
+}
+
+/* NAME
+ *        I2C_MemRead, I2C_MemWrite, I2C_Transmit, I2C_Receive - Blocking
+ *        transactions, sleeping rather than spinning on I2C1
+ *
+ * DESCRIPTION
+ *        Drop-in for HAL_I2C_Mem_Read/HAL_I2C_Mem_Write and
+ *        HAL_I2C_Master_Transmit/HAL_I2C_Master_Receive on hi2c1. The
+ *        transaction is queued behind any submitted ones, and the caller
+ *        sleeps until it completes. Timeout includes time spent queued.
+ *
+ *        Where completion interrupts can't preempt the caller, and the bus
+ *        is idle, falls back to the polling HAL functions.
+ *
+ * RETURN VALUE
+ *        HAL_OK on success, otherwise HAL_ERROR, HAL_BUSY or HAL_TIMEOUT;
+ *        details in hi2c1.ErrorCode.
+ */
+HAL_StatusTypeDef I2C_MemRead(uint16_t dev, uint16_t reg, uint16_t reg_size, uint8_t *buf, uint16_t len, uint32_t timeout) {
+  struct I2C_Xfer x = I2C_XFER_READ(dev, reg, reg_size, buf, len);
+  return I2C_Transfer(&x, timeout);
+}
+
+HAL_StatusTypeDef I2C_MemWrite(uint16_t dev, uint16_t reg, uint16_t reg_size, const uint8_t *buf, uint16_t len, uint32_t timeout) {
+  struct I2C_Xfer x = I2C_XFER_WRITE(dev, reg, reg_size, (uint8_t*)buf, len);
+  return I2C_Transfer(&x, timeout);
+}
+
+HAL_StatusTypeDef I2C_Transmit(uint16_t dev, const uint8_t *buf, uint16_t len, uint32_t timeout) {
+  struct I2C_Xfer x = I2C_XFER_WRITE(dev, 0, 0, (uint8_t*)buf, len);
+  return I2C_Transfer(&x, timeout);
+}
+
+HAL_StatusTypeDef I2C_Receive(uint16_t dev, uint8_t *buf, uint16_t len, uint32_t timeout) {
+  struct I2C_Xfer x = I2C_XFER_READ(dev, 0, 0, buf, len);
+  return I2C_Transfer(&x, timeout);
+}
+
+static HAL_StatusTypeDef I2C_Transfer(struct I2C_Xfer *x, uint32_t timeout) {
+  if(!I2C_CanSleep()) {
+    /* Completion interrupt can't preempt us, poll instead, if the bus is ours */
+    if(!I2C_Idle())
+      return HAL_BUSY;
+    if(x->reg_size)
+      return x->write ? HAL_I2C_Mem_Write(&hi2c1, x->dev, x->reg, x->reg_size, x->buf, x->len, timeout)
+                      : HAL_I2C_Mem_Read(&hi2c1, x->dev, x->reg, x->reg_size, x->buf, x->len, timeout);
+    return x->write ? HAL_I2C_Master_Transmit(&hi2c1, x->dev, x->buf, x->len, timeout)
+                    : HAL_I2C_Master_Receive(&hi2c1, x->dev, x->buf, x->len, timeout);
+  }
+
+  if(I2C_Submit(x) != HAL_OK)
+    return x->status;
+  return I2C_Wait(x, timeout);
+}
+
+/* NAME
+ *        I2C_Begin - Start transaction on the bus, interrupt or DMA driven
+ *
+ * DESCRIPTION
+ *        HAL_I2C_Mem_*_IT/_DMA send the register address in a polling loop,
+ *        timed by SysTick, which can't advance with interrupts masked or
+ *        from the completion handler. So register accesses are sequential
+ *        transfers instead, the address being a frame of its own: without
+ *        STOP for reads, followed by a repeated START; reloaded for writes,
+ *        so the data follows without one. I2C_Complete starts the data.
+ */
+static HAL_StatusTypeDef I2C_Begin(struct I2C_Xfer *x) {
+  HAL_StatusTypeDef r;
+  uint16_t n = x->reg_size == I2C_MEMADD_SIZE_16BIT ? 2 : 1;
+
+  if(!x->reg_size)
+    return I2C_BeginData(x);
+
+  i2cMemAddr[0] = n == 2 ? x->reg >> 8 : x->reg & 0xFF;
+  i2cMemAddr[1] = x->reg & 0xFF;
+  hi2c1.PreviousState = HAL_I2C_MODE_NONE;  /* START, even after an aborted or failed frame */
+  r = HAL_I2C_Master_Seq_Transmit_IT(&hi2c1, x->dev, i2cMemAddr, n,
+      !x->len ? I2C_FIRST_AND_LAST_FRAME : x->write ? I2C_FIRST_AND_NEXT_FRAME : I2C_FIRST_FRAME);
+  i2cAddressing = r == HAL_OK;
+  return r;
+}
+
+/* NAME
+ *        I2C_BeginData - Start data of transaction, after its register address
+ */
+static HAL_StatusTypeDef I2C_BeginData(struct I2C_Xfer *x) {
+  const bool dma = x->len >= I2C_DMA_MIN_SIZE && (x->write ? hi2c1.hdmatx : hi2c1.hdmarx);
+
+  if(x->reg_size && x->write)
+    return dma ? HAL_I2C_Master_Seq_Transmit_DMA(&hi2c1, x->dev, x->buf, x->len, I2C_LAST_FRAME)
+               : HAL_I2C_Master_Seq_Transmit_IT(&hi2c1, x->dev, x->buf, x->len, I2C_LAST_FRAME);
+  if(x->reg_size)
+    return dma ? HAL_I2C_Master_Seq_Receive_DMA(&hi2c1, x->dev, x->buf, x->len, I2C_LAST_FRAME)
+               : HAL_I2C_Master_Seq_Receive_IT(&hi2c1, x->dev, x->buf, x->len, I2C_LAST_FRAME);
+  if(x->write)
+    return dma ? HAL_I2C_Master_Transmit_DMA(&hi2c1, x->dev, x->buf, x->len)
+               : HAL_I2C_Master_Transmit_IT(&hi2c1, x->dev, x->buf, x->len);
+  return dma ? HAL_I2C_Master_Receive_DMA(&hi2c1, x->dev, x->buf, x->len)
+             : HAL_I2C_Master_Receive_IT(&hi2c1, x->dev, x->buf, x->len);
+}
+
+/* NAME
+ *        I2C_Finish - Pop head of queue with final status, notify its owner
+ *
+ * NOTES
+ *        Call with interrupts masked, or from I2C1/DMA interrupt.
+ */
+static void I2C_Finish(int32_t status) {
+  struct I2C_Xfer *x = i2cHead;
+
+  i2cRunning = false;
+  i2cHead = x->next;
+  if(!i2cHead)
+    i2cTail = NULL;
+  x->next = NULL;
+
+  x->status = status;
+  if(x->done)
+    x->done(x);
+}
+
+/* NAME
+ *        I2C_Dispatch - Start the head of queue, unless already running
+ *
+ * NOTES
+ *        Call with interrupts masked, or from I2C1/DMA interrupt.
+ *        Transactions which fail to start are finished right away.
+ */
+static void I2C_Dispatch(void) {
+  HAL_StatusTypeDef r;
+
+  while(!i2cRunning && i2cHead) {
+    if((r = I2C_Begin(i2cHead)) == HAL_OK) {
+      i2cRunning = true;
+      return;
+    }
+    I2C_Finish(r);
+  }
+}
+
+static void I2C_Complete(I2C_HandleTypeDef *hi2c, int32_t status) {
+  HAL_StatusTypeDef r;
+
+  if(hi2c != &hi2c1 || !i2cRunning)
+    return;
+
+  /* Register address sent, continue with data */
+  if(i2cAddressing) {
+    i2cAddressing = false;
+    if(status == HAL_OK && i2cHead->len) {
+      if((r = I2C_BeginData(i2cHead)) == HAL_OK)
+        return;
+      /* Bus is held without STOP */
+      I2C_Abort();
+      status = r;
+    }
+  }
+
+  I2C_Finish(status);
+  I2C_Dispatch();
+}
+
+/* NAME
+ *        I2C_Abort - Stop the transaction on bus, leave I2C1 ready
+ *
+ * DESCRIPTION
+ *        Clearing PE resets the I2C state machine and status flags
+ *        (RM0377 I2C software reset), without touching configuration.
+ */
+static void I2C_Abort(void) {
+  __HAL_I2C_DISABLE_IT(&hi2c1, I2C_IT_ERRI | I2C_IT_TCI | I2C_IT_STOPI | I2C_IT_NACKI | I2C_IT_ADDRI | I2C_IT_RXI | I2C_IT_TXI);
+  CLEAR_BIT(hi2c1.Instance->CR1, I2C_CR1_TXDMAEN | I2C_CR1_RXDMAEN);
+  __HAL_I2C_DISABLE(&hi2c1);
+
+  if(hi2c1.hdmarx)
+    HAL_DMA_Abort(hi2c1.hdmarx);
+  if(hi2c1.hdmatx)
+    HAL_DMA_Abort(hi2c1.hdmatx);
+  NVIC_ClearPendingIRQ(I2C1_IRQn);
+
+  hi2c1.ErrorCode |= HAL_I2C_ERROR_TIMEOUT;
+  hi2c1.State = HAL_I2C_STATE_READY;
+  hi2c1.Mode = HAL_I2C_MODE_NONE;
+  i2cAddressing = false;
+  __HAL_UNLOCK(&hi2c1);
+
+  __HAL_I2C_ENABLE(&hi2c1);
+}
+
+/* NAME
+ *        I2C_CanSleep - Whether I2C1 and its DMA interrupts can preempt caller
+ */
+static bool I2C_CanSleep(void) {
+  const int32_t irq = (int32_t)(__get_IPSR() & 0x3f) - 16;
+  uint32_t prio;
+
+  if(__get_PRIMASK())
+    return false;
+  if(irq == -16) /* Thread mode */
+    return true;
+  if(irq < SVC_IRQn) /* NMI, HardFault */
+    return false;
+
+  prio = NVIC_GetPriority((IRQn_Type)irq);
+  return prio > NVIC_GetPriority(I2C1_IRQn) && prio > NVIC_GetPriority(DMA1_Channel4_5_6_7_IRQn);
+}
+
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c) {
+  I2C_Complete(hi2c, HAL_OK);
+}
+
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c) {
+  I2C_Complete(hi2c, HAL_OK);
+}
+
+void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c) {
+  I2C_Complete(hi2c, HAL_OK);
+}
+
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c) {
+  I2C_Complete(hi2c, HAL_OK);
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+  I2C_Complete(hi2c, hi2c->ErrorCode & HAL_I2C_ERROR_TIMEOUT ? HAL_TIMEOUT : HAL_ERROR);
+}
@@ -3,6 +3,7 @@
 #include "protobuf.h"     /* PBEncodeMsg */
 #include "task_mgr.h"     /* tasks_ticks */
 #include "nfc.h"          /* MB_FCTCODE */
+#include "history.h"      /* History_Hold */
 #include <stdbool.h>      /* true */
 #include <string.h>       /* memcmp */
 #include "PinNames.h"     /* pButton0 */
@@ -177,11 +178,36 @@ static void DBG_PrintBuffer(const char* pre, const uint8_t buf[], uint16_t len,
   DBG_PRINTF("%s", post);
 }
 
+#ifdef HISTORY
+/* NAME
+ *        NFC_EncodeHistory - PBEncodeMsg_DeviceHistory, holding rollups for NFC_ChainSend
+ *
+ * DESCRIPTION
+ *        Every chunk must encode the very same message, so samples are held
+ *        and the time is snapshot from the size query until the last chunk is
+ *        encoded. In case phone walks away mid-transfer, the hold expires by
+ *        itself.
+ */
+static size_t NFC_EncodeHistory(uint8_t *msg, size_t len, size_t offset) {
+  size_t size;
+
+  /* Size query starts a transfer, take a fresh snapshot */
+  if(!msg)
+    History_Hold(0);
+  History_Hold(HISTORY_HOLD);
+  size = PBEncodeMsg_DeviceHistory(msg, len, offset, History_Now());
+  if(msg && offset + len >= size)
+    History_Hold(0);
+  return size;
+}
+#endif
+
 /* NAME
  *        NFCISR - interrupt subroutine for ST25DV04K-IE GPO pin
  *
  * DESCRIPTION
- *        Handles received and replied msgs via mailbox. NFCTAG is never used.
+ *        Handles received and replied msgs via mailbox. NFCTAG is written by
+ *        NFC_NdefProcess only, phones read it without any interrupt.
  *        Formats are STm FTM demo protocol and Google protobuf.
  *
  *    Firmware upload
@@ -211,6 +237,14 @@ static void DBG_PrintBuffer(const char* pre, const uint8_t buf[], uint16_t len,
  *        - bootldr must check EEPROM, to retain password session, prolong
  *          runtime to 120 seconds and possibly branch ST25DV init code.
  *
+ *    Chained transfers
+ *        Responses outgrowing the mailbox are answered as chained frames by
+ *        NFC_ChainSend. The 1st chunk answers the command, every further chunk
+ *        is written once RF has read out the previous one (RFGETMSG). Chained
+ *        commands are reassembled by NFC_ChainReceive, RF may put the next
+ *        chunk once mailbox is read out (RFPUTMSG). Either direction logs its
+ *        throughput, and a new simple frame from RF abandons the transfer.
+ *
  * TODO
  *        Scrutinize pw invalidation after device is put to sleep.
  *        In theory, if clock doesn't tick, than device could sleep
@@ -300,6 +334,9 @@ void NFCISR(void) {
   if(NFC_ReadReg(ST25DV_ADDR_DATA_I2C, ST25DV_ITSTS_DYN_REG, (void*)&nfc, 4)) return;
   DBG_PRINTF("NFC IRQ IT_STS:0x%02x MB_CTRL:0x%02x MB_LEN:0x%02x, Interrupt\n", nfc.it_sts, nfc.mb_ctrl, nfc.mb_len);
 
+  /* Phone read out a chunk of chained response, write next one */
+  if(~nfc.it_sts & ST25DV_ITSTS_DYN_RFPUTMSG_MASK && nfc.it_sts & ST25DV_ITSTS_DYN_RFGETMSG_MASK && NFC_ChainNext(nfc.mb)) return;
+
   /* Mailbox must have incoming data (put by RF) atleast 2 bytes */
   if(~nfc.it_sts & ST25DV_ITSTS_DYN_RFPUTMSG_MASK || !nfc.mb_len) return;
 
@@ -308,7 +345,6 @@ void NFCISR(void) {
     DBG_PrintBuffer("NFC <RX ", nfc.mb, 1, ", Firmware Update Message\n");
 
     /* Tell bootloader to listen NFC for 2 minutes and not require password */
-    HW_EraseEEPROM(EEPROM_BOOTMODE);
     HW_ProgramEEPROM(EEPROM_BOOTMODE, BOOTMODE_WAITNFC_MASK | BOOTMODE_PASSOK_MASK | BOOTMODE_KEEPNFC_MASK);
 
 
@@ -319,6 +355,16 @@ void NFCISR(void) {
   /* Read Mailbox */
   if((r = NFC_ReadReg(ST25DV_ADDR_DATA_I2C, ST25DV_MAILBOX_RAM_REG + 1, nfc.mb + 1, nfc.mb_len))) return;
 
+  /* Reassemble chained frames, the command is parsed once all chunks are in */
+  const uint8_t *data = nfc.mb + MB_DATA;
+  size_t data_len = nfc.mb_len + 1 - MB_DATA;
+  if(nfc.mb[MB_CHAINING] == MB_CHAINED) {
+    if(!(data = NFC_ChainReceive(nfc.mb, nfc.mb_len + 1, &data_len))) return;
+    DBG_PRINTF("NFC <RX chained fct:0x%02x len:%u\n", nfc.mb[MB_FCTCODE], (unsigned)data_len);
+  } else {
+    NFC_ChainAbort();
+  }
+
   /* Parse frame */
   switch(nfc.mb[MB_FCTCODE]) {
   case MB_R2HGETCONFIG:
@@ -341,9 +387,20 @@ void NFCISR(void) {
       DBG_PrintBuffer("NFC >TX ", nfc.mb, nfc.mb[MB_LENGTH] + MB_DATA, is_conf ? ", Ask Configure Message\n" : ", Ask Sensor Message\n");
     break;
   }
+#ifdef HISTORY
+  case MB_R2HGETHISTORY:
+    DBG_PrintBuffer("NFC <RX ", nfc.mb, nfc.mb_len + 1, ", Ask History Message\n");
+
+    /* Verify message size and header. */
+    if(nfc.mb_len + 1 != MB_DATA) break;
+    if(memcmp(nfc.mb + MB_CMDRESP, (uint8_t[4]){MB_COMMAND, MB_NOERROR, MB_NOTCHAINED, 0x00}, 4)) break;
+
+    NFC_ChainSend(nfc.mb, MB_R2HGETHISTORY, NFC_EncodeHistory);
+    break;
+#endif
   case MB_R2HSETCONFIG:
     DBG_PrintBuffer("NFC <RX ", nfc.mb, nfc.mb_len + 1, ", Set Configure Message\n");
-    PBDecodeMsg(nfc.mb + MB_DATA, nfc.mb_len + 1 - MB_DATA);
+    PBDecodeMsg(data, data_len);
 
     /* Answer ok*/
     const uint8_t response[5] = {MB_R2HSETCONFIG, MB_RESPONSE, pw_valid ? MB_NOERROR : MB_BADREQUEST, MB_NOTCHAINED, 0x00};
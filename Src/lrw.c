@@ -4,12 +4,12 @@
 #include "hardware.h"                    // DEBUG_MSG
 #include "eeprom.h"                      // DevCfg
 #include "sensors.h"                     // bma400 sfh7776 hdc2080
-#include "LoRaMac-node/common/NvmDataMgmt.h"          // NvmDataMgmtEvent
+#include "LoRaMac-node/common/NvmDataMgmt.h"          // NvmDataMgmtEvent, NvmDataMgmtCountersOnly
 #include "LoRaMac-node/mac/region/RegionEU868.h"      // EU868_MIN_TX_POWER
 #include "LoRaMac-node/mac/region/RegionUS915.h"      // US915_MIN_TX_POWER
 #include "LoRaMac-node/common/Commissioning.h"        // OVER_THE_AIR_ACTIVATION
 #include "LoRaMac-node/common/LmHandlerMsgDisplay.h"  // Display*
-#include "LoRaMac-node/boards/sx126x-board.h"         // SX126x
+#include "LoRaMac-node/boards/sx126x-board.h"         // SX126x SX126xBusyStats
 #include "LoRaMac-node/mac/LoRaMacTest.h"             // LoRaMacTestSetDutyCycleOn
 #include <string.h>  // memcpy memcmp
 
@@ -346,7 +346,6 @@ void LRW_TX(LmHandlerAppData_t *appData) {
 #ifdef EEDBGLOG
   {
     uint32_t sended = *(volatile uint32_t*)EEPROM_LOG_SENDED;
-    HW_EraseEEPROM(EEPROM_LOG_SENDED);
     HW_ProgramEEPROM(EEPROM_LOG_SENDED, sended + 1);
   }
 #endif
@@ -374,6 +373,11 @@ void LRW_Process(void) {
 
 static void LRW_SaveNvm(uint16_t notifyFlags) {
   NvmDataMgmtEvent(notifyFlags);
+  // Frame counters go to the journal, DevCfg has nothing to pick up from them.
+  if(NvmDataMgmtCountersOnly(notifyFlags))
+    return;
+  // Join state, session keys, ADR etc. show in the DeviceConfiguration over NFC.
+  PBInvalidate_DeviceConfiguration();
   if(!DevCfg.changed.lrw) {
     LRW_ToDevCfg();
     EEPROM_Save();
@@ -689,6 +693,9 @@ static void McpsConfirm(McpsConfirm_t *mcpsConfirm) {
   DBG_PRINTF("LRW MCPS AckReceived:   %d\n", mcpsConfirm->AckReceived);
   DBG_PRINTF("LRW MCPS UpLinkCounter: %d\n", mcpsConfirm->UpLinkCounter);
   DBG_PRINTF("LRW MCPS Channel:       %d\n", mcpsConfirm->Channel);
+  DBG_PRINTF("LRW RADIO BUSY waits:%d timeouts:%d max:%dus op:0x%02x\n", SX126xBusyStats.Waits,
+      SX126xBusyStats.Timeouts, SX126xBusyStats.MaxUs, SX126xBusyStats.MaxOpcode);
+  HW_BootPhase(BOOT_FIRST_UPLINK);
 
   /* Unschedule retransmissions */
   if(mcpsConfirm->AckReceived) {
@@ -792,19 +799,69 @@ int32_t LRW_HasQueue(void) {
   return 0;
 }
 
+#if defined(STX)
+/*
+ * NAME
+ *        LRW_Admit - Rate limit events of a trigger by DevCfg.event_limit
+ *
+ * DESCRIPTION
+ *        A token bucket per trigger allows burst events in a row, regaining
+ *        one per refill period, and no two within the re-arm interval. E.g. a
+ *        light left on or a chattering accelerometer costs a few messages,
+ *        not the battery and the gateway's duty cycle.
+ *
+ *        The reed switch skips the re-arm interval, as opening and closing
+ *        share its trigger and a quick close must not go unreported.
+ *
+ * RETURN VALUE
+ *        true if the event may be sent, otherwise it's counted in
+ *        lrw.suppressed and reported by the next message.
+ */
+static bool LRW_Admit(uint8_t trigger_type) {
+  struct LRW_Gate *g = &lrw.gate[trigger_type % LRW_TRIGGERS];
+  uint32_t now = HW_RTCGetSTime(), tat;
+  uint32_t burst = DevCfg.event_limit & LRW_LIMIT_BURST;
+  uint32_t period = (DevCfg.event_limit & LRW_LIMIT_REFILL) >> 8;
+  uint32_t rearm = (DevCfg.event_limit & LRW_LIMIT_REARM) >> 16;
+
+  if(!burst)
+    return true;
+  period = (period ? period : 1) * 60;
+  rearm = trigger_type == LRW_B0_TRIGGER_REED_SWITCH ? 0 : rearm * 10;
+
+  tat = g->tat && (int32_t)(g->tat - now) > 0 ? g->tat : now;
+  if((g->tat && now - g->last < rearm) || tat - now > (burst - 1) * period) {
+    lrw.suppressed += lrw.suppressed < UINT16_MAX;
+    DBG_PRINTF("LRW Event 0x%02x suppressed, total:%u\n", trigger_type, lrw.suppressed);
+    return false;
+  }
+  g->tat = tat + period;
+  g->last = now;
+  return true;
+}
+#endif
+
 /*
  * NAME
  *        enqueueToSend - Ask *main* ctx to make LoRa msg to send. Preclude sleep.
  *
+ * DESCRIPTION
+ *        Only reserves a queue slot, LRW_Send composes the message in *main*
+ *        ctx right before sending. So sensors are sampled then, rather than
+ *        an ISR packing whatever the cache held.
+ *
  * NOTES
  *    Locking regards
- *        Either *irq* or *main* context may invoke `enqueueToSend`, no locking
- *        element needed as only *main* can pop, and *irq* only push.
+ *        Either *irq* or *main* context may invoke `enqueueToSend`. Sensor
+ *        events push from *main* too, and an ISR may preempt them. So the
+ *        rate limiter and picking and claiming a slot run with interrupts
+ *        masked. Only *main* pops.
  *        main:           Can't read once .msg_type is cleared.
  *        enqueueToSend:  Can't write once .msg_type is set.
  */
 void enqueueToSend(enum MsgType msg_type, uint8_t trigger_type) {
   size_t i = 0;
+  uint32_t primask;
 
   /* Queue only if we're joined */
   if(!LRW_IsJoined()) {
@@ -812,43 +869,78 @@ void enqueueToSend(enum MsgType msg_type, uint8_t trigger_type) {
     return;
   }
 
+  if(msg_type != SCHEDULED && msg_type != EVENT) {
+    DEBUG_MSG("LRW ERR None Event\n");
+    return;
+  }
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+
+#if defined(STX)
+  /* Event storms, e.g. a threshold being hovered around */
+  if(msg_type == EVENT && !LRW_Admit(trigger_type)) {
+    __set_PRIMASK(primask);
+    return;
+  }
+#endif
+
   /* Pick an empty buffer to use */
   while(lrw.queue[i].msg_type && ++i < LRW_QUEUE_LEN);
 
   /* It appears there's no empty buffer */
   if(i >= LRW_QUEUE_LEN) {
+    __set_PRIMASK(primask);
     DEBUG_MSG("LRW ERR Queue full!\n");
     return;
   }
-  uint8_t *msg = lrw.queue[i].msg;
 
-  float voltage, temperature;
-  getBatteryVoltageAndTemperature(&voltage, &temperature);
+  /* Queue request for sending message, composed by LRW_Send */
+  lrw.queue[i].len = 0;
+#if defined(STX)
+  lrw.queue[i].trigger_type = trigger_type;
+#elif defined(STA)
+  lrw.queue[i].gesture = detectedGesture;
+#endif
+  lrw.queue[i].msg_type = msg_type;
+  __set_PRIMASK(primask);
+}
+
+/*
+ * NAME
+ *        LRW_Compose - Make LoRa msg of a queued request, in *main* ctx
+ */
+static void LRW_Compose(struct LRW_Msg *m) {
+  uint8_t *msg = m->msg;
+
+  uint16_t millivolts;
+  int16_t centicelsius;
+  getBatteryVoltageAndTemperature(&millivolts, &centicelsius);
 
   /* Compose a message */
-  switch(msg_type) {
+  switch(m->msg_type) {
   case SCHEDULED: {
 #if defined(STA)
     { /* Battery Voltage */
-      uint32_t v = voltage * 100;
+      uint32_t v = millivolts / 10;
       v = v < 201 ? 201 : v;
       v = v > 327 ? 327 : v;
       /* MCU Temperature */
-      int32_t t = temperature * 10;
+      int32_t t = centicelsius / 10;
       t = t < -400 ? -400 : t;
       t = t > 1250 ? 1250 : t;
       t = (t + 400) * 255 / 1650;
       msg[1] = (v - 200) & 0x7f;
       msg[2] = t;
     }
-    lrw.queue[i].len = 3;
-    msg[0] = 0x40 /* version */ | 0; // NB! 0x3c bits are modified at send time! Contains TX Power
+    m->len = 3;
+    msg[0] = 0x40 /* version */ | 0; // NB! 0x1c bits are modified at send time! Contains TX Power
     break;
 #elif defined(STE)
     memset(msg, 0, 11);
     msg[0] = 0x40 /* version */;
     { /* Battery Voltage */
-      uint32_t v = voltage * 100;
+      uint32_t v = millivolts / 10;
       v = v < 201 ? 201 : v;
       v = v > 327 ? 327 : v;
       msg[1] = (v - 200) & 0x7f;
@@ -900,7 +992,7 @@ void enqueueToSend(enum MsgType msg_type, uint8_t trigger_type) {
       msg[ 9] |= v >>  8 << 4 & 0xf0;
       msg[10] |= v >> 12 << 2 & 0x1c;
     }
-    lrw.queue[i].len = 11;
+    m->len = 11;
 #else
     static_assert(0, "Not adapted for V1.1 Firmware or documented.");
     { /* BME680: Temperature, Humidity, Pressure, Air Quality Index */
@@ -922,7 +1014,7 @@ void enqueueToSend(enum MsgType msg_type, uint8_t trigger_type) {
       msg[4] = u16_pressure;
       msg[5] = u16_pressure >> 8;
     }
-    lrw.queue[i].len = 6;
+    m->len = 6;
     msg[0] = 0;
 #endif
     break;
@@ -935,11 +1027,11 @@ void enqueueToSend(enum MsgType msg_type, uint8_t trigger_type) {
   case EVENT: {
 #ifdef STA
     { /* Battery Voltage */
-      uint32_t v = voltage * 100;
+      uint32_t v = millivolts / 10;
       v = v < 201 ? 201 : v;
       v = v > 327 ? 327 : v;
       /* MCU Temperature */
-      int32_t t = temperature * 10;
+      int32_t t = centicelsius / 10;
       t = t < -400 ? -400 : t;
       t = t > 1250 ? 1250 : t;
       t = (t + 400) * 255 / 1650;
@@ -948,27 +1040,41 @@ void enqueueToSend(enum MsgType msg_type, uint8_t trigger_type) {
     }
     { /* Gesture Event */
       uint8_t gest_cnt, gest;
-      switch(detectedGesture) {
+      switch(m->gesture) {
       case 1: gest = 0x0, DevCfg.changed.any = true, gest_cnt = DevCfg.singleCount++; break;
       case 2: gest = 0x1, DevCfg.changed.any = true, gest_cnt = DevCfg.doubleCount++; break;
       case 3: gest = 0x2, DevCfg.changed.any = true, gest_cnt = DevCfg.longCount++; break;
-      default: gest = 0x3; gest_cnt = 0; DBG_PRINTF("LRW ERR Unknown gesture %u\n", detectedGesture);
+      default: gest = 0x3; gest_cnt = 0; DBG_PRINTF("LRW ERR Unknown gesture %u\n", m->gesture);
       }
-      msg[0]  = ((gest & 0x01) << 1) | 0x40 /* version */ | LRW_B0_TRIGGER_EVENT; // NB! 0x3c bits are modified at send time! Contains TX Power
+      msg[0]  = ((gest & 0x01) << 1) | 0x40 /* version */ | LRW_B0_TRIGGER_EVENT; // NB! 0x1c bits are modified at send time! Contains TX Power
       msg[1] |= ((gest & 0x02) >> 1 << 7);
       msg[3] = gest_cnt;
     }
-    lrw.queue[i].len = 4;
+    m->len = 4;
 #endif
 #ifdef STX
     { /* Battery Voltage */
-      uint32_t v = voltage * 100;
+      uint32_t v = millivolts / 10;
       v = v < 201 ? 201 : v;
       v = v > 327 ? 327 : v;
       msg[1] = (v - 200) & 0x7f;
     }
-    { /* BMA400: Acceleration (X/Y/Z Axis) */
-      BMA400_Read();
+    Sensors_Update();
+    if(bma400.vibration) { /* BMA400: Vibration features of last FIFO batch */
+      msg[2] = bma400.vib.rms_x / 10 > 255 ? 255 : bma400.vib.rms_x / 10;
+      msg[3] = bma400.vib.rms_y / 10 > 255 ? 255 : bma400.vib.rms_y / 10;
+      msg[4] = bma400.vib.rms_z / 10 > 255 ? 255 : bma400.vib.rms_z / 10;
+      msg[5] = bma400.vib.peak  / 20 > 255 ? 255 : bma400.vib.peak  / 20;
+      msg[6] = bma400.vib.crest / 10 > 255 ? 255 : bma400.vib.crest / 10;
+      msg[7] = bma400.vib.freq  /  2 > 255 ? 255 : bma400.vib.freq  /  2;
+    } else if(bma400.events) { /* BMA400: Acceleration (X/Y/Z Axis), activity and steps */
+      msg[2] = bma400.raw_x;
+      msg[3] = bma400.raw_y;
+      msg[4] = bma400.raw_z;
+      msg[5] = bma400.activity;
+      msg[6] = bma400.steps;
+      msg[7] = bma400.steps >> 8;
+    } else { /* BMA400: Acceleration (X/Y/Z Axis) */
       msg[2] = bma400.raw_x;
       msg[3] = bma400.raw_y;
       msg[4] = bma400.raw_z;
@@ -977,19 +1083,28 @@ void enqueueToSend(enum MsgType msg_type, uint8_t trigger_type) {
       msg[7] = bma400.raw_z_ref;
     }
     { /* HDC2080: Temperature, Humidity */
-      HDC2080_Read();
       msg[8] = hdc2080.raw_temp >> 7 & 0xff;
       msg[9] = (hdc2080.raw_temp >> 8 & 0x80) | hdc2080.humid % 100;
     }
     { /* SFH7776: Luminance */
-      SFH7776_Read();
-      msg[10] = sfh7776.lux;
-      msg[11] = sfh7776.lux >> 8 & 0x3f;
+      uint16_t lux = sfh7776.lux > 0x3fff ? 0x3fff : sfh7776.lux;
+      msg[10] = lux;
+      msg[11] = lux >> 8 & 0x3f;
+    }
+    msg[ 0]  = 0x40 /* version */ | (m->trigger_type & 0x03) | (bma400.vibration ? 0x20 : 0);
+    msg[ 1] |=                      (m->trigger_type & 0x04) >> 2 << 7;
+    msg[11] |=                      (m->trigger_type & 0x18) >> 3 << 6;
+    { /* Events suppressed by rate limiter since last message */
+      __disable_irq();
+      msg[12] = lrw.suppressed > UINT8_MAX ? UINT8_MAX : lrw.suppressed;
+      lrw.suppressed = 0;
+      __enable_irq();
+    }
+    m->len = 13;
+    if(m->msg_type == SCHEDULED) { /* HDC2080: Extremes since last scheduled message, restart them */
+      HDC2080_Extremes(msg + 13);
+      m->len = 17;
     }
-    msg[ 0]  = 0x40 /* version */ | (lrw.queue[i].trigger_type & 0x03);
-    msg[ 1] |=                      (lrw.queue[i].trigger_type & 0x04) >> 2 << 7;
-    msg[11] |=                      (lrw.queue[i].trigger_type & 0x18) >> 3 << 6;
-    lrw.queue[i].len = 12;
 #endif
 #ifdef STE
     DEBUG_MSG("LRW ERR STE Event\n");
@@ -998,29 +1113,18 @@ void enqueueToSend(enum MsgType msg_type, uint8_t trigger_type) {
 #endif
     break;
   }
-  default: {
-    DEBUG_MSG("LRW ERR None Event\n");
-    return;
-  }
+  default: break;
   }
 
-  /* Queue request for sending message */
-#if defined(STX)
-  lrw.queue[i].trigger_type = trigger_type;
-#endif
-  lrw.queue[i].msg_type = msg_type;
-
 #ifdef EEDBGLOG
   {
     uint32_t events = *(volatile uint32_t*)EEPROM_LOG_EVENTS;
-    HW_EraseEEPROM(EEPROM_LOG_EVENTS);
     HW_ProgramEEPROM(EEPROM_LOG_EVENTS, events + 1);
-    if(events % 73 == 0) {
-      uint32_t *d146 = (uint32_t*)EEPROM_LOG_VOLTYR + events / 146;
+    uint32_t *d146 = (uint32_t*)EEPROM_LOG_VOLTYR + events / 146;
+    if(events % 73 == 0 && (uint32_t)d146 < EEPROM_LOG_VOLTYR_END) {
       uint32_t bak = *d146;
-      bak = events % 146 == 0 ? (bak & 0xFFFF0000) | (uint16_t)(voltage * 1000) :
-                                (bak & 0x0000FFFF) | (uint16_t)(voltage * 1000) << 16;
-      HW_EraseEEPROM((uint32_t)d146);
+      bak = events % 146 == 0 ? (bak & 0xFFFF0000) | millivolts :
+                                (bak & 0x0000FFFF) | (uint32_t)millivolts << 16;
       HW_ProgramEEPROM((uint32_t)d146, bak);
     }
   }
@@ -1062,6 +1166,10 @@ void LRW_Send(void) {
     return;
   }
 
+  /* Fresh request, sample and pack now */
+  if(!lrw.queue[i].len)
+    LRW_Compose(&lrw.queue[i]);
+
   /* if prior confirmed message NACK'ed, then assert max tx power */
   if(lrw.retrans_left && DevCfg.confirmedMsgs) {
     MibRequestConfirm_t mibReq;
@@ -1102,7 +1210,7 @@ void LRW_Send(void) {
     MibRequestConfirm_t mibReq;
     mibReq.Type = MIB_CHANNELS_TX_POWER;
     LoRaMacMibGetRequestConfirm(&mibReq);
-    appData.Buffer[0] &= 0xc3; // clear bits
+    appData.Buffer[0] &= 0xe3; // clear bits
     appData.Buffer[0] |= (mibReq.Param.ChannelsTxPower & 0x7) << 2; // set bits
   }
   LRW_TX(&appData);
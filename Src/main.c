@@ -42,6 +42,7 @@
 #include "protobuf.h"
 #include "isr.h"
 #include "nfc.h"
+#include "history.h"
 #include "hardware.h" // this must to be the last include, so we can overwrite previous macros with the same name.
 /* USER CODE END Includes */
 
@@ -196,12 +197,18 @@ sleep:
   HAL_GPIO_WritePin(RF_Switch_GPIO_Port, RF_Switch_Pin, GPIO_PIN_SET);
 
   DEBUG_PRINTF("BOOTED mainfw RTT@0x%08x\n", &_SEGGER_RTT);
+  HW_BootPhase(BOOT_START);
+#ifdef I2C_DIAGNOSTIC
   I2C_Scan();
+#endif
+  I2C_Probe();
+  HW_BootPhase(BOOT_I2C);
 
   // EEPROM Testing: Clear EEPROM (Nvm, DevCfg, Password).
   // HW_ResetEEPROM((void*)DATA_EEPROM_BASE, DATA_EEPROM_BANK2_END + 1 - DATA_EEPROM_BASE);
 
   EEPROM_Load();
+  HW_BootPhase(BOOT_EEPROM);
 
 #ifdef LORAWAN
   // TODO: Optimize to enable this only when we are using the RF Chip
@@ -218,6 +225,7 @@ sleep:
   // while(1) {};
 
   LRW_Init();
+  HW_BootPhase(BOOT_LRW);
 
   // Radio Testing: Output continuous wave
   //         868 MHz EU  915 MHz US
@@ -262,6 +270,7 @@ sleep:
   // DEBUG_PRINTF("TEST EEPROM SensorConfigurations.temperatureData: %d\n", SensorConfigurations.temperatureData);
 #ifdef NFC
   NFC_Init();
+  HW_BootPhase(BOOT_NFC);
 #endif
 
 #ifdef USE_ATECC608A
@@ -281,12 +290,13 @@ if (ATECC_status != ATCA_SUCCESS) {
   DBG_PRINTF("ATECC608A serial number: %d:%d:%d:%d:%d:%d:%d:%d:%d \n", serialnum[0],serialnum[1],serialnum[2],serialnum[3],serialnum[4],serialnum[5],serialnum[6],serialnum[7],serialnum[8]);
 }
 // }
+HW_BootPhase(BOOT_ATECC);
 
 #endif
 
 #ifdef BMA400
   /* BMA400 persists across MCU reset, either power-cycle or explicitly reset to disable it. */
-  // BMA400_Init(DevCfg.bma400_config, DevCfg.bma400_threshold);
+  // BMA400_Init(DevCfg.bma400_config, DevCfg.bma400_threshold, DevCfg.bma400_events);
 
   // Sensor Testing: BMA400 (Acceleration)
   // for(int i = 0; i < 5; i++) {
@@ -300,7 +310,7 @@ if (ATECC_status != ATCA_SUCCESS) {
 
 #ifdef SFH7776
   /* SFH7776 persists across MCU reset, either power-cycle or explicitly reset to disable it. */
-  // SFH7776_Init(DevCfg.sfh7776_threshold_upper, DevCfg.sfh7776_threshold_lower);
+  // SFH7776_Init(DevCfg.sfh7776_threshold_upper, DevCfg.sfh7776_threshold_lower, (DevCfg.event_limit & LRW_LIMIT_HYST_LIGHT) >> 24);
 
   // Sensor Testing: SFH7776 (Luminance)
   // for(int i = 0; i < 5; i++) {
@@ -314,7 +324,7 @@ if (ATECC_status != ATCA_SUCCESS) {
 
 #ifdef HDC2080
   /* HDC2080 persists across MCU reset, either power-cycle or explicitly reset to disable it. */
-  // HDC2080_Init(DevCfg.hdc2080_mode, DevCfg.hdc2080_threshold);
+  // HDC2080_Init(DevCfg.hdc2080_threshold, DevCfg.hdc2080_windows, DevCfg.hdc2080_config);
 
   // Sensor Testing: HDC2080 (Humidity & Temperature)
   // for(int i = 0; i < 5; i++) {
@@ -328,12 +338,15 @@ if (ATECC_status != ATCA_SUCCESS) {
 
 #ifdef BME680
 #ifdef BSEC
-  BSEC_Init(BSEC_SAMPLE_RATE_ULP);
-  BSEC_Read();
+  if(I2C_Present(0x76 << 1)) {
+    BSEC_Init(BSEC_SAMPLE_RATE_ULP);
+    BSEC_Read();
+  }
   // Sensor Testing: BSEC
   // BSEC_ForeverTest();
 #else
-  BME680_Init();
+  if(I2C_Present(0x76 << 1))
+    BME680_Init();
   // Sensor Testing: BME680
   // for (uint8_t i = 1; i < 5; i++) {
   //   BME680_ReadOld();
@@ -342,6 +355,21 @@ if (ATECC_status != ATCA_SUCCESS) {
 #endif /* BSEC */
 #endif /* BME680 */
 
+#if defined(STX) || defined(STE)
+  /* Warm the sensor cache, NFC and LoRa events read from it */
+  Sensors_Read();
+#endif
+#ifdef HISTORY
+  /* First history sample right away, then every history_interval */
+  History_Init();
+  History_Request();
+  PrepareWakeup(WAKEUP_HISTORY_SAMPLE, DevCfg.history_interval);
+#endif
+#ifdef NFC_NDEF
+  NFC_NdefRequest();
+#endif
+  HW_BootPhase(BOOT_SENSORS);
+
   // Button Testing: Read input pin
   // while(1) {
   //   int buttonValue = HAL_GPIO_ReadPin(Button0_GPIO_Port, Button0_Pin);
@@ -352,7 +380,6 @@ if (ATECC_status != ATCA_SUCCESS) {
 #ifdef EEDBGLOG
   {
     uint32_t reboots = *(volatile uint32_t*)EEPROM_LOG_REBOTS;
-    HW_EraseEEPROM(EEPROM_LOG_REBOTS);
     HW_ProgramEEPROM(EEPROM_LOG_REBOTS, reboots + 1);
   }
 #endif
@@ -371,30 +398,30 @@ if (ATECC_status != ATCA_SUCCESS) {
      */
     if(DevCfg.changed.any) {
 #ifdef STX
-      if(DevCfg.changed.bma400) {
+      if(DevCfg.changed.bma400 && I2C_Present(0x14 << 1)) {
         if(DevCfg.useSensor.bma400) {
-          BMA400_Init(DevCfg.bma400_config, DevCfg.bma400_threshold);
+          BMA400_Init(DevCfg.bma400_config, DevCfg.bma400_threshold, DevCfg.bma400_events);
           DEBUG_MSG("SEN BMA400  IRQ ON\n");
         } else {
-          BMA400_Init(DevCfg.bma400_config = 0xf, DevCfg.bma400_threshold = 3907);
+          BMA400_Init(DevCfg.bma400_config = 0xf, DevCfg.bma400_threshold = 3907, DevCfg.bma400_events = 0);
           DEBUG_MSG("SEN BMA400  IRQ OFF\n");
         }
       }
-      if(DevCfg.changed.sfh7776) {
+      if(DevCfg.changed.sfh7776 && I2C_Present(0x72)) {
         if(DevCfg.useSensor.sfh7776) {
-          SFH7776_Init(DevCfg.sfh7776_threshold_upper, DevCfg.sfh7776_threshold_lower);
+          SFH7776_Init(DevCfg.sfh7776_threshold_upper, DevCfg.sfh7776_threshold_lower, (DevCfg.event_limit & LRW_LIMIT_HYST_LIGHT) >> 24);
           DEBUG_MSG("SEN SFH7776 IRQ ON\n");
         } else {
-          SFH7776_Init(DevCfg.sfh7776_threshold_upper = UINT16_MAX, DevCfg.sfh7776_threshold_lower = 0);
+          SFH7776_Init(DevCfg.sfh7776_threshold_upper = UINT16_MAX, DevCfg.sfh7776_threshold_lower = 0, 0);
           DEBUG_MSG("SEN SFH7776 IRQ OFF\n");
         }
       }
-      if(DevCfg.changed.hdc2080) {
+      if(DevCfg.changed.hdc2080 && I2C_Present(0x80)) {
         if(DevCfg.useSensor.hdc2080) {
-          HDC2080_Init(DevCfg.hdc2080_mode, DevCfg.hdc2080_threshold);
+          HDC2080_Init(DevCfg.hdc2080_threshold, DevCfg.hdc2080_windows, DevCfg.hdc2080_config);
           DEBUG_MSG("SEN HDC2080 IRQ ON\n");
         } else {
-          HDC2080_Init(DevCfg.hdc2080_mode = HDC2080_TEMPERATURE_HIGH, DevCfg.hdc2080_threshold = 12499);
+          HDC2080_Init(DevCfg.hdc2080_threshold, DevCfg.hdc2080_windows = 0, DevCfg.hdc2080_config = 0);
           DEBUG_MSG("SEN HDC2080 IRQ OFF\n");
         }
       }
@@ -406,8 +433,14 @@ if (ATECC_status != ATCA_SUCCESS) {
         /* Disable scheduled messages if we're not joined. */
         PrepareWakeup(WAKEUP_LRW_SCHEDMSG, LRW_IsJoined() ? DevCfg.sendInterval : 0);
       }
+#ifdef HISTORY
+      if(DevCfg.changed.history) {
+        PrepareWakeup(WAKEUP_HISTORY_SAMPLE, DevCfg.history_interval);
+      }
+#endif
 
       EEPROM_Save();
+      PBInvalidate_DeviceConfiguration();
       memset(&DevCfg.changed, 0, sizeof DevCfg.changed);
     }
 
@@ -449,8 +482,28 @@ if (ATECC_status != ATCA_SUCCESS) {
       }
     }
 
+    I2C_Process();
 #ifdef BSEC
-    BSEC_Read();
+    if(I2C_Present(0x76 << 1))
+      BSEC_Read();
+#endif
+#if defined(STX) || defined(STE)
+    Sensors_Process();
+#endif
+#ifdef BMA400
+    BMA400_Process();
+#endif
+#ifdef HDC2080
+    HDC2080_Process();
+#endif
+#ifdef SFH7776
+    SFH7776_Process();
+#endif
+#ifdef HISTORY
+    History_Process();
+#endif
+#ifdef NFC_NDEF
+    NFC_NdefProcess();
 #endif
 
     /* Go to sleep once LoRaWAN is idle and there's no tasks on LED blinks & button gestures. */
@@ -532,6 +585,18 @@ extern Gpio_t *GpioIrq[16];
 void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
   DEBUG_PRINTF("IRQ  EXTI %d pin:%d\n", HAL_GetTick(), GPIO_Pin);
   HW_ExitStopMode();
+#ifdef BMA400
+  if(GPIO_Pin == Button0_Pin)
+    BMA400_Interrupt();
+#endif
+#ifdef HDC2080
+  if(GPIO_Pin == TEMP_Int_Pin)
+    HDC2080_Interrupt();
+#endif
+#ifdef SFH7776
+  if(GPIO_Pin == LIGHT_Int_Pin)
+    SFH7776_Interrupt();
+#endif
 }
 
 /* Wake-up timer (RTC) implementation */
@@ -546,10 +611,25 @@ void HAL_RTCEx_WakeUpTimerEventCallback(RTC_HandleTypeDef *hrtc) {
   if(wuh.schedmsg_due && wuh.schedmsg_due <= now) {
     PrepareWakeup(WAKEUP_LRW_SCHEDMSG, DevCfg.sendInterval);
     enqueueToSend(SCHEDULED, 0);
+#ifdef NFC_NDEF
+    NFC_NdefRequest();
+#endif
   }
   if(wuh.bsec_due && wuh.bsec_due <= now) {
     PrepareWakeup(WAKEUP_BSEC_SAMPLE, 0);
   }
+#ifdef HISTORY
+  if(wuh.history_due && wuh.history_due <= now) {
+    PrepareWakeup(WAKEUP_HISTORY_SAMPLE, DevCfg.history_interval);
+    History_Request();
+#ifdef NFC_NDEF
+    NFC_NdefRequest();
+#endif
+  }
+  if(wuh.hold_due && wuh.hold_due <= now) {
+    PrepareWakeup(WAKEUP_HISTORY_HOLD, 0);
+  }
+#endif
 }
 
 static void Sleep(void) {
@@ -576,8 +656,33 @@ static void Sleep(void) {
   if(DutyCycleWaitTime < 1000 && LRW_IsJoined() && LRW_HasQueue())
     return;
 
+#ifdef BMA400
+  /* Sleep if BMA400 FIFO or event isn't waiting for readout */
+  if(bma400.irq)
+    return;
+#endif
+
+#ifdef HDC2080
+  /* Sleep if HDC2080 window or peak restart isn't handled */
+  if(hdc2080.irq)
+    return;
+#endif
+
+#ifdef SFH7776
+  /* Sleep if SFH7776 threshold crossing isn't handled */
+  if(sfh7776.irq)
+    return;
+#endif
+
+#ifdef HISTORY
+  /* Sleep if history sample is taken, wake up when NFC download hold ends */
+  if(History_Pending())
+    return;
+  PrepareWakeup(WAKEUP_HISTORY_HOLD, History_Deferred());
+#endif
+
 #ifdef BSEC
-  { /* Sleep if BSEC sample is scheduled */
+  if(I2C_Present(0x76 << 1)) { /* Sleep if BSEC sample is scheduled */
     int64_t seconds = (bme680.bsec.next_call - HW_RTCGetNsTime()) / 1000 / 1000 / 1000;
     if(seconds > 0)
       PrepareWakeup(WAKEUP_BSEC_SAMPLE, seconds);
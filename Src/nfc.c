@@ -1,13 +1,16 @@
 /* Includes ------------------------------------------------------------------*/
 #include "hardware.h"
 #include "i2c.h"
+#include "i2c_xfer.h"
 #include "nfc.h"
+#include "protobuf.h"  /* PBEncodeMsg_DeviceSensors */
 #include "st25dv.h"
 #include <string.h>  /* memcpy */
 
 /* External variables --------------------------------------------------------*/
 ST25DV_Object_t St25Dv_Obj;
 uint32_t nfc_activity;
+uint32_t nfc_throughput;  /* B/s of last completed chained transfer, DeviceSensors field 19 */
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private defines -----------------------------------------------------------*/
@@ -21,6 +24,31 @@ static int32_t NFC_IsReady(uint16_t DevAddr, const uint32_t Trials);
 static int32_t nop(void);
 
 /* Global variables ----------------------------------------------------------*/
+/* Chained transfer in progress, see NFC_ChainSend and NFC_ChainReceive */
+static struct {
+  size_t (*encode)(uint8_t *msg, size_t len, size_t offset);  /* D2H, NULL if H2D */
+  uint32_t full;    /* Bytes of whole transfer */
+  uint32_t done;    /* Bytes transferred so far */
+  uint32_t start;   /* HW_RTCGetMsTime of chunk 0 */
+  uint16_t total;   /* Chunks, 0 if no transfer */
+  uint16_t next;    /* Chunk due */
+  uint8_t fct;
+} chain;
+
+/* Reassembly of H2D chained transfer */
+static uint8_t chain_rx[NFC_CHAIN_RX_MAX];
+
+#ifdef NFC_NDEF
+/* Start of ST25DV user memory, as last written, see NFC_NdefProcess */
+static struct {
+  uint8_t mem[NFC_NDEF_SIZE];
+  bool valid;
+  volatile bool requested;
+} ndef;
+
+static const char ndef_type[] = "application/vnd.nfuse.sensors";
+#endif
+
 /* Public functions ----------------------------------------------------------*/
 /* NAME
  *        NFC_Init - project-level abstraction to initialize st25dv.
@@ -32,6 +60,8 @@ static int32_t nop(void);
  *        so keep mailbox last.
  *
  *        Pulse st25dv gpo only on mailbox write, precluding trivial wakeups.
+ *        With NFC_NDEF, field change and RF activity don't pulse it either,
+ *        so a phone reading the NDEF record doesn't wake the MCU at all.
  *
  * BUGS
  *        Doesn't init host I2C1/GPIO and assumes prior setup.
@@ -72,8 +102,8 @@ int32_t NFC_Init(void) {
 
   /* Enable GPO interrupt status bits */
   if((r = St25Dv_Drv.GetITStatus(&St25Dv_Obj, &v))) {c = 0x7; goto err;};
-  if(v != (ST25DV_GPO_ALL_MASK))
-    if((r = St25Dv_Drv.ConfigIT(&St25Dv_Obj, ST25DV_GPO_ALL_MASK))) {c = 0x8; goto err;};
+  if(v != (NFC_GPO_MASK))
+    if((r = St25Dv_Drv.ConfigIT(&St25Dv_Obj, NFC_GPO_MASK))) {c = 0x8; goto err;};
 
   /*
    * Assert defaults
@@ -172,7 +202,8 @@ int32_t NFC_HasActivity(void) {
  * NOTES
  *    Interrupt Context
  *        ST25DV requires a delay (theory unknown), and for lack of millisecond scheduler,
- *        we block using HAL_Delay. Also HAL_I2C_Mem_Read is used instead of HAL_I2C_Mem_Read_IT.
+ *        we block using HAL_Delay. Transfers go through I2C_MemRead, which sleeps
+ *        until the I2C1 interrupt (priority 0) completes them.
  *        Thus invoke within EXTI0_1_IRQ, whose priority is below all other interrupts.
  *        In practice, it means main is blocked for a couple milliseconds.
  *
@@ -185,7 +216,7 @@ int32_t NFC_ReadReg(uint16_t DevAddr, uint16_t Reg, uint8_t *pData, uint16_t Len
   uint32_t try = 3, r = 1, ts = HAL_GetTick();
 
   /* First try, Hooray! */
-  if(!HAL_I2C_Mem_Read(&hi2c1, DevAddr, Reg, I2C_MEMADD_SIZE_16BIT, pData, Length, 50))
+  if(!I2C_MemRead(DevAddr, Reg, I2C_MEMADD_SIZE_16BIT, pData, Length, 50))
     return 0;
 
   /* Ok, well, maybe st25dv was preoccupied by serving phone, or nasal demons */
@@ -195,14 +226,12 @@ int32_t NFC_ReadReg(uint16_t DevAddr, uint16_t Reg, uint8_t *pData, uint16_t Len
    * 1. A rare coincidence,
    * 2. The request is invalid (under context),
    * 3. This is that time where device goes for a hike for 1156 ms */
-  while(try-- && (r = HAL_I2C_Mem_Read(&hi2c1, DevAddr, Reg, I2C_MEMADD_SIZE_16BIT, pData, Length, 50)))
+  while(try-- && (r = I2C_MemRead(DevAddr, Reg, I2C_MEMADD_SIZE_16BIT, pData, Length, 50)))
     DBG_PRINTF("NFC I2C <RX TRY dur:%3d try:%2d ret:0x%x err:0x%x dev:0x%02x reg:0x%04x len:%x\n", HAL_GetTick() - ts, try, r, hi2c1.ErrorCode, DevAddr, Reg, Length), NFC_WaitACK(50);
   if(r) {
     DBG_PRINTF("NFC I2C <RX ERR dur:%3d ret:0x%x err:0x%x dev:0x%02x reg:0x%04x len:0x%x caller:%p\n", HAL_GetTick() - ts, r, hi2c1.ErrorCode, DevAddr, Reg, Length, __builtin_return_address(0));
     MX_I2C1_Init();
-    if(!I2C_Scan()) {
-      DEBUG_MSG("NFC I2C <RX ERR Reinit Failed!\n");
-    }
+    I2C_RequestProbe();
   }
   return r;
 }
@@ -217,7 +246,7 @@ int32_t NFC_WriteReg(uint16_t DevAddr, uint16_t Reg, const uint8_t *pData, uint1
   uint32_t try = 3, r = 1, ts = HAL_GetTick();
 
   /* First try, Hooray! */
-  if(!HAL_I2C_Mem_Write(&hi2c1, DevAddr, Reg, I2C_MEMADD_SIZE_16BIT, (void*)pData, Length, 50))
+  if(!I2C_MemWrite(DevAddr, Reg, I2C_MEMADD_SIZE_16BIT, (void*)pData, Length, 50))
     return 0;
 
   /* Ok, well, maybe st25dv was preoccupied by serving phone, or nasal demons */
@@ -227,14 +256,12 @@ int32_t NFC_WriteReg(uint16_t DevAddr, uint16_t Reg, const uint8_t *pData, uint1
    * 1. A rare coincidence,
    * 2. The request is invalid (under context),
    * 3. This is that time where device goes for a hike for 1156 ms */
-  while(try-- && (r = HAL_I2C_Mem_Write(&hi2c1, DevAddr, Reg, I2C_MEMADD_SIZE_16BIT, (void*)pData, Length, 50)))
+  while(try-- && (r = I2C_MemWrite(DevAddr, Reg, I2C_MEMADD_SIZE_16BIT, (void*)pData, Length, 50)))
     DBG_PRINTF("NFC I2C >TX TRY dur:%3d try:%2d ret:0x%x err:0x%x dev:0x%02x reg:0x%04x len:%x\n", HAL_GetTick() - ts, try, r, hi2c1.ErrorCode, DevAddr, Reg, Length), NFC_WaitACK(50);
   if(r) {
     DBG_PRINTF("NFC I2C >TX ERR dur:%3d ret:0x%x err:0x%x dev:0x%02x reg:0x%04x len:0x%x caller:%p\n", HAL_GetTick() - ts, r, hi2c1.ErrorCode, DevAddr, Reg, Length, __builtin_return_address(0));
     MX_I2C1_Init();
-    if(!I2C_Scan()) {
-      DEBUG_MSG("NFC I2C >RX ERR Reinit Failed!\n");
-    }
+    I2C_RequestProbe();
   }
   return r;
 }
@@ -356,6 +383,203 @@ void NFC_ClearMailbox(void) {
   NFC_WriteReg(ST25DV_ADDR_DATA_I2C, ST25DV_MB_CTRL_DYN_REG, &(uint8_t){1}, 1);
 }
 
+/* NAME
+ *        MBEncodeHeader - counterpart of MBDecodeHeader for chained frames
+ */
+static void MBEncodeHeader(uint8_t * const pData, uint8_t fctcode, uint8_t error, uint32_t fulllength, uint16_t totalchunk, uint16_t chunknb, uint8_t framelength) {
+  pData[MB_FCTCODE] = fctcode;
+  pData[MB_CMDRESP] = MB_RESPONSE;
+  pData[MB_ERROR] = error;
+  pData[MB_CHAINING] = MB_CHAINED;
+  pData[MB_CH_FULLLENGTH - 3] = fulllength >> 24;
+  pData[MB_CH_FULLLENGTH - 2] = fulllength >> 16;
+  pData[MB_CH_FULLLENGTH - 1] = fulllength >> 8;
+  pData[MB_CH_FULLLENGTH] = fulllength;
+  pData[MB_CH_TOTALCHUNK - 1] = totalchunk >> 8;
+  pData[MB_CH_TOTALCHUNK] = totalchunk;
+  pData[MB_CH_NBCHUNK - 1] = chunknb >> 8;
+  pData[MB_CH_NBCHUNK] = chunknb;
+  pData[MB_CH_LENGTH] = framelength;
+}
+
+/* NAME
+ *        NFC_ChainEnd - finish or abandon chained transfer, logging throughput
+ */
+static void NFC_ChainEnd(bool ok) {
+  const uint32_t ms = HW_RTCGetMsTime() - chain.start;
+
+  if(ok) {
+    nfc_throughput = ms ? (uint64_t)chain.full * 1000 / ms : chain.full * 1000;
+    DBG_PRINTF("NFC CHAIN %s fct:0x%02x %u B in %u ms, %u B/s\n", chain.encode ? "D2H" : "H2D", chain.fct, chain.full, ms, nfc_throughput);
+  } else
+    DBG_PRINTF("NFC CHAIN %s fct:0x%02x abandoned at chunk %u/%u\n", chain.encode ? "D2H" : "H2D", chain.fct, chain.next, chain.total);
+  chain.total = 0;
+}
+
+/* NAME
+ *        NFC_ChainChunk - stream next chunk of D2H transfer into mailbox
+ *
+ * DESCRIPTION
+ *        Should the response have changed size since NFC_ChainSend, the
+ *        chunks wouldn't add up to it. Then the transfer is abandoned with an
+ *        error frame instead.
+ */
+static void NFC_ChainChunk(uint8_t *mb) {
+  const uint32_t len = chain.full - chain.done < MB_CH_MAXLENGTH ? chain.full - chain.done : MB_CH_MAXLENGTH;
+
+  MBEncodeHeader(mb, chain.fct, MB_NOERROR, chain.full, chain.total, chain.next, len);
+  if(chain.encode(mb + MB_CH_DATA, len, chain.done) != chain.full) {
+    DBG_PRINTF("NFC CHAIN D2H fct:0x%02x response changed size\n", chain.fct);
+    memcpy(mb, (uint8_t[5]){chain.fct, MB_RESPONSE, MB_DEFAULTERROR, MB_NOTCHAINED, 0x00}, MB_DATA);
+    NFC_WriteReg(ST25DV_ADDR_DATA_I2C, ST25DV_MAILBOX_RAM_REG, mb, MB_DATA);
+    NFC_ChainEnd(false);
+    return;
+  }
+  if(NFCTAG_OK != NFC_WriteReg(ST25DV_ADDR_DATA_I2C, ST25DV_MAILBOX_RAM_REG, mb, MB_CH_DATA + len)) {
+    NFC_ChainEnd(false);
+    return;
+  }
+  chain.done += len;
+  chain.next++;
+}
+
+/* NAME
+ *        NFC_ChainSend - answer with a response larger than the mailbox
+ *
+ * DESCRIPTION
+ *        encode(msg, len, offset) stores len bytes of the response starting
+ *        at offset to msg, and returns size of the whole response. It must
+ *        encode the very same response on each call of a transfer, and msg
+ *        NULL with len 0 asks for the size only. A call returning another
+ *        size fails the transfer, see NFC_ChainChunk.
+ *
+ *        Each chunk is encoded straight into the mailbox buffer mb. The 1st
+ *        chunk is written right away, the others by NFC_ChainNext, once RF
+ *        has read out the previous one. A response fitting the mailbox is
+ *        sent as a simple frame.
+ *
+ * SEE ALSO
+ *        mailboxfunc.c:MBWriteChainedMsg of STSW-ST25DV001 firmware.
+ */
+void NFC_ChainSend(uint8_t *mb, uint8_t fct, size_t (*encode)(uint8_t *msg, size_t len, size_t offset)) {
+  const size_t full = encode(NULL, 0, 0);
+
+  if(chain.total)
+    NFC_ChainEnd(false);
+
+  if(full <= 256 - MB_DATA) {
+    memcpy(mb, (uint8_t[5]){fct, MB_RESPONSE, MB_NOERROR, MB_NOTCHAINED, full}, MB_DATA);
+    if(encode(mb + MB_DATA, full, 0) != full)
+      memcpy(mb, (uint8_t[5]){fct, MB_RESPONSE, MB_DEFAULTERROR, MB_NOTCHAINED, 0x00}, MB_DATA);
+    NFC_WriteReg(ST25DV_ADDR_DATA_I2C, ST25DV_MAILBOX_RAM_REG, mb, MB_DATA + mb[MB_LENGTH]);
+    return;
+  }
+
+  chain.encode = encode;
+  chain.fct = fct;
+  chain.full = full;
+  chain.done = 0;
+  chain.total = (full + MB_CH_MAXLENGTH - 1) / MB_CH_MAXLENGTH;
+  chain.next = 0;
+  chain.start = HW_RTCGetMsTime();
+  DBG_PRINTF("NFC CHAIN D2H fct:0x%02x %u B in %u chunks\n", fct, chain.full, chain.total);
+  NFC_ChainChunk(mb);
+}
+
+/* NAME
+ *        NFC_ChainNext - advance D2H transfer, upon RFGETMSG
+ *
+ * RETURN VALUE
+ *        true if a D2H transfer is in progress, i.e. event is consumed.
+ */
+bool NFC_ChainNext(uint8_t *mb) {
+  if(!chain.total || !chain.encode)
+    return false;
+  if(chain.next == chain.total)
+    NFC_ChainEnd(true);
+  else
+    NFC_ChainChunk(mb);
+  return true;
+}
+
+/* NAME
+ *        NFC_ChainReceive - reassemble H2D chained frame, upon RFPUTMSG
+ *
+ * DESCRIPTION
+ *        Chunks must arrive in order, numbered from 0, each one having the
+ *        same fct, full length and chunk count. Flow control is inherent,
+ *        since RF can't put the next chunk, until mb has been read out.
+ *
+ *        Out of order chunks and oversized transfers are answered with
+ *        MB_CHUNKERROR or MB_LENGTHERROR, and abandoned. Any simple frame
+ *        abandons a transfer as well, see NFC_ChainAbort.
+ *
+ * RETURN VALUE
+ *        Pointer to whole transfer, with *len set to its size, once last
+ *        chunk arrived. NULL otherwise.
+ */
+const uint8_t *NFC_ChainReceive(uint8_t *mb, size_t mb_len, size_t *len) {
+  MB_HEADER_T h = {0};
+  uint8_t error = MB_CHUNKERROR;
+
+  if(mb_len < MB_CH_DATA)
+    goto err;
+  MBDecodeHeader(mb, &h);
+  if(h.framesize + 1U != mb_len)
+    goto err;
+
+  if(h.chunknb == 0) {
+    if(chain.total)
+      NFC_ChainEnd(false);
+    if(h.fulllength > sizeof chain_rx) {
+      error = MB_LENGTHERROR;
+      goto err;
+    }
+    chain.encode = NULL;
+    chain.fct = h.fctcode;
+    chain.full = h.fulllength;
+    chain.done = 0;
+    chain.total = h.totalchunk;
+    chain.next = 0;
+    chain.start = HW_RTCGetMsTime();
+  }
+  if(!chain.total || chain.encode || h.fctcode != chain.fct || h.chunknb != chain.next || h.totalchunk != chain.total || h.fulllength != chain.full)
+    goto err;
+  if(h.framelength > chain.full - chain.done) {
+    error = MB_LENGTHERROR;
+    goto err;
+  }
+
+  memcpy(chain_rx + chain.done, mb + MB_CH_DATA, h.framelength);
+  chain.done += h.framelength;
+  if(++chain.next < chain.total)
+    return NULL;
+  if(chain.done != chain.full) {
+    error = MB_LENGTHERROR;
+    goto err;
+  }
+
+  NFC_ChainEnd(true);
+  *len = chain.full;
+  return chain_rx;
+
+err:
+  DBG_PRINTF("NFC CHAIN H2D fct:0x%02x chunk %u/%u rejected, error:%u\n", mb[MB_FCTCODE], h.chunknb, h.totalchunk, error);
+  if(chain.total)
+    NFC_ChainEnd(false);
+  memcpy(mb, (uint8_t[5]){mb[MB_FCTCODE], MB_RESPONSE, error, MB_NOTCHAINED, 0x00}, MB_DATA);
+  NFC_WriteReg(ST25DV_ADDR_DATA_I2C, ST25DV_MAILBOX_RAM_REG, mb, MB_DATA);
+  return NULL;
+}
+
+/* NAME
+ *        NFC_ChainAbort - abandon transfer in progress, as RF moved on
+ */
+void NFC_ChainAbort(void) {
+  if(chain.total)
+    NFC_ChainEnd(false);
+}
+
 /* NAME
  *        NFC_ReadRegAll - devtool to check all contents of st25dv
  *
@@ -487,3 +711,103 @@ uint32_t NFC_ReadRegAll(struct ST25DV_AllRegs * const save) {
   }
   return 0;
 }
+
+#ifdef NFC_NDEF
+/* NAME
+ *        NFC_NdefEncode - Type 5 Tag layout of ST25DV user memory
+ *
+ * DESCRIPTION
+ *        Capability container, NDEF message TLV holding a single MIME record
+ *        with message DeviceSensors as payload, then terminator TLV.
+ *
+ * RETURN VALUE
+ *        Bytes used of mem, 0 if it doesn't fit.
+ */
+static size_t NFC_NdefEncode(uint8_t *mem) {
+  const size_t type_len = sizeof ndef_type - 1;
+  const size_t head = 4 + 2 + 3 + type_len;
+  const size_t payload = PBEncodeMsg_DeviceSensors(mem + head, NFC_NDEF_SIZE - head - 1, false);
+  size_t n = 0;
+
+  if(head + payload + 1 > NFC_NDEF_SIZE)
+    return 0;
+
+  /* CC: NDEF magic, v1.0 read always write never, 512 B, no features */
+  mem[n++] = 0xe1;
+  mem[n++] = 0x43;
+  mem[n++] = 512 / 8;
+  mem[n++] = 0x00;
+
+  /* NDEF message TLV, record of MB ME SR and TNF media-type */
+  mem[n++] = 0x03;
+  mem[n++] = 3 + type_len + payload;
+  mem[n++] = 0xd2;
+  mem[n++] = type_len;
+  mem[n++] = payload;
+  memcpy(mem + n, ndef_type, type_len);
+  n += type_len + payload;
+
+  /* Terminator TLV */
+  mem[n++] = 0xfe;
+  return n;
+}
+
+/* NAME
+ *        NFC_NdefRequest - Have the main loop refresh the NDEF record, ISR safe
+ */
+void NFC_NdefRequest(void) {
+  ndef.requested = true;
+}
+
+/* NAME
+ *        NFC_NdefProcess - Refresh the NDEF record in ST25DV user memory
+ *
+ * DESCRIPTION
+ *        Phones read the record passively, the way they read any NFC tag,
+ *        without the mailbox and without waking the MCU.
+ *
+ *        ST25DV EEPROM is programmed in 4 byte blocks, ~5 ms and a write
+ *        cycle of wear each. So the new layout is compared block by block to
+ *        what's known to be on the tag, and only runs of changed blocks are
+ *        written. The tag is read once after boot, to carry that over reboots.
+ *
+ * BUGS
+ *        A phone reading during the update may get a mix of old and new
+ *        values. Either one is a valid record, unless payload size changed.
+ */
+void NFC_NdefProcess(void) {
+  uint8_t mem[NFC_NDEF_SIZE];
+  size_t n, written = 0;
+
+  if(!ndef.requested)
+    return;
+  ndef.requested = false;
+
+  if(!ndef.valid && NFC_ReadReg(ST25DV_ADDR_DATA_I2C, 0, ndef.mem, sizeof ndef.mem))
+    return;
+  ndef.valid = true;
+
+  memcpy(mem, ndef.mem, sizeof mem);
+  if(!(n = NFC_NdefEncode(mem))) {
+    DEBUG_MSG("NFC NDEF ERR record doesn't fit\n");
+    return;
+  }
+
+  for(size_t i = 0; i < n; i += 4) {
+    size_t j = i;
+    while(j < n && memcmp(mem + j, ndef.mem + j, 4))
+      j += 4;
+    if(j == i)
+      continue;
+    if(St25Dv_Drv.WriteData(&St25Dv_Obj, mem + i, i, j - i)) {
+      ndef.valid = false;
+      DEBUG_PRINTF("NFC NDEF ERR write of %u B at %u\n", (unsigned)(j - i), (unsigned)i);
+      return;
+    }
+    memcpy(ndef.mem + i, mem + i, j - i);
+    written += j - i;
+    i = j;
+  }
+  DEBUG_PRINTF("NFC NDEF %u B, %u B written\n", (unsigned)n, (unsigned)written);
+}
+#endif
@@ -6,6 +6,8 @@
 #include "protobuf.h"
 #include "lrw.h"       /* lrw_GetIsOtaDevice */
 #include "eeprom.h"    /* BackUpFlash */
+#include "history.h"   /* History_Get */
+#include "nfc.h"       /* nfc_throughput */
 #include "main.h"
 #include "mac/LoRaMac.h"
 #include "mac/region/Region.h"  //
@@ -53,7 +55,7 @@ static void PrintBuffer(const char* pre, const uint8_t buf[], uint16_t len, cons
  *        0 1 2 3 --el-boolor--> 3210 --proto--> 0 1 2 3
  *        0 1 2 3 --be-boolor--> 3210 --proto--> 0 1 2 3
  */
-uint64_t u64(uint8_t b[static 8]) {
+uint64_t u64(const uint8_t b[static 8]) {
   return
       (uint64_t)b[7] << 56 | (uint64_t)b[6] << 48 |
       (uint64_t)b[5] << 40 | (uint64_t)b[4] << 32 |
@@ -290,12 +292,15 @@ int64_t PBDecodeSInt(uint64_t val) {
  *              82 80 40             05  aa bb cc dd ee
  *        bytes 131072 = {0xaa, 0xbb, 0xcc, 0xdd, 0xee}
  */
-void PBDecodeMsg(const uint8_t *msg, uint8_t len) {
+void PBDecodeMsg(const uint8_t *msg, size_t len) {
   MibRequestConfirm_t mibReq;
-  uint8_t pos = 0;
+  size_t pos = 0;
   const char *debug_msg = NULL;
-  uint8_t debug_fieldpos = 0;
+  size_t debug_fieldpos = 0;
   bool use_bma400 = false, use_hdc2080 = false, use_sfh7776 = false;
+#ifdef STX
+  uint8_t hdc2080_windows = 0;
+#endif
 
   /* 1st byte always zero, to allow future (unlikely) breaking changes */
   if(len < 1 || msg[0]) {
@@ -382,7 +387,7 @@ void PBDecodeMsg(const uint8_t *msg, uint8_t len) {
       pos += val_rawbytes;
 
       /* Prevent bytes spill */
-      val_rawbytes = val_int > 250 || val_int > (uint8_t)(len - pos)
+      val_rawbytes = val_int > 250 || val_int > len - pos
         ? 0 : val_int;
 
       break;
@@ -525,37 +530,51 @@ void PBDecodeMsg(const uint8_t *msg, uint8_t len) {
       DBG_PRINTF("NFC <RX sensor_send_strategy 0x%02x\n", val_int);
       DEVCFG_SET(DevCfg.sendStrategy, val_int) && (DevCfg.changed.resched = true);
 
+#ifdef HISTORY
+    /* rw-- 36: uint32_t  Sampling interval of on-device history */
+    } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_HISTORY_INTERVAL) {
+      DBG_PRINTF("NFC <RX sensor_history_interval 0x%02x\n", val_int);
+      if(val_int && val_int < HISTORY_MIN_INTERVAL)
+        val_int = HISTORY_MIN_INTERVAL;
+      DEVCFG_SET(DevCfg.history_interval, val_int) && (DevCfg.changed.history = true);
+#endif
+
 #if defined(STX)
     /* rw-- 24:  uint8_t  Send LoRa Message on humidity upper threshold */
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_HUMIDITY_UPPER_THRESHOLD) {
       DBG_PRINTF("NFC <RX sensor_humidity_upper_threshold 0x%02x\n", val_int);
-      DEVCFG_SET(DevCfg.hdc2080_threshold, val_int) && (DevCfg.changed.hdc2080 = true);
-      DEVCFG_SET(DevCfg.hdc2080_mode, HDC2080_HUMIDITY_HIGH) && (DevCfg.changed.hdc2080 = true);
+      DEVCFG_SET(DevCfg.hdc2080_threshold[HDC2080_HUMIDITY_HIGH], (int32_t)val_int) && (DevCfg.changed.hdc2080 = true);
+      hdc2080_windows |= HDC2080_WINDOW(HDC2080_HUMIDITY_HIGH);
       use_hdc2080 = true;
 
     /* rw-- 25:  uint8_t  Send LoRa Message on humidity lower threshold */
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_HUMIDITY_LOWER_THRESHOLD) {
       DBG_PRINTF("NFC <RX sensor_humidity_lower_threshold 0x%02x\n", val_int);
-      DEVCFG_SET(DevCfg.hdc2080_threshold, val_int) && (DevCfg.changed.hdc2080 = true);
-      DEVCFG_SET(DevCfg.hdc2080_mode, HDC2080_HUMIDITY_LOW) && (DevCfg.changed.hdc2080 = true);
+      DEVCFG_SET(DevCfg.hdc2080_threshold[HDC2080_HUMIDITY_LOW], (int32_t)val_int) && (DevCfg.changed.hdc2080 = true);
+      hdc2080_windows |= HDC2080_WINDOW(HDC2080_HUMIDITY_LOW);
       use_hdc2080 = true;
 
     /* rw-- 26:  int16_t  Send LoRa Message on temperature upper threshold */
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_TEMPERATURE_UPPER_THRESHOLD) {
       DBG_PRINTF("NFC <RX sensor_temperature_upper_threshold 0x%02x\n", val_int);
-      uint64_t v = PBDecodeSInt(val_int);
-      DEVCFG_SET(DevCfg.hdc2080_threshold, v) && (DevCfg.changed.hdc2080 = true);
-      DEVCFG_SET(DevCfg.hdc2080_mode, HDC2080_TEMPERATURE_HIGH) && (DevCfg.changed.hdc2080 = true);
+      int32_t v = PBDecodeSInt(val_int);
+      DEVCFG_SET(DevCfg.hdc2080_threshold[HDC2080_TEMPERATURE_HIGH], v) && (DevCfg.changed.hdc2080 = true);
+      hdc2080_windows |= HDC2080_WINDOW(HDC2080_TEMPERATURE_HIGH);
       use_hdc2080 = true;
 
     /* rw-- 27:  int16_t  Send LoRa Message on temperature lower threshold */
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_TEMPERATURE_LOWER_THRESHOLD) {
       DBG_PRINTF("NFC <RX sensor_temperature_lowe_thresholdr 0x%02x\n", val_int);
-      uint64_t v = PBDecodeSInt(val_int);
-      DEVCFG_SET(DevCfg.hdc2080_threshold, v) && (DevCfg.changed.hdc2080 = true);
-      DEVCFG_SET(DevCfg.hdc2080_mode, HDC2080_TEMPERATURE_LOW) && (DevCfg.changed.hdc2080 = true);
+      int32_t v = PBDecodeSInt(val_int);
+      DEVCFG_SET(DevCfg.hdc2080_threshold[HDC2080_TEMPERATURE_LOW], v) && (DevCfg.changed.hdc2080 = true);
+      hdc2080_windows |= HDC2080_WINDOW(HDC2080_TEMPERATURE_LOW);
       use_hdc2080 = true;
 
+    /* rw-- 35: uint32_t  Event rate limit and luminance hysteresis */
+    } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_EVENT_LIMIT) {
+      DBG_PRINTF("NFC <RX sensor_event_limit 0x%02x\n", val_int);
+      DEVCFG_SET(DevCfg.event_limit, val_int) && (DevCfg.changed.sfh7776 = true);
+
     /* rw-- 28: uint16_t  Send LoRa Message on luminance upper threshold */
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_LUMINANCE_UPPER_THRESHOLD) {
       DBG_PRINTF("NFC <RX sensor_luminance_upper_threshold 0x%02x\n", val_int);
@@ -568,6 +587,14 @@ void PBDecodeMsg(const uint8_t *msg, uint8_t len) {
       DEVCFG_SET(DevCfg.sfh7776_threshold_lower, val_int) && (DevCfg.changed.sfh7776 = true);
       use_sfh7776 = true;
 
+    /* rw-- 33: char[36]  Luminance calibration of housing or cover */
+    } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_LUMINANCE_CALIBRATION && val_rawbytes && val_rawbytes <= sizeof DevCfg.sfh7776_cal && val_rawbytes % sizeof *DevCfg.sfh7776_cal == 0) {
+      struct SFH7776_Band cal[SFH7776_BANDS] = {0};
+      PrintBuffer("NFC <RX sensor_luminance_calibration ", msg + pos, val_rawbytes, "\n");
+      memcpy(cal, msg + pos, val_rawbytes);
+      DEVCFG_MEMCPY(DevCfg.sfh7776_cal, cal, sizeof cal) && (DevCfg.changed.sfh7776 = true);
+      use_sfh7776 = true;
+
     /* rw-- 30: uint32_t  Send LoRa Message on axis acceleration above threshold */
     } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_AXIS_THRESHOLD) {
       DBG_PRINTF("NFC <RX sensor_axis_threshold 0x%02x\n", val_int);
@@ -580,6 +607,18 @@ void PBDecodeMsg(const uint8_t *msg, uint8_t len) {
       DEVCFG_SET(DevCfg.bma400_config, val_int) && (DevCfg.changed.bma400 = true);
       use_bma400 = true;
 
+    /* rw-- 32: uint32_t  Send LoRa Message on orientation, activity and steps */
+    } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_AXIS_EVENTS) {
+      DBG_PRINTF("NFC <RX sensor_axis_events 0x%02x\n", val_int);
+      DEVCFG_SET(DevCfg.bma400_events, val_int) && (DevCfg.changed.bma400 = true);
+      use_bma400 = true;
+
+    /* rw-- 34: uint32_t  Climate measurement rate and window hysteresis */
+    } else if((tagnr << 3 | tagtype) == PBMSG_BX_SENSOR_CLIMATE_CONFIGURE) {
+      DBG_PRINTF("NFC <RX sensor_climate_configure 0x%02x\n", val_int);
+      DEVCFG_SET(DevCfg.hdc2080_config, val_int) && (DevCfg.changed.hdc2080 = true);
+      use_hdc2080 = true;
+
 #endif
 
     /* Undefined key-value field, Skip. */
@@ -597,6 +636,8 @@ abort:
   DEVCFG_SET(DevCfg.useSensor.bma400,  use_bma400)  && (DevCfg.changed.bma400  = true);
   DEVCFG_SET(DevCfg.useSensor.sfh7776, use_sfh7776) && (DevCfg.changed.sfh7776 = true);
   DEVCFG_SET(DevCfg.useSensor.hdc2080, use_hdc2080) && (DevCfg.changed.hdc2080 = true);
+  if(use_hdc2080)
+    DEVCFG_SET(DevCfg.hdc2080_windows, hdc2080_windows) && (DevCfg.changed.hdc2080 = true);
 #endif
 
   if(debug_msg) {
@@ -605,11 +646,38 @@ abort:
   return;
 }
 
+#if defined(STX) || defined(STE)
+/* NAME
+ *        PBEncodeMsg_SensorChannel - Encode a sensor registry channel
+ *
+ * DESCRIPTION
+ *        Floats are sent as their IEEE 754 bits, be it a fixed32 or varint field.
+ */
+static size_t PBEncodeMsg_SensorChannel(uint8_t *msg, size_t len, size_t pos, const struct SensorChannel *ch) {
+  uint64_t val = 0;
+  uint32_t f;
+
+  switch(ch->format) {
+  case SENSOR_FMT_U8:    val = *(const uint8_t *)ch->value;                break;
+  case SENSOR_FMT_U16:   val = *(const uint16_t *)ch->value;               break;
+  case SENSOR_FMT_U32:   val = *(const uint32_t *)ch->value;               break;
+  case SENSOR_FMT_S16:   val = PBEncodeSInt(*(const int16_t *)ch->value);  break;
+  case SENSOR_FMT_S32:   val = PBEncodeSInt(*(const int32_t *)ch->value);  break;
+  case SENSOR_FMT_FLOAT: memcpy(&f, ch->value, sizeof f), val = f;         break;
+  default: break;;
+  }
+
+  if((ch->pbkey & 0x7) == PB_TAGTYPE_FIXED32)
+    return PBEncodeMsgField(msg, len, pos, ch->pbkey, (uint32_t)val);
+  return PBEncodeMsgField(msg, len, pos, ch->pbkey, val);
+}
+#endif
+
 size_t PBEncodeMsg_DeviceSensors(uint8_t *msg, size_t len, bool pw_valid) {
   size_t size = 0;
-  uint32_t b;
   (void)pw_valid;
-  float voltage, temperature;
+  uint16_t millivolts;
+  int16_t centicelsius;
 
   /* discriminator byte specifies message DeviceSensors */
   if(size++ < len)
@@ -627,59 +695,20 @@ size_t PBEncodeMsg_DeviceSensors(uint8_t *msg, size_t len, bool pw_valid) {
   );
 
   /*  uint8_t: Device Battery Voltage */
-  getBatteryVoltageAndTemperature(&voltage, &temperature);
-  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_DEVICE_BATTERY_VOLTAGE, (uint64_t)(voltage * 100));
-
-#ifdef STE
-#ifndef BSEC
-  BME680_Read();
-#endif
-  /*  int16_t: Temperature */
-  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_TEMPERATURE, PBEncodeSInt(bme680.data.temperature));
-
-  /* uint32_t: Humidity */
-  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_HUMIDITY, (uint64_t)bme680.data.humidity);
-
-  /* uint16_t: Pressure */
-  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_PRESSURE, (uint64_t)bme680.data.pressure);
-
-#ifdef BSEC
-  /*    float: Air Quality Index */
-  memcpy(b, &bme680.bsec.iaq, sizeof b), size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_AIR_QUALITY, (uint32_t)b);
-
-  /*    float: VOC Equivalent */
-  memcpy(b, &bme680.bsec.voc, sizeof b), size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_AIR_VOC_PPM, (uint32_t)b);
-
-  /*    float: CO2 Equivalent */
-  memcpy(b, &bme680.bsec.co2, sizeof b), size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_AIR_CO2_PPM, (uint32_t)b);
-
-  /*  uint8_t: Air Accuracy */
-  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_AIR_ACCURACY, (uint64_t)bme680.bsec.acc);
-
-#endif
-#elif defined(STX)
-  HDC2080_Read();
-  SFH7776_Read();
-  BMA400_Read();
-  /*  int16_t: Temperature */
-  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_TEMPERATURE, PBEncodeSInt(hdc2080.fix_temp));
-
-  /* uint32_t: Humidity */
-  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_HUMIDITY, (uint64_t)hdc2080.raw_humid * 100000 / 65536);
-
-  /* uint16_t: Luminance */
-  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_LUMINANCE, (uint64_t)sfh7776.lux);
-
-  /*  int16_t: X-Axis Acceleration */
-  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_X_AXIS, PBEncodeSInt(bma400.fix_x));
-
-  /*  int16_t: Y-Axis Acceleration */
-  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_Y_AXIS, PBEncodeSInt(bma400.fix_y));
-
-  /*  int16_t: Z-Axis Acceleration */
-  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_Z_AXIS, PBEncodeSInt(bma400.fix_z));
+  getBatteryVoltageAndTemperature(&millivolts, &centicelsius);
+  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_DEVICE_BATTERY_VOLTAGE, (uint64_t)(millivolts / 10));
+
+  /* uint32_t: NFC Throughput of last chained transfer, none yet is implicit */
+  if(nfc_throughput)
+    size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_DEVICE_NFC_THROUGHPUT, (uint64_t)nfc_throughput);
+
+#if defined(STX) || defined(STE)
+  Sensors_Update();
+  for(unsigned i = 0; sensors[i]; i++)
+    for(unsigned j = 0; j < sensors[i]->channels_n && I2C_Present(sensors[i]->addr); j++)
+      size += PBEncodeMsg_SensorChannel(msg, len, size, &sensors[i]->channels[j]);
 #elif defined(STA)
-  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_TEMPERATURE, PBEncodeSInt(temperature * 100));
+  size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_TEMPERATURE, PBEncodeSInt(centicelsius));
   /*  uint8_t: Gesture Count */
   size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_GESTURE_SINGLE_COUNT, (uint64_t)DevCfg.singleCount);
   size += PBEncodeMsgField(msg, len, size, PBSMSG_TX_SENSOR_GESTURE_DOUBLE_COUNT, (uint64_t)DevCfg.doubleCount);
@@ -689,7 +718,99 @@ size_t PBEncodeMsg_DeviceSensors(uint8_t *msg, size_t len, bool pw_valid) {
   return size;
 }
 
-size_t PBEncodeMsg_DeviceConfiguration(uint8_t *msg, size_t len, bool pw_valid) {
+#ifdef HISTORY
+/* NAME
+ *        PBEncodeMsg_Window - Copy the n bytes of a message at pos, as far as
+ *        they fall into the window at offset, len long, stored in msg
+ */
+static void PBEncodeMsg_Window(uint8_t *msg, size_t len, size_t offset, size_t pos, const uint8_t *buf, size_t n) {
+  const size_t skip = offset > pos ? offset - pos : 0;
+  const size_t at = pos > offset ? pos - offset : 0;
+
+  if(skip >= n || at >= len)
+    return;
+  n -= skip;
+  memcpy(msg + at, buf + skip, n < len - at ? n : len - at);
+}
+
+/* NAME
+ *        PBEncodeMsg_HistoryRollup - Encode a DeviceHistory.Rollup
+ */
+static size_t PBEncodeMsg_HistoryRollup(uint8_t *msg, size_t len, uint32_t now, enum HistoryLevel level, const struct HistoryBucket *b, bool partial) {
+  const uint16_t boots_ago = History_Boot() - b->boot;
+  uint8_t stat[24];
+  size_t size = 0;
+
+  size += PBEncodeMsgField(msg, len, size, PBHMSG_TX_ROLLUP_RESOLUTION, PBENUM_RESOLUTION_QUARTER_HOUR + level);
+  if(boots_ago)
+    size += PBEncodeMsgField(msg, len, size, PBHMSG_TX_ROLLUP_BOOTS_AGO, (uint64_t)boots_ago);
+  else
+    size += PBEncodeMsgField(msg, len, size, PBHMSG_TX_ROLLUP_AGE, (uint64_t)(now - b->end));
+  size += PBEncodeMsgField(msg, len, size, PBHMSG_TX_ROLLUP_SAMPLES, (uint64_t)b->count);
+  if(partial)
+    size += PBEncodeMsgField(msg, len, size, PBHMSG_TX_ROLLUP_PARTIAL, (uint64_t)true);
+
+  for(unsigned i = 0; i < HISTORY_CHANNELS; i++) {
+    size_t n = 0;
+    n += PBEncodeMsgField(stat, sizeof stat, n, PBHMSG_TX_STAT_SENSOR, (uint64_t)(History_Key(i) >> 3));
+    n += PBEncodeMsgField(stat, sizeof stat, n, PBHMSG_TX_STAT_MIN, PBEncodeSInt(b->stat[i].min));
+    n += PBEncodeMsgField(stat, sizeof stat, n, PBHMSG_TX_STAT_MAX, PBEncodeSInt(b->stat[i].max));
+    n += PBEncodeMsgField(stat, sizeof stat, n, PBHMSG_TX_STAT_MEAN, PBEncodeSInt(b->stat[i].sum / b->count));
+    assert(n <= sizeof stat);
+    size += PBEncodeMsgField(msg, len, size, PBHMSG_TX_ROLLUP_STAT, n, stat);
+  }
+  return size;
+}
+
+/* NAME
+ *        PBEncodeMsg_DeviceHistory - Encode a window of message DeviceHistory
+ *
+ * DESCRIPTION
+ *        The message outgrows any buffer we can spare, so it's encoded one
+ *        rollup at a time, keeping just the part from offset on, len long.
+ *        Called once per mailbox chunk, with History_Hold keeping it the same
+ *        message. Uptime and ages are relative to now, which must be the
+ *        same for every chunk too.
+ *
+ * RETURN VALUE
+ *        Size of the whole message.
+ */
+size_t PBEncodeMsg_DeviceHistory(uint8_t *msg, size_t len, size_t offset, uint32_t now) {
+  uint8_t rec[112], rollup[96];
+  size_t size = 0, n = 0;
+  bool partial;
+
+  /* discriminator byte specifies message DeviceHistory */
+  rec[n++] = PBMSGID_DEVICE_HISTORY;
+  n += PBEncodeMsgField(rec, sizeof rec, n, PBHMSG_TX_HISTORY_INTERVAL, (uint64_t)DevCfg.history_interval);
+  n += PBEncodeMsgField(rec, sizeof rec, n, PBHMSG_TX_HISTORY_UPTIME, (uint64_t)now);
+  PBEncodeMsg_Window(msg, len, offset, size, rec, n);
+  size += n;
+
+  for(unsigned level = HISTORY_QUARTER; level < HISTORY_LEVELS; level++)
+    for(unsigned i = 0; i < History_Count(level); i++) {
+      const struct HistoryBucket *b = History_Get(level, i, &partial);
+      const size_t r = PBEncodeMsg_HistoryRollup(rollup, sizeof rollup, now, level, b, partial);
+
+      assert(r <= sizeof rollup);
+      n = PBEncodeMsgField(rec, sizeof rec, 0, PBHMSG_TX_HISTORY_ROLLUP, r, rollup);
+      assert(n <= sizeof rec);
+      PBEncodeMsg_Window(msg, len, offset, size, rec, n);
+      size += n;
+    }
+
+  return size;
+}
+#endif
+
+/* NAME
+ *        PBEncodeMsg_Configuration - Encode message DeviceConfiguration afresh
+ *
+ * DESCRIPTION
+ *        Queries LoRaMac MIB and secure element key list, see
+ *        PBEncodeMsg_DeviceConfiguration for the memoized one.
+ */
+static size_t PBEncodeMsg_Configuration(uint8_t *msg, size_t len, bool pw_valid) {
   size_t size = 0;
 
   /* discriminator byte specifies message DeviceConfiguration */
@@ -820,34 +941,44 @@ size_t PBEncodeMsg_DeviceConfiguration(uint8_t *msg, size_t len, bool pw_valid)
     /*     bool: Send Strategy */
     size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_SEND_STRATEGY, (uint64_t)DevCfg.sendStrategy);
 
+#ifdef HISTORY
+    /* uint32_t: Sampling interval of on-device history */
+    size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_HISTORY_INTERVAL, (uint64_t)DevCfg.history_interval);
+#endif
+
 #if defined(STE)
     // STE has no configuration
 #elif defined(STX)
-    if(DevCfg.useSensor.hdc2080) switch(DevCfg.hdc2080_mode) {
-    case HDC2080_TEMPERATURE_HIGH:
-      /*  int32_t: Send LoRa Message on temperature upper threshold */
-      size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_TEMPERATURE_UPPER_THRESHOLD, PBEncodeSInt(DevCfg.hdc2080_threshold));
-      break;
-    case HDC2080_TEMPERATURE_LOW:
-      /*  int32_t: Send LoRa Message on temperature lower threshold */
-      size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_TEMPERATURE_LOWER_THRESHOLD, PBEncodeSInt(DevCfg.hdc2080_threshold));
-      break;
-    case HDC2080_HUMIDITY_HIGH:
-      /*  int32_t: Send LoRa Message on temperature upper threshold */
-      size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_HUMIDITY_UPPER_THRESHOLD, DevCfg.hdc2080_threshold);
-      break;
-    case HDC2080_HUMIDITY_LOW:
-      /*  int32_t: Send LoRa Message on temperature upper threshold */
-      size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_HUMIDITY_LOWER_THRESHOLD, DevCfg.hdc2080_threshold);
-      break;
+    if(DevCfg.useSensor.hdc2080) {
+      if(DevCfg.hdc2080_windows & HDC2080_WINDOW(HDC2080_TEMPERATURE_HIGH))
+        /*  int32_t: Send LoRa Message on temperature upper threshold */
+        size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_TEMPERATURE_UPPER_THRESHOLD, PBEncodeSInt(DevCfg.hdc2080_threshold[HDC2080_TEMPERATURE_HIGH]));
+      if(DevCfg.hdc2080_windows & HDC2080_WINDOW(HDC2080_TEMPERATURE_LOW))
+        /*  int32_t: Send LoRa Message on temperature lower threshold */
+        size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_TEMPERATURE_LOWER_THRESHOLD, PBEncodeSInt(DevCfg.hdc2080_threshold[HDC2080_TEMPERATURE_LOW]));
+      if(DevCfg.hdc2080_windows & HDC2080_WINDOW(HDC2080_HUMIDITY_HIGH))
+        /*  uint8_t: Send LoRa Message on humidity upper threshold */
+        size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_HUMIDITY_UPPER_THRESHOLD, (uint64_t)DevCfg.hdc2080_threshold[HDC2080_HUMIDITY_HIGH]);
+      if(DevCfg.hdc2080_windows & HDC2080_WINDOW(HDC2080_HUMIDITY_LOW))
+        /*  uint8_t: Send LoRa Message on humidity lower threshold */
+        size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_HUMIDITY_LOWER_THRESHOLD, (uint64_t)DevCfg.hdc2080_threshold[HDC2080_HUMIDITY_LOW]);
+
+      /* uint32_t: Climate measurement rate and window hysteresis */
+      size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_CLIMATE_CONFIGURE, (uint64_t)DevCfg.hdc2080_config);
     }
 
+    /* uint32_t: Event rate limit and luminance hysteresis */
+    size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_EVENT_LIMIT, (uint64_t)DevCfg.event_limit);
+
     if(DevCfg.useSensor.sfh7776) {
       /*  int32_t: Send LoRa Message on luminance upper threshold */
       size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_LUMINANCE_UPPER_THRESHOLD, (uint64_t)DevCfg.sfh7776_threshold_upper);
 
       /*  int32_t: Send LoRa Message on luminance lower threshold */
       size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_LUMINANCE_LOWER_THRESHOLD, (uint64_t)DevCfg.sfh7776_threshold_lower);
+
+      /* char[36]: Luminance calibration of housing or cover */
+      size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_LUMINANCE_CALIBRATION, SFH7776_CalibrationSize(DevCfg.sfh7776_cal), (const uint8_t *)DevCfg.sfh7776_cal);
     }
 
     if(DevCfg.useSensor.bma400) {
@@ -856,6 +987,9 @@ size_t PBEncodeMsg_DeviceConfiguration(uint8_t *msg, size_t len, bool pw_valid)
 
       /*  int32_t: Send LoRa Message on axis acceleration configure */
       size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_AXIS_CONFIGURE, (uint64_t)DevCfg.bma400_config);
+
+      /* uint32_t: Send LoRa Message on orientation, activity and steps */
+      size += PBEncodeMsgField(msg, len, size, PBMSG_BX_SENSOR_AXIS_EVENTS, (uint64_t)DevCfg.bma400_events);
     }
 
 #endif
@@ -864,6 +998,60 @@ size_t PBEncodeMsg_DeviceConfiguration(uint8_t *msg, size_t len, bool pw_valid)
   return size;
 }
 
+/* Public view is the discriminator, part number and firmware version, any
+ * varint value fits in 10 bytes */
+#define PB_VARINT_MAXSIZE  10
+static_assert(PBMSG_TX_DEVICE_PART_NUMBER < 0x80 && PBMSG_TX_DEVICE_FW_VERSION < 0x80, "configPublic assumes single byte keys.");
+
+/* Encoded DeviceConfiguration, of either view, size 0 if stale */
+static uint8_t configPublic[1 + 2 * (1 + PB_VARINT_MAXSIZE)], configPrivileged[256 - 5];
+static struct {
+  uint8_t *msg;
+  size_t len;
+  volatile size_t size;
+} configCache[2] = {
+  {configPublic, sizeof configPublic, 0},
+  {configPrivileged, sizeof configPrivileged, 0},
+};
+
+/* NAME
+ *        PBEncodeMsg_DeviceConfiguration - Encode message DeviceConfiguration
+ *
+ * DESCRIPTION
+ *        Phone apps poll the configuration, so each view (pw_valid) is
+ *        encoded once and copied out thereafter, until PBInvalidate_DeviceConfiguration.
+ *
+ *        While DevCfg.changed is pending, the main loop is yet to apply it
+ *        to LoRaMac, thus the message is encoded afresh and not memoized.
+ */
+size_t PBEncodeMsg_DeviceConfiguration(uint8_t *msg, size_t len, bool pw_valid) {
+  size_t size = configCache[pw_valid].size;
+
+  if(DevCfg.changed.any)
+    return PBEncodeMsg_Configuration(msg, len, pw_valid);
+
+  if(!size) {
+    size = PBEncodeMsg_Configuration(configCache[pw_valid].msg, configCache[pw_valid].len, pw_valid);
+    if(size > configCache[pw_valid].len)
+      return PBEncodeMsg_Configuration(msg, len, pw_valid);
+    configCache[pw_valid].size = size;
+  }
+
+  memcpy(msg, configCache[pw_valid].msg, size < len ? size : len);
+  return size;
+}
+
+/* NAME
+ *        PBInvalidate_DeviceConfiguration - Drop memoized DeviceConfiguration
+ *
+ * DESCRIPTION
+ *        Invoke once DevCfg changes are applied, and on LoRaMac NVM changes.
+ */
+void PBInvalidate_DeviceConfiguration(void) {
+  configCache[0].size = 0;
+  configCache[1].size = 0;
+}
+
 #if UNITTEST
 static void Usage_PBEncodeSInt(void) {
 	assert(0x0000000000000000 == PBEncodeSInt(0));
@@ -0,0 +1,364 @@
+//bin/true; export WFLAGS="-Wall -Wextra -Wpedantic -Wformat=2 -Wwrite-strings -Wswitch-default -Wold-style-definition -Wstrict-prototypes -Wc++-compat -Wcast-align=strict -Wcast-qual"
+//usr/bin/env gcc -DUNITTEST -ggdb3 $WFLAGS -O2 -fsanitize=address,undefined -std=iso9899:2018 -I"${0%/*}/../Inc" -o "${o=`mktemp`}" "$0" && exec setarch -R -- sh -c 'set -x; exec -a "$0" "$@"' "$0" "$o" "$@";
+//bin/true; exit 1
+
+/* Includes ------------------------------------------------------------------*/
+#include "regshadow.h"
+#include <string.h>
+
+/* Hosted environment only */
+#ifdef UNITTEST
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define I2C_MEMADD_SIZE_8BIT  1
+static int32_t I2C_MemRead(uint16_t dev, uint16_t reg, uint16_t reg_size, uint8_t *buf, uint16_t len, uint32_t timeout);
+static int32_t I2C_MemWrite(uint16_t dev, uint16_t reg, uint16_t reg_size, const uint8_t *buf, uint16_t len, uint32_t timeout);
+#else
+#include "i2c_xfer.h"
+#endif
+
+/* Private define ------------------------------------------------------------*/
+#define REGSHADOW_TIMEOUT  100
+
+/* Private functions ---------------------------------------------------------*/
+static inline bool RegShadow_Bit(const uint8_t *map, unsigned i) {
+  return map[i / 8] >> i % 8 & 1;
+}
+
+static inline void RegShadow_SetBit(uint8_t *map, unsigned i) {
+  map[i / 8] |= 1 << i % 8;
+}
+
+static inline void RegShadow_ClrBit(uint8_t *map, unsigned i) {
+  map[i / 8] &= ~(1 << i % 8);
+}
+
+static inline bool RegShadow_Cacheable(const struct RegShadow *s, unsigned i) {
+  return !s->nocache || !RegShadow_Bit(s->nocache, i);
+}
+
+/* NAME
+ *        RegShadow_Invalidate - Forget all known register values
+ *
+ * DESCRIPTION
+ *        Call after the device was reset, powered down, or otherwise
+ *        reconfigured behind the shadow's back. Staged values are dropped.
+ */
+void RegShadow_Invalidate(struct RegShadow *s) {
+  memset(s->valid, 0, REGSHADOW_BITMAP(s->first, s->last));
+  memset(s->dirty, 0, REGSHADOW_BITMAP(s->first, s->last));
+}
+
+/* NAME
+ *        RegShadow_Known - Whether any register value is known
+ *
+ * DESCRIPTION
+ *        False on boot, and after RegShadow_Invalidate or a failed transfer.
+ *        Drivers use it to tell a first configuration (reset the device)
+ *        from a reconfiguration (only write what changed).
+ */
+bool RegShadow_Known(const struct RegShadow *s) {
+  for(unsigned i = 0; i < (unsigned)REGSHADOW_BITMAP(s->first, s->last); i++)
+    if(s->valid[i])
+      return true;
+  return false;
+}
+
+/* NAME
+ *        RegShadow_Set - Stage register values for RegShadow_Flush
+ *
+ * DESCRIPTION
+ *        Registers whose known value already equals buf are left clean.
+ *        Registers outside [first, last] are ignored, use RegShadow_Write.
+ */
+void RegShadow_Set(struct RegShadow *s, uint8_t reg, const uint8_t *buf, uint16_t len) {
+  for(unsigned k = 0; k < len; k++) {
+    const unsigned r = reg + k;
+    if(r < s->first || r > s->last)
+      continue;
+
+    const unsigned i = r - s->first;
+    if(!RegShadow_Bit(s->dirty, i) && RegShadow_Bit(s->valid, i) && RegShadow_Cacheable(s, i) && s->val[i] == buf[k]) {
+      s->skipped++;
+      continue;
+    }
+    s->val[i] = buf[k];
+    RegShadow_SetBit(s->dirty, i);
+  }
+}
+
+/* NAME
+ *        RegShadow_Flush - Write staged registers to device
+ *
+ * DESCRIPTION
+ *        Staged registers go out in as few burst writes as possible. A burst
+ *        spans clean registers between staged ones when their value is known,
+ *        rewriting it, rather than splitting into two transactions.
+ *
+ * NOTES
+ *        Only for devices with auto-incrementing register addresses.
+ *
+ * RETURN VALUE
+ *        Zero on success. Otherwise the HAL error, and the shadow is
+ *        invalidated, as the device state is unknown.
+ */
+int32_t RegShadow_Flush(struct RegShadow *s) {
+  const unsigned n = s->last - s->first + 1;
+  unsigned i, j, end;
+  int32_t r;
+
+  for(i = 0; i < n; i = end + 1) {
+    end = i;
+    if(!RegShadow_Bit(s->dirty, i))
+      continue;
+
+    for(j = i; j < n && (RegShadow_Bit(s->dirty, j) || (RegShadow_Bit(s->valid, j) && RegShadow_Cacheable(s, j))); j++)
+      if(RegShadow_Bit(s->dirty, j))
+        end = j;
+
+    if((r = I2C_MemWrite(s->dev, s->first + i, I2C_MEMADD_SIZE_8BIT, s->val + i, end - i + 1, REGSHADOW_TIMEOUT))) {
+      RegShadow_Invalidate(s);
+      return r;
+    }
+    s->writes++;
+
+    for(j = i; j <= end; j++) {
+      RegShadow_ClrBit(s->dirty, j);
+      if(RegShadow_Cacheable(s, j))
+        RegShadow_SetBit(s->valid, j);
+    }
+  }
+  return 0;
+}
+
+/* NAME
+ *        RegShadow_Write - Write registers, skipping those already up to date
+ *
+ * DESCRIPTION
+ *        Stage and flush. Writes reaching outside [first, last] are passed
+ *        through as is, and update the shadow for registers in range.
+ *
+ * RETURN VALUE
+ *        Zero on success, otherwise the HAL error.
+ */
+int32_t RegShadow_Write(struct RegShadow *s, uint8_t reg, const uint8_t *buf, uint16_t len) {
+  int32_t r;
+
+  if(!len)
+    return 0;
+
+  if(reg >= s->first && reg + len - 1u <= s->last) {
+    RegShadow_Set(s, reg, buf, len);
+    return RegShadow_Flush(s);
+  }
+
+  if((r = I2C_MemWrite(s->dev, reg, I2C_MEMADD_SIZE_8BIT, buf, len, REGSHADOW_TIMEOUT))) {
+    RegShadow_Invalidate(s);
+    return r;
+  }
+  s->writes++;
+
+  for(unsigned k = 0; k < len; k++) {
+    const unsigned i = reg + k - s->first;
+    if(reg + k < s->first || reg + k > s->last)
+      continue;
+    s->val[i] = buf[k];
+    RegShadow_ClrBit(s->dirty, i);
+    if(RegShadow_Cacheable(s, i))
+      RegShadow_SetBit(s->valid, i);
+  }
+  return 0;
+}
+
+/* NAME
+ *        RegShadow_Read - Read registers, from shadow when all are known
+ *
+ * DESCRIPTION
+ *        Reads from the device fill in the shadow, except for nocache and
+ *        staged registers (the latter return the device value). A failed
+ *        read forgets the registers it covered, buf may hold partial data.
+ *
+ * RETURN VALUE
+ *        Zero on success, otherwise the HAL error.
+ */
+int32_t RegShadow_Read(struct RegShadow *s, uint8_t reg, uint8_t *buf, uint16_t len) {
+  bool hit = len && reg >= s->first && reg + len - 1u <= s->last;
+  int32_t r;
+
+  for(unsigned k = 0; hit && k < len; k++) {
+    const unsigned i = reg + k - s->first;
+    hit = RegShadow_Bit(s->valid, i) && !RegShadow_Bit(s->dirty, i) && RegShadow_Cacheable(s, i);
+  }
+  if(hit) {
+    memcpy(buf, s->val + (reg - s->first), len);
+    return 0;
+  }
+
+  r = I2C_MemRead(s->dev, reg, I2C_MEMADD_SIZE_8BIT, buf, len, REGSHADOW_TIMEOUT);
+
+  for(unsigned k = 0; k < len; k++) {
+    const unsigned i = reg + k - s->first;
+    if(reg + k < s->first || reg + k > s->last)
+      continue;
+    if(r)
+      RegShadow_ClrBit(s->valid, i);
+    else if(RegShadow_Cacheable(s, i) && !RegShadow_Bit(s->dirty, i)) {
+      s->val[i] = buf[k];
+      RegShadow_SetBit(s->valid, i);
+    }
+  }
+  return r;
+}
+
+#ifdef UNITTEST
+/* Simulated auto-incrementing device, and bus transaction counters */
+static uint8_t Usage_Dev[256];
+static unsigned Usage_Reads, Usage_Writes, Usage_Bytes;
+static bool Usage_Fail;
+
+static int32_t I2C_MemRead(uint16_t dev, uint16_t reg, uint16_t reg_size, uint8_t *buf, uint16_t len, uint32_t timeout) {
+  (void)dev, (void)reg_size, (void)timeout;
+  assert(reg + len <= 256);
+  Usage_Reads++;
+  memcpy(buf, Usage_Dev + reg, len);
+  return Usage_Fail;
+}
+
+static int32_t I2C_MemWrite(uint16_t dev, uint16_t reg, uint16_t reg_size, const uint8_t *buf, uint16_t len, uint32_t timeout) {
+  (void)dev, (void)reg_size, (void)timeout;
+  assert(reg + len <= 256);
+  if(Usage_Fail)
+    return 1;
+  Usage_Writes++;
+  Usage_Bytes += len;
+  memcpy(Usage_Dev + reg, buf, len);
+  return 0;
+}
+
+/*
+ * HDC2080_Init as it was: soft reset, INT_ENABLE, then TEMP_TL..MEASURE in
+ * one burst, against the shadowed flavour which resets only when the shadow
+ * is unknown. Register images must match after every reconfiguration.
+ */
+static void Usage_Reconfigure(void) {
+  static const uint8_t defaults[16] = {0};
+  uint8_t legacy[256], cfg[7];
+  REGSHADOW(shadow, 0x80, 0x07, 0x0f, NULL);
+
+  memcpy(Usage_Dev, defaults, sizeof defaults);
+  for(size_t i = 0; i < sizeof cfg; i++)
+    cfg[i] = rand();
+  for(int n = 0; n < 1000; n++) {
+    for(size_t i = 0; i < sizeof cfg; i++)
+      cfg[i] = rand() % 4 ? cfg[i] : rand();  /* Mostly unchanged, as on NFC reconfig */
+
+    /* Today */
+    memcpy(legacy, Usage_Dev, sizeof legacy);
+    memcpy(legacy, defaults, sizeof defaults);
+    legacy[0x07] = cfg[0];
+    memcpy(legacy + 0x0a, cfg + 1, 6);
+
+    /* Shadowed */
+    unsigned w = Usage_Writes;
+    if(!RegShadow_Known(&shadow))
+      memcpy(Usage_Dev, defaults, sizeof defaults);
+    RegShadow_Set(&shadow, 0x07, cfg, 1);
+    RegShadow_Set(&shadow, 0x0a, cfg + 1, 6);
+    assert(!RegShadow_Flush(&shadow));
+
+    assert(!memcmp(legacy, Usage_Dev, sizeof legacy));
+    assert(Usage_Writes - w <= 2);
+
+    /* Same again is free */
+    w = Usage_Writes;
+    RegShadow_Set(&shadow, 0x07, cfg, 1);
+    RegShadow_Set(&shadow, 0x0a, cfg + 1, 6);
+    assert(!RegShadow_Flush(&shadow));
+    assert(Usage_Writes == w);
+  }
+}
+
+static void Usage_Burst(void) {
+  REGSHADOW(shadow, 0x72, 0x41, 0x52, NULL);
+  uint8_t v[4] = {1, 2, 3, 4};
+
+  memset(Usage_Dev, 0, sizeof Usage_Dev);
+  assert(!RegShadow_Write(&shadow, 0x4f, v, 4));
+  assert(Usage_Dev[0x52] == 4);
+
+  /* Changes at 0x4f and 0x52 bridge over known 0x50..0x51: one transaction */
+  Usage_Writes = Usage_Bytes = 0;
+  v[0] = 5, v[3] = 6;
+  RegShadow_Set(&shadow, 0x4f, v, 4);
+  assert(!RegShadow_Flush(&shadow));
+  assert(Usage_Writes == 1 && Usage_Bytes == 4);
+  assert(!memcmp(Usage_Dev + 0x4f, v, 4));
+
+  /* But not over unknown 0x42..0x4e: two transactions */
+  Usage_Writes = Usage_Bytes = 0;
+  RegShadow_Set(&shadow, 0x41, v, 1);
+  RegShadow_Set(&shadow, 0x52, v, 1);
+  assert(!RegShadow_Flush(&shadow));
+  assert(Usage_Writes == 2 && Usage_Bytes == 2);
+
+  /* Failure forgets everything, so the same value goes out again */
+  Usage_Fail = true;
+  v[0] = 7;
+  assert(RegShadow_Write(&shadow, 0x4f, v, 1));
+  assert(!RegShadow_Known(&shadow));
+  Usage_Fail = false;
+  v[0] = 5;
+  Usage_Writes = 0;
+  assert(!RegShadow_Write(&shadow, 0x4f, v, 1));
+  assert(Usage_Writes == 1);
+}
+
+static void Usage_Cache(void) {
+  static const uint8_t nocache[REGSHADOW_BITMAP(0x19, 0x58)] = {[(0x31 - 0x19) / 8] = 1 << (0x31 - 0x19) % 8};
+  REGSHADOW(shadow, 0x28, 0x19, 0x58, nocache);
+  uint8_t v[5];
+
+  memset(Usage_Dev, 0x55, sizeof Usage_Dev);
+
+  /* First read goes to device, second one doesn't */
+  Usage_Reads = 0;
+  assert(!RegShadow_Read(&shadow, 0x2f, v, 2));
+  assert(!RegShadow_Read(&shadow, 0x2f, v, 2));
+  assert(Usage_Reads == 1);
+
+  /* Hardware-updated register is always read */
+  Usage_Dev[0x31] = 0xaa;
+  assert(!RegShadow_Read(&shadow, 0x2f, v, 5));
+  assert(v[2] == 0xaa && Usage_Reads == 2);
+  assert(!RegShadow_Read(&shadow, 0x31, v, 1));
+  assert(Usage_Reads == 3);
+
+  /* Failed read forgets what it covered, the next one goes to device */
+  Usage_Fail = true;
+  assert(RegShadow_Read(&shadow, 0x2f, v, 5));
+  Usage_Fail = false;
+  assert(!RegShadow_Read(&shadow, 0x2f, v, 2));
+  assert(Usage_Reads == 5);
+
+  /* Read-modify-write of unchanged value skips the write */
+  Usage_Writes = 0;
+  assert(!RegShadow_Read(&shadow, 0x2a, v, 1));
+  assert(!RegShadow_Write(&shadow, 0x2a, v, 1));
+  assert(Usage_Writes == 0 && shadow.skipped == 1);
+
+  /* Soft reset command, out of range, passes through */
+  v[0] = 0xb6;
+  assert(!RegShadow_Write(&shadow, 0x7e, v, 1));
+  assert(Usage_Writes == 1 && Usage_Dev[0x7e] == 0xb6);
+}
+
+int main(void) {
+  Usage_Reconfigure();
+  Usage_Burst();
+  Usage_Cache();
+  puts("regshadow ok");
+  return EXIT_SUCCESS;
+}
+#endif
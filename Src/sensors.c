@@ -1,6 +1,7 @@
 #include "adc.h"
 #include "dma.h"
 #include "i2c.h"
+#include "i2c_xfer.h"
 #include "rtc.h"
 #include "spi.h"
 #include "gpio.h"
@@ -11,13 +12,54 @@
 #include "sensors.h"
 #include "hardware.h"
 #include "eeprom.h"
+#include "regshadow.h"
+#include "protobuf.h"
+#include "crc32.h"
 #include <assert.h>
 #include <math.h>
+#include <stddef.h>
+#include <string.h>
 
 #ifdef BMA400
 struct bma400_dev bma;
 struct BMA400_Handle bma400;
 
+/* Vibration mode batches, 12-bit X/Y/Z frames are a header and 6 bytes */
+#define BMA400_VIB_ODR          BMA400_ODR_100HZ
+#define BMA400_VIB_HZ           100
+#define BMA400_VIB_FRAMES       128
+#define BMA400_VIB_FRAME_SIZE   7
+#define BMA400_VIB_CHUNK        16      /* Frames extracted at once */
+#define BMA400_FIFO_SIZE        1024
+
+/* 12-bit at 2 g to scale 100 m/s^2, 2 * 980.665 / 2048 */
+#define BMA400_LSB_TO_FIX(v)    ((int32_t)(v) * 196133 / 204800)
+
+/* ACC_CONFIG0 (power mode, switched by auto low power/wakeup) and
+ * WKUP_INT_CONFIG2..4 (wakeup reference, updated by IC) */
+static const uint8_t bma400_nocache[REGSHADOW_BITMAP(BMA400_ACCEL_CONFIG_0_ADDR, 0x58)] = {0x01, 0x00, 0x00, 0x07};
+REGSHADOW(bma400_regs, BMA400_I2C_ADDRESS_SDO_LOW << 1, BMA400_ACCEL_CONFIG_0_ADDR, 0x58, bma400_nocache);
+
+/* NAME
+ *        BMA400_RegRead, BMA400_RegWrite - Driver hooks, through register shadow
+ *
+ * DESCRIPTION
+ *        The driver configures by read-modify-write of single registers. Reads
+ *        of configuration are served from the shadow, and writes of values
+ *        already on the IC dropped. Soft reset forgets the shadow.
+ */
+static int8_t BMA400_RegRead(uint8_t dev_id, uint8_t reg, uint8_t *data, uint16_t len) {
+  return RegShadow_Read(&bma400_regs, reg, data, len) ? -1 : 0;
+}
+
+static int8_t BMA400_RegWrite(uint8_t dev_id, uint8_t reg, uint8_t *data, uint16_t len) {
+  if(RegShadow_Write(&bma400_regs, reg, data, len))
+    return -1;
+  if(reg == BMA400_COMMAND_REG_ADDR && *data == BMA400_SOFT_RESET_CMD)
+    RegShadow_Invalidate(&bma400_regs);
+  return 0;
+}
+
 /* NAME
  *        BMA400_Init - Initialize BMA400 Bosch Accelerometer
  *
@@ -38,6 +80,31 @@ struct BMA400_Handle bma400;
  *        Power prolongs active level from 40ms to 80ms due wakeup time of
  *        2/ODR.
  *
+ *    Reconfiguration
+ *        Soft reset only on first configuration. After that, registers live in
+ *        bma400_regs, so only changed settings reach the IC, and settle delays
+ *        are skipped when nothing was written.
+ *
+ *    Vibration Mode
+ *        With BMA400_CONFIG_VIBRATION the IC runs in Normal Mode at 100 Hz,
+ *        batching X/Y/Z in its 1 KiB FIFO. INT1 signals the FIFO watermark of
+ *        BMA400_VIB_FRAMES samples instead of wake ups, BMA400_Process then
+ *        reduces the batch to struct BMA400_Vibration features.
+ *
+ *    Event Mode
+ *        With bma400_events the IC runs in Normal Mode, its own engines
+ *        classify motion and INT1 (latched) fires only on a meaningful change,
+ *        instead of on every wake up above threshold:
+ *
+ *            BMA400_EVENT_ORIENTATION  orientation change, stable for 1 s,
+ *                                      threshold (events & 0xff0000) >> 16 * 8 mg
+ *            BMA400_EVENT_ACTIVITY     still/walk/run of the step counter
+ *            BMA400_EVENT_STEPS        every (events & 0xff00) >> 8 * 10 steps
+ *
+ *        Activity and steps are evaluated on activity change interrupts,
+ *        average acceleration moving 64 mg over 128 samples, so steps don't
+ *        wake the MCU one by one.
+ *
  *    Run Modes (OSR=0 ODR=25Hz)
  *        - Sleep Mode       200 nA ~  160 nA  powerup in 1 ms
  *        - Normal Mode    14500 nA ~ 3500 nA  wakeup in 80 ms  800 Hz .. 12.5 Hz
@@ -52,22 +119,31 @@ struct BMA400_Handle bma400;
  *    https://www.bosch-sensortec.com/media/boschsensortec/downloads/datasheets/bst-bma400-ds000.pdf
  *        Datasheet.
  */
-void BMA400_Init(uint16_t config, uint16_t threshold) {
+void BMA400_Init(uint16_t config, uint16_t threshold, uint32_t events) {
+  const bool vibration = config & BMA400_CONFIG_VIBRATION;
+  const bool orient = events & BMA400_EVENT_ORIENTATION;
+  const bool activity = events & (BMA400_EVENT_ACTIVITY | BMA400_EVENT_STEPS);
+  const bool normal = vibration || orient || activity;
   int32_t r, c;
+  uint16_t w;
 
   bma400.p = &bma;
+  bma400.vibration = false;
+  bma400.events = 0;
+  bma400.irq = false;
 
   /* Initialize BMA400 Driver */
   bma.dev_id = BMA400_I2C_ADDRESS_SDO_LOW; /* I2C device address is 0x80 */
   bma.intf = BMA400_I2C_INTF;              /* I2C interface used */
   bma.intf_ptr = &hi2c1;      /* Hook I2C1 peripheral handle to driver */
   bma.delay_ms = delay_ms;    /* Hook HAL_Delay to driver */
-  bma.read = i2c_reg_read;    /* Hook HAL_I2C_Mem_Read to driver */
-  bma.write = i2c_reg_write;  /* Hook HAL_I2C_Mem_Write to driver */
+  bma.read = BMA400_RegRead;    /* Hook I2C_MemRead to driver */
+  bma.write = BMA400_RegWrite;  /* Hook I2C_MemWrite to driver */
 
   if((r = bma400_init(&bma))) {c = 0x1; goto err;};
 
-  if((r = bma400_soft_reset(&bma))) {c = 0x2; goto err;};
+  if(!RegShadow_Known(&bma400_regs))
+    if((r = bma400_soft_reset(&bma))) {c = 0x2; goto err;};
 
   /* Configure Acceleration */
   struct bma400_sensor_conf sconf;
@@ -75,13 +151,15 @@ void BMA400_Init(uint16_t config, uint16_t threshold) {
 
   if((r = bma400_get_sensor_conf(&sconf, 1, &bma))) {c = 0x3; goto err;};
 
-  sconf.param.accel.odr = BMA400_ODR_25HZ;
+  sconf.param.accel.odr = vibration ? BMA400_VIB_ODR : BMA400_ODR_25HZ;
   sconf.param.accel.range = BMA400_2G_RANGE;
   sconf.param.accel.data_src = BMA400_DATA_SRC_ACCEL_FILT_1;
   sconf.param.accel.osr = (config & 0x300) >> 8;
 
+  w = bma400_regs.writes;
   if((r = bma400_set_sensor_conf(&sconf, 1, &bma))) {c = 0x4; goto err;};
-  bma.delay_ms(100);
+  if(w != bma400_regs.writes)
+    bma.delay_ms(100);
 
   /* Configure Wake Up Interrupt */
   struct bma400_device_conf dconf;
@@ -104,23 +182,83 @@ void BMA400_Init(uint16_t config, uint16_t threshold) {
 
   if((r = bma400_get_device_conf(&dconf, 1, &bma))) {c = 0x7; goto err;};
 
-  dconf.param.auto_lp.auto_low_power_trigger = BMA400_AUTO_LP_TIMEOUT_EN;
+  dconf.param.auto_lp.auto_low_power_trigger = normal ? BMA400_AUTO_LP_TIMEOUT_DISABLE : BMA400_AUTO_LP_TIMEOUT_EN;
   dconf.param.auto_lp.auto_lp_timeout_threshold = 0;
 
   if((r = bma400_set_device_conf(&dconf, 1, &bma))) {c = 0x8; goto err;};
 
+  /* Configure FIFO, watermark on INT1 */
+  dconf.type = BMA400_FIFO_CONF;
+
+  if((r = bma400_get_device_conf(&dconf, 1, &bma))) {c = 0xb; goto err;};
+
+  dconf.param.fifo_conf.conf_regs = BMA400_FIFO_X_EN | BMA400_FIFO_Y_EN | BMA400_FIFO_Z_EN;
+  dconf.param.fifo_conf.conf_status = vibration ? BMA400_ENABLE : BMA400_DISABLE;
+  dconf.param.fifo_conf.fifo_watermark = BMA400_VIB_FRAMES * BMA400_VIB_FRAME_SIZE;
+  dconf.param.fifo_conf.fifo_wm_channel = vibration ? BMA400_INT_CHANNEL_1 : BMA400_UNMAP_INT_PIN;
+  dconf.param.fifo_conf.fifo_full_channel = BMA400_UNMAP_INT_PIN;
+
+  if((r = bma400_set_device_conf(&dconf, 1, &bma))) {c = 0xc; goto err;};
+
+  /* Configure Orientation, Activity Change and Step Counter engines */
+  struct bma400_sensor_conf econf[3];
+  econf[0].type = BMA400_ORIENT_CHANGE_INT;
+  econf[1].type = BMA400_ACTIVITY_CHANGE_INT;
+  econf[2].type = BMA400_STEP_COUNTER_INT;
+
+  if((r = bma400_get_sensor_conf(econf, 3, &bma))) {c = 0xe; goto err;};
+
+  econf[0].param.orient.axes_sel = BMA400_XYZ_AXIS_EN;
+  econf[0].param.orient.data_src = BMA400_DATA_SRC_ACC_FILT2;
+  econf[0].param.orient.ref_update = BMA400_ORIENT_REFU_ACC_FILT_2;     /* New orientation becomes reference */
+  econf[0].param.orient.orient_thres = events & 0xff0000 ? (events & 0xff0000) >> 16 : 32; /* N*8mg, defaults to 256mg ~15 deg */
+  econf[0].param.orient.stability_thres = 4;                           /* Within 32mg ... */
+  econf[0].param.orient.orient_int_dur = 100;                          /* ... for 1s */
+  econf[0].param.orient.stability_mode = BMA400_STABILITY_ACC_FILT_LP;
+  econf[0].param.orient.int_chan = orient ? BMA400_INT_CHANNEL_1 : BMA400_UNMAP_INT_PIN;
+  econf[1].param.act_ch.act_ch_thres = 8;                              /* N*8mg */
+  econf[1].param.act_ch.axes_sel = BMA400_XYZ_AXIS_EN;
+  econf[1].param.act_ch.data_source = BMA400_DATA_SRC_ACC_FILT2;
+  econf[1].param.act_ch.act_ch_ntps = BMA400_ACT_CH_SAMPLE_CNT_128;
+  econf[1].param.act_ch.int_chan = activity ? BMA400_INT_CHANNEL_1 : BMA400_UNMAP_INT_PIN;
+  econf[2].param.step_cnt.int_chan = BMA400_UNMAP_INT_PIN;             /* Count, but don't wake on every step */
+
+  if((r = bma400_set_sensor_conf(econf, 3, &bma))) {c = 0xf; goto err;};
+
   /* Configure Interrupt Mappings */
-  struct bma400_int_enable iconf[2];
+  struct bma400_int_enable iconf[6];
   iconf[0].type = BMA400_LATCH_INT_EN;
-  iconf[0].conf = BMA400_DISABLE;
+  iconf[0].conf = orient || activity ? BMA400_ENABLE : BMA400_DISABLE;
   iconf[1].type = BMA400_AUTO_WAKEUP_EN;
-  iconf[1].conf = BMA400_ENABLE;
-
-  if((r = bma400_enable_interrupt(iconf, 2, &bma))) {c = 0x9; goto err;};
-  bma.delay_ms(100);
+  iconf[1].conf = normal ? BMA400_DISABLE : BMA400_ENABLE;
+  iconf[2].type = BMA400_FIFO_WM_INT_EN;
+  iconf[2].conf = vibration ? BMA400_ENABLE : BMA400_DISABLE;
+  iconf[3].type = BMA400_ORIENT_CHANGE_INT_EN;
+  iconf[3].conf = orient ? BMA400_ENABLE : BMA400_DISABLE;
+  iconf[4].type = BMA400_ACTIVITY_CHANGE_INT_EN;
+  iconf[4].conf = activity ? BMA400_ENABLE : BMA400_DISABLE;
+  iconf[5].type = BMA400_STEP_COUNTER_INT_EN;
+  iconf[5].conf = activity ? BMA400_ENABLE : BMA400_DISABLE;
+
+  w = bma400_regs.writes;
+  if((r = bma400_enable_interrupt(iconf, 6, &bma))) {c = 0x9; goto err;};
+  if(w != bma400_regs.writes)
+    bma.delay_ms(100);
 
   /* Configure Power Mode */
-  if((r = bma400_set_power_mode(BMA400_LOW_POWER_MODE, &bma))) {c = 0xa; goto err;};
+  if((r = bma400_set_power_mode(normal ? BMA400_NORMAL_MODE : BMA400_LOW_POWER_MODE, &bma))) {c = 0xa; goto err;};
+
+  if(vibration) {
+    memset(&bma400.vib, 0, sizeof bma400.vib);
+    if((r = bma400_set_fifo_flush(&bma))) {c = 0xd; goto err;};
+    bma400.vibration = true;
+  }
+
+  if(orient || activity) {
+    if((r = bma400_get_steps_counted(&bma400.steps, &bma400.activity, &bma))) {c = 0x10; goto err;};
+    bma400.steps_sent = bma400.steps;
+    bma400.events = events;
+  }
 
   return;
 err:
@@ -135,7 +273,12 @@ void BMA400_Read(void) {
 
   bma400_get_accel_data(BMA400_DATA_ONLY, &data, &bma);
   bma400_get_device_conf(&conf, 1, &bma);
-  bma400_get_interrupt_status(&bma400.status, &bma);
+  if(!bma400.events) /* Reading clears latched events, leave them to BMA400_Process */
+    bma400_get_interrupt_status(&bma400.status, &bma);
+  else { /* Steps only, activity changes are BMA400_Process' to notice */
+    uint8_t activity;
+    bma400_get_steps_counted(&bma400.steps, &activity, &bma);
+  }
 
   bma400.raw_x = data.x;
   bma400.raw_y = data.y;
@@ -155,6 +298,187 @@ void BMA400_Reset(void) {
   bma400_soft_reset(&bma);
 }
 
+/* NAME
+ *        BMA400_Interrupt - INT1 edge, from EXTI callback
+ *
+ * DESCRIPTION
+ *        In vibration mode it's the FIFO watermark, in event mode a latched
+ *        event, leave the I2C reads to BMA400_Process in thread mode.
+ */
+void BMA400_Interrupt(void) {
+  if(bma400.vibration || bma400.events)
+    bma400.irq = true;
+}
+
+static uint32_t BMA400_Sqrt(uint32_t v) {
+  uint32_t r = 0, b = 1UL << 30;
+
+  while(b > v)
+    b >>= 2;
+  for(; b; b >>= 2) {
+    if(v >= r + b) {
+      v -= r + b;
+      r = (r >> 1) + b;
+    } else {
+      r >>= 1;
+    }
+  }
+  return r;
+}
+
+/* NAME
+ *        BMA400_Features - Reduce a FIFO readout to vibration features
+ *
+ * DESCRIPTION
+ *        First pass gets per axis mean, RMS of the AC part and the extremes.
+ *        Second pass counts mean crossings of the axis with most energy, with
+ *        a quarter RMS hysteresis against noise, for a dominant frequency of
+ *        crossings / 2 per batch duration.
+ *
+ *        Frames are extracted BMA400_VIB_CHUNK at a time, so only the raw FIFO
+ *        bytes are buffered.
+ */
+static void BMA400_Features(struct bma400_fifo_data *fifo) {
+  struct bma400_sensor_data d[BMA400_VIB_CHUNK];
+  int32_t sum[3] = {0}, min[3] = {INT16_MAX, INT16_MAX, INT16_MAX}, max[3] = {INT16_MIN, INT16_MIN, INT16_MIN};
+  uint32_t sq[3] = {0}, rms[3], peak = 0, crossings = 0;
+  int32_t mean[3], band;
+  unsigned n = 0, axis = 0, peak_axis = 0;
+  uint16_t k;
+  int8_t side = 0;
+
+  do {
+    k = BMA400_VIB_CHUNK;
+    bma400_extract_accel(fifo, d, &k, &bma);
+    for(unsigned i = 0; i < k; i++) {
+      const int32_t v[3] = {d[i].x, d[i].y, d[i].z};
+      for(unsigned a = 0; a < 3; a++) {
+        sum[a] += v[a];
+        sq[a] += v[a] * v[a];
+        min[a] = v[a] < min[a] ? v[a] : min[a];
+        max[a] = v[a] > max[a] ? v[a] : max[a];
+      }
+    }
+    n += k;
+  } while(k == BMA400_VIB_CHUNK);
+
+  if(!n)
+    return;
+
+  for(unsigned a = 0; a < 3; a++) {
+    uint32_t p;
+    mean[a] = sum[a] / (int32_t)n;
+    rms[a] = BMA400_Sqrt(sq[a] / n - (uint32_t)(mean[a] * mean[a]));
+    p = max[a] - mean[a] > mean[a] - min[a] ? max[a] - mean[a] : mean[a] - min[a];
+    axis = rms[a] > rms[axis] ? a : axis;
+    if(p > peak) {
+      peak = p;
+      peak_axis = a;
+    }
+  }
+
+  /* Second pass, mean crossings of the strongest axis */
+  band = rms[axis] / 4;
+  fifo->accel_byte_start_idx = 0;
+  do {
+    k = BMA400_VIB_CHUNK;
+    bma400_extract_accel(fifo, d, &k, &bma);
+    for(unsigned i = 0; i < k; i++) {
+      const int32_t v = (axis == 0 ? d[i].x : axis == 1 ? d[i].y : d[i].z) - mean[axis];
+      if(v > band && side <= 0) {
+        crossings += side < 0;
+        side = 1;
+      } else if(v < -band && side >= 0) {
+        crossings += side > 0;
+        side = -1;
+      }
+    }
+  } while(k == BMA400_VIB_CHUNK);
+
+  bma400.vib.rms_x = BMA400_LSB_TO_FIX(rms[0]);
+  bma400.vib.rms_y = BMA400_LSB_TO_FIX(rms[1]);
+  bma400.vib.rms_z = BMA400_LSB_TO_FIX(rms[2]);
+  bma400.vib.peak = BMA400_LSB_TO_FIX(peak);
+  bma400.vib.crest = rms[peak_axis] ? peak * 100 / rms[peak_axis] : 0;
+  bma400.vib.freq = crossings * BMA400_VIB_HZ * 10 / (2 * n);
+  bma400.vib.frames = n;
+  bma400.vib.batches++;
+}
+
+/* NAME
+ *        BMA400_Batch - Burst read FIFO and extract features
+ */
+static void BMA400_Batch(void) {
+  static uint8_t buf[BMA400_FIFO_SIZE];
+  struct bma400_fifo_data fifo = { .data = buf, .length = sizeof buf };
+  int32_t r;
+
+  if((r = bma400_get_fifo_data(&fifo, &bma))) {
+    DEBUG_PRINTF("SEN BMA400 ERR ret:0x%x FIFO Read Failed!\n", r);
+    return;
+  }
+  BMA400_Features(&fifo);
+  DBG_PRINTF("SEN BMA400 VIB n:%u rms:%u/%u/%u peak:%u crest:%u freq:%u\n", bma400.vib.frames,
+      bma400.vib.rms_x, bma400.vib.rms_y, bma400.vib.rms_z, bma400.vib.peak, bma400.vib.crest, bma400.vib.freq);
+}
+
+/* NAME
+ *        BMA400_Events - Turn latched engine interrupts into LoRa events
+ *
+ * DESCRIPTION
+ *        Reading interrupt status releases the latch. Activity class and step
+ *        count are compared to what was last seen or sent, an activity change
+ *        interrupt alone isn't worth a message.
+ */
+static void BMA400_Events(void) {
+  const uint32_t per = (bma400.events & 0xff00 ? (bma400.events & 0xff00) >> 8 : 1) * 10;
+  uint16_t status;
+  uint8_t activity;
+  int32_t r;
+
+  if((r = bma400_get_interrupt_status(&status, &bma)) || (r = bma400_get_steps_counted(&bma400.steps, &activity, &bma))) {
+    DEBUG_PRINTF("SEN BMA400 ERR ret:0x%x Event Read Failed!\n", r);
+    return;
+  }
+  bma400.status = status;
+  DBG_PRINTF("SEN BMA400 EVT IRQ:0x%04x act:%u steps:%u\n", status, activity, bma400.steps);
+
+  if(bma400.events & BMA400_EVENT_ORIENTATION && status & BMA400_ORIENT_CH_INT_ASSERTED)
+    enqueueToSend(EVENT, LRW_B0_TRIGGER_ORIENTATION);
+
+  if(activity != bma400.activity) {
+    bma400.activity = activity;
+    if(bma400.events & BMA400_EVENT_ACTIVITY)
+      enqueueToSend(EVENT, LRW_B0_TRIGGER_ACTIVITY);
+  }
+
+  if(bma400.events & BMA400_EVENT_STEPS && bma400.steps - bma400.steps_sent >= per) {
+    bma400.steps_sent = bma400.steps;
+    enqueueToSend(EVENT, LRW_B0_TRIGGER_STEPS);
+  }
+}
+
+/* NAME
+ *        BMA400_Process - Handle INT1 of vibration or event mode
+ *
+ * DESCRIPTION
+ *        Called from main loop. Watermark interrupt is level, non-latched, so
+ *        if the FIFO has refilled past it meanwhile, go again without an edge.
+ */
+void BMA400_Process(void) {
+  if(!bma400.irq)
+    return;
+  bma400.irq = false;
+
+  if(bma400.events)
+    BMA400_Events();
+  if(bma400.vibration)
+    BMA400_Batch();
+
+  if((bma400.vibration || bma400.events) && HAL_GPIO_ReadPin(Button0_GPIO_Port, Button0_Pin))
+    bma400.irq = true;
+}
+
 void BMA400_ForeverTest(void) {
   uint32_t ts_prev, ts_now, prev = 0;
 
@@ -192,6 +516,87 @@ void BMA400_ForeverTest(void) {
 
 #ifdef SFH7776
 struct SFH7776_Handle sfh7776;
+static void SFH7776_Parse(const uint8_t *buf);
+
+/* PS_DATA, ALS_VIS_DATA, ALS_IR_DATA */
+static const uint8_t sfh7776_nocache[REGSHADOW_BITMAP(SFH7776_MODE_CONTROL, SFH7776_ALS_VIS_TL_MSB)] = {0xf8, 0x01, 0x00};
+REGSHADOW(sfh7776_regs, 0x72, SFH7776_MODE_CONTROL, SFH7776_ALS_VIS_TL_MSB, sfh7776_nocache);
+
+/* NAME
+ *        SFH7776_Lookup - Calibration band for IR/VIS ratio
+ */
+static const struct SFH7776_Band *SFH7776_Lookup(uint32_t ratio) {
+  const struct SFH7776_Band *cal = DevCfg.sfh7776_cal;
+  size_t i;
+
+  for(i = 0; i + 1 < SFH7776_BANDS && cal[i + 1].ratio && ratio >= cal[i].ratio; i++);
+  return &cal[i];
+}
+
+/* NAME
+ *        SFH7776_Ratio - ALS_IR / ALS_VIS, scale 1000
+ */
+static uint32_t SFH7776_Ratio(uint16_t als_vis, uint16_t als_ir) {
+  uint32_t ratio = als_vis ? (uint32_t)als_ir * 1000 / als_vis : UINT16_MAX;
+
+  return ratio > UINT16_MAX ? UINT16_MAX : ratio;
+}
+
+/* NAME
+ *        SFH7776_Coefficient - Lux per ALS_VIS count at x1, scale 1000
+ *
+ * DESCRIPTION
+ *        IR accounted for as a fraction of VIS. Never below 1, so it can
+ *        divide thresholds.
+ */
+static int32_t SFH7776_Coefficient(const struct SFH7776_Band *band, uint32_t ratio) {
+  int32_t k = band->vis - (int32_t)(band->ir * ratio / 1000);
+
+  return k < 1 ? 1 : k;
+}
+
+/* NAME
+ *        SFH7776_CalibrationSize - Bytes of used calibration bands
+ */
+size_t SFH7776_CalibrationSize(const struct SFH7776_Band *cal) {
+  size_t i;
+
+  static_assert(sizeof *cal == 6, "Calibration bands are sent as is");
+  for(i = 0; i < SFH7776_BANDS && cal[i].ratio; i++);
+  return i * sizeof *cal;
+}
+
+/* NAME
+ *        SFH7776_Thresholds - Stage lux thresholds as ALS_VIS counts of gain
+ *
+ * DESCRIPTION
+ *        The IC compares ALS_VIS alone, so the coefficient of the last
+ *        sample's ratio converts.
+ *
+ *        Outside the thresholds, the exceeded one is disabled and the other
+ *        moves to where the light has come back by hyst, see SFH7776_State.
+ */
+static void SFH7776_Thresholds(void) {
+  uint32_t upper = sfh7776.upper, lower = sfh7776.lower, th, tl;
+  uint8_t val[4];
+
+  if(sfh7776.state > 0)
+    upper = UINT16_MAX, lower = sfh7776.upper * (100 - sfh7776.hyst) / 100;
+  else if(sfh7776.state < 0)
+    lower = 0, upper = sfh7776.lower * (100 + sfh7776.hyst) / 100;
+  upper = upper > UINT16_MAX ? UINT16_MAX : upper;
+
+  th = upper * 1000 * sfh7776.gain / sfh7776.k;
+  tl = lower * 1000 * sfh7776.gain / sfh7776.k;
+  th = th > UINT16_MAX ? UINT16_MAX : th;
+  tl = tl > UINT16_MAX ? UINT16_MAX : tl;
+
+  // ALS_VIS_TH: ALS upper threshold
+  // ALS_VIS_TL: ALS lower threshold
+  val[0] = th, val[1] = th >> 8, val[2] = tl, val[3] = tl >> 8;
+  RegShadow_Set(&sfh7776_regs, SFH7776_ALS_VIS_TH_LSB, val, 4);
+  sfh7776.als_vis_tl = tl;
+}
 
 /* NAME
  *        SFH7776_Init - Configure the SFH7776 IC Luminance sensor.
@@ -199,52 +604,60 @@ struct SFH7776_Handle sfh7776;
  * DESCRIPTION
  *    Gain
  *        Higher gain, e.g. x64 over x1, decreases lux range, but increases
- *        granularity.
+ *        granularity. SFH7776_Parse switches between them, x1 once x64 nears
+ *        saturation, x64 once x1 counts would fit it.
  *
  *    Int Pin
  *        Open-Drain, i.e. 2 states of either Hi-Z or GND. So default state is
  *        1, and interrupt happens on 0.
  *
+ *    Reconfiguration
+ *        Reset and identity check only on first configuration, after that
+ *        only registers that differ from sfh7776_regs are written.
+ *
  * SEE ALSO
  *    https://dammedia.osram.info/media/resource/hires/osram-dam-2496477/SFH 7776.pdf#page=26
  *        Describes Int Pin.
  */
-void SFH7776_Init(uint16_t upper_thres, uint16_t lower_thres) {
+void SFH7776_Init(uint16_t upper_thres, uint16_t lower_thres, uint8_t hyst) {
   int32_t r, c = 0;
   uint8_t val[4];
-  uint32_t als_vis_th = fminf(roundf((uint32_t)GAIN_VIS * upper_thres / 8 / 4), UINT16_MAX);
-  uint32_t als_vis_tl = fminf(roundf((uint32_t)GAIN_VIS * lower_thres / 8 / 4), UINT16_MAX);
+  uint32_t max, ratio = SFH7776_Ratio(sfh7776.als_vis, sfh7776.als_ir);
 
-  als_vis_th = GAIN_VIS * upper_thres / 8 / 4, als_vis_th = als_vis_th > UINT16_MAX ? UINT16_MAX : als_vis_th;
-  als_vis_tl = GAIN_VIS * lower_thres / 8 / 4, als_vis_tl = als_vis_tl > UINT16_MAX ? UINT16_MAX : als_vis_tl;
+  /* Calibration may have changed since last sample */
+  if(!sfh7776.gain)
+    sfh7776.gain = 64, ratio = 0;
+  sfh7776.k = SFH7776_Coefficient(SFH7776_Lookup(ratio), ratio);
 
   /* Communicate via NFC that threshold was lowered to maximum */
-  DevCfg.sfh7776_threshold_upper = 8 * 4 * als_vis_th / GAIN_VIS;
-  DevCfg.sfh7776_threshold_lower = 8 * 4 * als_vis_tl / GAIN_VIS;
+  max = (uint32_t)UINT16_MAX * sfh7776.k / 1000;
+  DevCfg.sfh7776_threshold_upper = sfh7776.upper = upper_thres > max ? max : upper_thres;
+  DevCfg.sfh7776_threshold_lower = sfh7776.lower = lower_thres > max ? max : lower_thres;
+  sfh7776.hyst = hyst > 100 ? 100 : hyst;
+  sfh7776.state = 0;
 
   // SYSTEM_CONTROL: reset and check identity
-  *val = 0x80;
-  if((r = HAL_I2C_Mem_Write(&hi2c1, 0x72, SFH7776_SYSTEM_CONTROL, I2C_MEMADD_SIZE_8BIT, val, 1, 100))) {c = 0x1; goto err;};
-  if((r = HAL_I2C_Mem_Read(&hi2c1, 0x72, SFH7776_SYSTEM_CONTROL, I2C_MEMADD_SIZE_8BIT, val, 1, 100))) {c = 0x2; goto err;};
-  HAL_Delay(100);
-  if(*val != 0x09) {c = 0x3; goto err;};
+  if(!RegShadow_Known(&sfh7776_regs)) {
+    *val = 0x80;
+    if((r = I2C_MemWrite(0x72, SFH7776_SYSTEM_CONTROL, I2C_MEMADD_SIZE_8BIT, val, 1, 100))) {c = 0x1; goto err;};
+    if((r = I2C_MemRead(0x72, SFH7776_SYSTEM_CONTROL, I2C_MEMADD_SIZE_8BIT, val, 1, 100))) {c = 0x2; goto err;};
+    HAL_Delay(100);
+    if(*val != 0x09) {c = 0x3; goto err;};
+  }
 
   // MODE_CONTROL: PS disabled, ALS enabled and measure for 100ms every 400ms.
-  // ALS_PS_CONTROL: ALS_VIS and ALS_IR use x64 gain.
-  static_assert(T_INT_ALS == 100 && GAIN_VIS == 64 && GAIN_IR == 64, "");
-  val[0] = 0x08, val[1] = 0x28;
-  if((r = HAL_I2C_Mem_Write(&hi2c1, 0x72, SFH7776_MODE_CONTROL, I2C_MEMADD_SIZE_8BIT, val, 2, 100))) {c = 0x4; goto err;};
+  // ALS_PS_CONTROL: ALS_VIS and ALS_IR use the same x1 or x64 gain.
+  static_assert(T_INT_ALS == 100 && T_ALS == 400, "");
+  val[0] = 0x08, val[1] = sfh7776.gain == 1 ? GAIN_X1 : GAIN_X64;
+  RegShadow_Set(&sfh7776_regs, SFH7776_MODE_CONTROL, val, 2);
 
-  // ALS_VIS_TH: ALS upper threshold
-  // ALS_VIS_TL: ALS lower threshold
-  val[0] = als_vis_th, val[1] = als_vis_th >> 8, val[2] = als_vis_tl, val[3] = als_vis_tl >> 8;
-  if((r = HAL_I2C_Mem_Write(&hi2c1, 0x72, SFH7776_ALS_VIS_TH_LSB, I2C_MEMADD_SIZE_8BIT, val, 4, 100))) {c = 0x5; goto err;};
+  SFH7776_Thresholds();
 
   // INTERRUPT_CONTROL: ALS only, non-latched.
   *val = 0x06;
-  if((r = HAL_I2C_Mem_Write(&hi2c1, 0x72, SFH7776_INTERRUPT_CONTROL, I2C_MEMADD_SIZE_8BIT, val, 1, 100))) {c = 0x6; goto err;};
+  RegShadow_Set(&sfh7776_regs, SFH7776_INTERRUPT_CONTROL, val, 1);
 
-  sfh7776.als_vis_tl = als_vis_tl;
+  if((r = RegShadow_Flush(&sfh7776_regs))) {c = 0x4; goto err;};
 
   return;
 err:
@@ -273,58 +686,136 @@ err:
  *        read INT_STATUS.
  *
  * SEE ALSO
- *    https://dammedia.osram.info/media/resource/hires/osram-dam-2496565/SFH 7776 (IR-LED + proximity sensor + ambient light sensor).pdf#page=6
- *        C/Eq.(1) exemplifies Lux formula w/o overlayed covers
- *        I/Eq.(5) elaborates Lux formula for overlayed covers
+ *    SFH7776_Parse
  */
 void SFH7776_Read(void) {
   uint8_t buf[4];
-  float lux;
 
-  HAL_I2C_Mem_Read(&hi2c1, 0x72, 0x46, I2C_MEMADD_SIZE_8BIT, buf, sizeof buf, 100);
+  I2C_MemRead(0x72, SFH7776_ALS_VIS_DATA_LSB, I2C_MEMADD_SIZE_8BIT, buf, sizeof buf, 100);
+  SFH7776_Parse(buf);
+}
+
+/* NAME
+ *        SFH7776_Parse - Update globals from ALS_VIS/ALS_IR data registers
+ *
+ * DESCRIPTION
+ *        Lux by DevCfg.sfh7776_cal, integer math only. The default single
+ *        band, VIS only, is the multiplier hand measured by comparing phone
+ *        and device against white IPS LCD monitor at 40% brightness (target:
+ *        250 lux), AN099 reference and cover examples read 42 and 120 lux.
+ *
+ *        After a gain switch, samples within T_ALS * 2 may still be of the old
+ *        gain, and are dropped.
+ *
+ * SEE ALSO
+ *    https://dammedia.osram.info/media/resource/hires/osram-dam-2496565/SFH 7776 (IR-LED + proximity sensor + ambient light sensor).pdf#page=6
+ *        C/Eq.(1) exemplifies Lux formula w/o overlayed covers
+ *        I/Eq.(5) elaborates Lux formula for overlayed covers, e.g. bands
+ *        {670, 11071, 14286}, {746, 5876, 6536}, {1482, 1914, 1225},
+ *        {2340, 3828, 1446}, {3900, 7656, 1629}, {0xffff, 15312, 0}.
+ */
+static void SFH7776_Parse(const uint8_t *buf) {
   const uint16_t ALS_VIS = buf[1] << 8 | buf[0];
   const uint16_t ALS_IR = buf[3] << 8 | buf[2];
+  const struct SFH7776_Band *band;
+  uint32_t ratio, vis, ir, lux;
+  uint8_t val;
 
-  // Reference Calculation (No cover)
-  lux =
-    1.0 * ALS_IR / ALS_VIS < 0.109       ?        1.534 * ALS_VIS / GAIN_VIS -         3.759 * ALS_IR / GAIN_IR : // - LED, fluorescence and sunlight based light.
-    1.0 * ALS_IR / ALS_VIS < 0.429       ?        1.339 * ALS_VIS / GAIN_VIS -         1.972 * ALS_IR / GAIN_IR : // - Incandescent and halogen lamps.
-    1.0 * ALS_IR / ALS_VIS < 0.95 * 1.45 ?        0.701 * ALS_VIS / GAIN_VIS -         0.483 * ALS_IR / GAIN_IR : // - Dimmed incandescent and halogen lamps,
-    1.0 * ALS_IR / ALS_VIS < 1.5  * 1.45 ?  2.0 * 0.701 * ALS_VIS / GAIN_VIS -  1.18 * 0.483 * ALS_IR / GAIN_IR : //   characterized by increased infrared.
-    1.0 * ALS_IR / ALS_VIS < 2.5  * 1.45 ?  4.0 * 0.701 * ALS_VIS / GAIN_VIS -  1.33 * 0.483 * ALS_IR / GAIN_IR :
-                                            8.0 * 0.701 * ALS_VIS / GAIN_VIS;
-
-  // AN099/page28 I/eq5 Example Calculation (example cover)
-  lux =
-    1.0 * ALS_IR / ALS_VIS < 0.670       ?       11.071 * ALS_VIS / GAIN_VIS -        14.286 * ALS_IR / GAIN_IR : // - LED, fluorescence and sunlight based light.
-    1.0 * ALS_IR / ALS_VIS < 0.746       ?        5.876 * ALS_VIS / GAIN_VIS -         6.536 * ALS_IR / GAIN_IR : // - Incandescent and halogen lamps.
-    1.0 * ALS_IR / ALS_VIS < 0.95 * 1.56 ?        1.914 * ALS_VIS / GAIN_VIS -         1.225 * ALS_IR / GAIN_IR : // - Dimmed incandescent and halogen lamps,
-    1.0 * ALS_IR / ALS_VIS < 1.5  * 1.56 ?  2.0 * 1.914 * ALS_VIS / GAIN_VIS -  1.18 * 1.225 * ALS_IR / GAIN_IR : //   characterized by increased infrared.
-    1.0 * ALS_IR / ALS_VIS < 2.5  * 1.56 ?  4.0 * 1.914 * ALS_VIS / GAIN_VIS -  1.33 * 1.225 * ALS_IR / GAIN_IR :
-                                            8.0 * 1.914 * ALS_VIS / GAIN_VIS;
-  sfh7776.lux = lux * 100 / T_INT_ALS;
-
-  // Since calculating true ALS (with IR) can cause 87% variation (e.g. threshold is 6000 lux; but triggers at 759 lux)
-  // And wakeup can't accomodate IR to begin with, I'll choose visible light only solution.
-
-  // Multiplier hand measured through trial & error, by comparing phone and device against white IPS LCD monitor 40% brightness (target: 250 lux)
-  lux = 8.0 * 1.914 * ALS_VIS / GAIN_VIS; // AN099 Cover example   (cover:120 lux; exposed: 1455 lux)
-  lux = 8.0 * 0.701 * ALS_VIS / GAIN_VIS; // AN099 Reference value (cover: 42 lux; exposed:  550 lux)
-  lux = 8   * 4     * ALS_VIS / GAIN_VIS; // Trial & Error         (cover:236 lux; exposed: 2957 lux)
+  if((int32_t)(HW_RTCGetMsTime() - sfh7776.settle) < 0)
+    return;
 
-  /*
-   * gcc discards redundant calculations, like no floats invoked. Demonstrated by:
-   * arm-none-eabi-objdump --visualize-jumps=extended-color -FCz --disassemble=SFH7776_Read ./stx-fw.elf
-   */
+  /* Out of range for the gain, switch and wait for a sample of it */
+  if(sfh7776.gain == 64 ? ALS_VIS > GAIN_DOWN || ALS_IR > GAIN_DOWN : ALS_VIS < GAIN_UP && ALS_IR < GAIN_UP) {
+    sfh7776.gain = sfh7776.gain == 64 ? 1 : 64;
+    val = sfh7776.gain == 1 ? GAIN_X1 : GAIN_X64;
+    RegShadow_Set(&sfh7776_regs, SFH7776_ALS_PS_CONTROL, &val, 1);
+    SFH7776_Thresholds();
+    if(RegShadow_Flush(&sfh7776_regs))
+      DEBUG_MSG("SEN SFH7776 ERR Gain Switch Failed!\n");
+    sfh7776.settle = HW_RTCGetMsTime() + T_ALS * 2;
+    DBG_PRINTF("SEN SFH7776 gain:x%u ALS_VIS:0x%04x ALS_IR:0x%04x\n", sfh7776.gain, ALS_VIS, ALS_IR);
+    return;
+  }
+
+  ratio = SFH7776_Ratio(ALS_VIS, ALS_IR);
+  band = SFH7776_Lookup(ratio);
 
-  sfh7776.lux = 8 * 4 * ALS_VIS * 100 / T_INT_ALS / GAIN_VIS;
+  /* Both products fit 32 bits, 16 x 16 */
+  vis = (uint32_t)band->vis * ALS_VIS;
+  ir = (uint32_t)band->ir * ALS_IR;
+  lux = vis > ir ? ((vis - ir) / sfh7776.gain + 500) / 1000 * 100 / T_INT_ALS : 0;
+
+  sfh7776.k = SFH7776_Coefficient(band, ratio);
+  sfh7776.lux = lux > UINT16_MAX ? UINT16_MAX : lux;
   sfh7776.als_vis = ALS_VIS;
   sfh7776.als_ir = ALS_IR;
 }
 
+/* NAME
+ *        SFH7776_State - Next threshold state of a lux sample
+ */
+static int8_t SFH7776_State(uint16_t lux) {
+  int8_t s = sfh7776.state;
+
+  if(s > 0 && lux < (uint32_t)sfh7776.upper * (100 - sfh7776.hyst) / 100)
+    s = 0;
+  if(s < 0 && lux > (uint32_t)sfh7776.lower * (100 + sfh7776.hyst) / 100)
+    s = 0;
+  if(s == 0 && lux > sfh7776.upper)
+    s = 1;
+  if(s == 0 && lux < sfh7776.lower)
+    s = -1;
+  return s;
+}
+
+/* NAME
+ *        SFH7776_Interrupt - LIGHT_Int fall, from EXTI callback
+ */
+void SFH7776_Interrupt(void) {
+  sfh7776.irq = true;
+}
+
+/* NAME
+ *        SFH7776_Process - Threshold transitions, in thread mode
+ *
+ * DESCRIPTION
+ *        Leaving the thresholds sends LIGHT_HIGH or LIGHT_LOW once, then
+ *        SFH7776_Thresholds moves them so INT releases (non-latched) until
+ *        the light returns by hyst. A light left on thus costs one message,
+ *        not one every T_ALS.
+ *
+ *        Samples still settling from a gain switch are retried while INT is
+ *        held low.
+ */
+void SFH7776_Process(void) {
+  int8_t s;
+
+  if(!sfh7776.irq)
+    return;
+  sfh7776.irq = false;
+
+  SFH7776_Read();
+  if((int32_t)(HW_RTCGetMsTime() - sfh7776.settle) < 0) {
+    if(!HAL_GPIO_ReadPin(LIGHT_Int_GPIO_Port, LIGHT_Int_Pin))
+      sfh7776.irq = true;
+    return;
+  }
+
+  if(s = SFH7776_State(sfh7776.lux), s != sfh7776.state) {
+    sfh7776.state = s;
+    if(s)
+      enqueueToSend(EVENT, s > 0 ? LRW_B0_TRIGGER_LIGHT_HIGH : LRW_B0_TRIGGER_LIGHT_LOW);
+    DBG_PRINTF("SEN SFH7776 IRQ lux:%u state:%d\n", sfh7776.lux, s);
+  }
+
+  SFH7776_Thresholds();
+  if(RegShadow_Flush(&sfh7776_regs))
+    DEBUG_MSG("SEN SFH7776 ERR Rearm Failed!\n");
+}
+
 void SFH7776_Reset(void) {
   uint8_t val = 0x80;
-  if(HAL_OK != HAL_I2C_Mem_Read(&hi2c1, 0x72, SFH7776_SYSTEM_CONTROL, I2C_MEMADD_SIZE_8BIT, &val, 1, 100))
+  if(HAL_OK != I2C_MemRead(0x72, SFH7776_SYSTEM_CONTROL, I2C_MEMADD_SIZE_8BIT, &val, 1, 100))
     DEBUG_MSG("SEN SFH7776 Reset Failed!\n");
 }
 
@@ -354,6 +845,56 @@ void SFH7776_ForeverTest(void) {
 
 #ifdef BME680
 #include "bme680.h"
+
+/* Sensor mode polls after the profile duration, should its oscillator lag RTC */
+#define BME680_POLL_MS     5
+#define BME680_POLL_TRIES  10
+
+/* NAME
+ *        BME680_Trigger - Begin a forced mode measurement with current settings
+ *
+ * DESCRIPTION
+ *        Records in bme680.due when the TPH conversion and gas heater profile
+ *        (bme680_get_profile_dur) are done, in HW_RTCGetMsTime.
+ */
+static int8_t BME680_Trigger(void) {
+  uint16_t dur;
+  int8_t r;
+
+  bme680.dev.power_mode = BME680_FORCED_MODE;
+  if((r = bme680_set_sensor_mode(&bme680.dev)))
+    return r;
+
+  bme680_get_profile_dur(&dur, &bme680.dev);
+  bme680.due = HW_RTCGetMsTime() + dur;
+  bme680.pending = true;
+  return BME680_OK;
+}
+
+/* NAME
+ *        BME680_Await - Stop mode until the forced measurement is done
+ *
+ * RETURN VALUE
+ *        BME680_OK once the sensor is back in sleep mode, BME680_W_NO_NEW_DATA
+ *        if it's still measuring after BME680_POLL_TRIES polls.
+ */
+static int8_t BME680_Await(void) {
+  int8_t r;
+
+  HW_StopUntil(bme680.due);
+  bme680.pending = false;
+
+  for(unsigned i = 0;; i++) {
+    if((r = bme680_get_sensor_mode(&bme680.dev)))
+      return r;
+    if(bme680.dev.power_mode == BME680_SLEEP_MODE)
+      return BME680_OK;
+    if(i == BME680_POLL_TRIES)
+      return BME680_W_NO_NEW_DATA;
+    HAL_Delay(BME680_POLL_MS);
+  }
+}
+
 #ifdef BSEC
 #include "bsec_datatypes.h"
 #include "bsec_interface.h"
@@ -366,6 +907,111 @@ struct BME680_Handle bme680 = {
   .dev.delay_ms = HAL_Delay,
 };
 
+/*
+ * DESCRIPTION
+ *        BSEC calibration state, saved to EEPROM_BSEC so IAQ doesn't need days
+ *        of gas heater cycles to reconverge after a reset or battery swap.
+ *
+ *        Slots are written round robin, spreading wear, and the valid slot
+ *        with the highest seq wins. A torn write thus only loses the latest
+ *        save. The CRC covers the whole slot, states of another BSEC version
+ *        or slot layout are ignored.
+ *
+ * NOTES
+ *        HW_WriteEEPROM skips unchanged words. Three slots and a 4 h interval
+ *        program a word at most every 12 h, far below the EEPROM endurance.
+ */
+struct BSEC_StateSlot {
+  uint32_t crc;
+  uint32_t seq;
+  uint32_t version;  /* bsec_version_t, major in LSB */
+  uint16_t layout;   /* BSEC_STATE_LAYOUT */
+  uint16_t len;
+  uint8_t  state[(BSEC_MAX_STATE_BLOB_SIZE + 3) / 4 * 4];
+};
+
+#define BSEC_STATE_LAYOUT  1
+#define BSEC_STATE_SLOTS   ((EEPROM_BSEC_END - EEPROM_BSEC) / sizeof(struct BSEC_StateSlot))
+static_assert(BSEC_STATE_SLOTS >= 2, "BSEC state slots don't fit EEPROM_BSEC.");
+
+static struct {
+  uint32_t seq;    /* Of the latest slot, 0 if none */
+  uint8_t slot;
+  uint8_t acc;     /* IAQ accuracy at last save */
+  uint32_t saved;  /* HW_RTCGetSTime of last save or load */
+} bsecState;
+
+static uint32_t BSEC_Version(void) {
+  bsec_version_t v = {0};
+
+  bsec_get_version(&v);
+  return v.major | v.minor << 8 | v.major_bugfix << 16 | (uint32_t)v.minor_bugfix << 24;
+}
+
+static uint32_t BSEC_StateCRC(const struct BSEC_StateSlot *s) {
+  return CRC32_Finalize(CRC32_Update(CRC32_INIT, &s->seq, sizeof *s - offsetof(struct BSEC_StateSlot, seq)));
+}
+
+/* NAME
+ *        BSEC_LoadState - Restore the latest valid calibration state
+ */
+static void BSEC_LoadState(void) {
+  const struct BSEC_StateSlot *slots = (const struct BSEC_StateSlot *)EEPROM_BSEC, *best = NULL;
+  const uint32_t version = BSEC_Version();
+  uint8_t work[BSEC_MAX_STATE_BLOB_SIZE];
+  int r;
+
+  bsecState.saved = HW_RTCGetSTime();
+
+  for(unsigned i = 0; i < BSEC_STATE_SLOTS; i++) {
+    const struct BSEC_StateSlot *s = &slots[i];
+    if(s->layout != BSEC_STATE_LAYOUT || s->version != version || s->len > BSEC_MAX_STATE_BLOB_SIZE)
+      continue;
+    if(s->crc != BSEC_StateCRC(s))
+      continue;
+    if(!best || (int32_t)(s->seq - best->seq) > 0)
+      best = s;
+  }
+
+  if(!best) {
+    DBG_PRINTF("SEN BSEC    No saved state\n");
+    return;
+  }
+
+  bsecState.seq = best->seq;
+  bsecState.slot = best - slots;
+  if((r = bsec_set_state(best->state, best->len, work, sizeof work))) {
+    DBG_PRINTF("SEN BSEC    ERR ret:%d Restoring state seq:%u\n", r, best->seq);
+    return;
+  }
+  DBG_PRINTF("SEN BSEC    Restored state seq:%u slot:%u\n", best->seq, bsecState.slot);
+}
+
+/* NAME
+ *        BSEC_SaveState - Write calibration state to the next slot
+ */
+static void BSEC_SaveState(void) {
+  struct BSEC_StateSlot s = {.seq = bsecState.seq + 1, .version = BSEC_Version(), .layout = BSEC_STATE_LAYOUT};
+  const uint8_t slot = (bsecState.slot + 1) % BSEC_STATE_SLOTS;
+  uint8_t work[BSEC_MAX_STATE_BLOB_SIZE];
+  uint32_t len;
+  int r, c;
+
+  if((r = bsec_get_state(0, s.state, sizeof s.state, work, sizeof work, &len))) {c = 0x1; goto err;};
+  s.len = len;
+  s.crc = BSEC_StateCRC(&s);
+  if(!HW_WriteEEPROM((void*)(EEPROM_BSEC + slot * sizeof s), &s, sizeof s)) {r = 0; c = 0x2; goto err;};
+
+  bsecState.seq = s.seq;
+  bsecState.slot = slot;
+  bsecState.acc = bme680.bsec.acc;
+  bsecState.saved = HW_RTCGetSTime();
+  DBG_PRINTF("SEN BSEC    Saved state seq:%u slot:%u len:%u acc:%u\n", s.seq, slot, s.len, bsecState.acc);
+  return;
+err:
+  DBG_PRINTF("SEN BSEC    ERR ret:0x%x cond:0x%x Saving state\n", r, c);
+}
+
 void BSEC_Init(float sample_rate) {
   bsec_sensor_configuration_t phy[BSEC_MAX_PHYSICAL_SENSOR];
   bsec_sensor_configuration_t virt[] = {
@@ -399,203 +1045,230 @@ void BSEC_Init(float sample_rate) {
   /* Enable virtual sensors */
   if((r = bsec_update_subscription(virt, sizeof virt / sizeof *virt, phy, &phy_count))) {c = 0x3; goto err;};
 
+  /* Resume calibration */
+  BSEC_LoadState();
+
   return;
 err:
   DBG_PRINTF("SEN BSEC    ERR ret:0x%x cond:0x%x Init Failed\n", r, c);
 }
 
-void BSEC_Read(void) {
+/* NAME
+ *        BSEC_Start - Consult BSEC, start a BME680 measurement if it asks for one
+ *
+ * RETURN VALUE
+ *        Whether a measurement is pending, BSEC_Complete finishes it.
+ */
+bool BSEC_Start(void) {
   /* BSEC sensor settings struct */
-  bsec_bme_settings_t settings;
-
-  /* BME680 Physical Sensors  */
-  bsec_input_t inputs[BSEC_MAX_PHYSICAL_SENSOR];
-  uint8_t inputs_n;
-
-  /* BSEC Virtual Sensors */
-  bsec_output_t outputs[BSEC_NUMBER_OUTPUTS];
-  uint8_t outputs_n;
-
-  /* Timing */
-  uint16_t measure_period;
-  int64_t timestamp = HW_RTCGetNsTime();
-
-  /* Debug Information */
-  unsigned outputs_i = 0, inputs_i = 0;
+  bsec_bme_settings_t *settings = &bme680.bsec.settings;
+  int64_t timestamp = bme680.bsec.timestamp = HW_RTCGetNsTime();
   int r;
 
   // Ask BSEC:
   // 1. How to configure BME680.
   // 2. Should we do a measurement right now.
   // 3. When to consult BSEC again.
-  if((r = bsec_sensor_control(timestamp, &settings))) {
+  if((r = bsec_sensor_control(timestamp, settings))) {
     DBG_PRINTF("BSEC ERR sensor_control ret:%d\n", r);
   }
   DBG_PRINTF("BSEC   %10u sensor_control ts:%10d.%09u next_call:%10d.%09u do_meas:%x do_gas:%x do:%x ht:%u C hd:%u ms p:%x t:%x h:%x\n",
       HAL_GetTick(),
       (int32_t)(timestamp / 1000 / 1000 / 1000), (uint32_t)(timestamp % (1000 * 1000 * 1000)),
-      (int32_t)(settings.next_call / 1000 / 1000 / 1000), (uint32_t)(settings.next_call % (1000 * 1000 * 1000)),
-      settings.trigger_measurement,
-      settings.run_gas,
-      settings.process_data,
-      settings.heater_temperature,
-      settings.heating_duration,
-      settings.pressure_oversampling,
-      settings.temperature_oversampling,
-      settings.humidity_oversampling
+      (int32_t)(settings->next_call / 1000 / 1000 / 1000), (uint32_t)(settings->next_call % (1000 * 1000 * 1000)),
+      settings->trigger_measurement,
+      settings->run_gas,
+      settings->process_data,
+      settings->heater_temperature,
+      settings->heating_duration,
+      settings->pressure_oversampling,
+      settings->temperature_oversampling,
+      settings->humidity_oversampling
   );
-  bme680.bsec.next_call = settings.next_call;
+  bme680.bsec.next_call = settings->next_call;
 
   // Measure BME680 Now (if BSEC asked)
-  if(settings.trigger_measurement) {
-    /*
-     * Measure physical sensors
-     */
-    // Configure BME680
-    bme680.dev.tph_sett.os_hum     = settings.humidity_oversampling;
-    bme680.dev.tph_sett.os_pres    = settings.pressure_oversampling;
-    bme680.dev.tph_sett.os_temp    = settings.temperature_oversampling;
-    bme680.dev.gas_sett.run_gas    = settings.run_gas;
-    bme680.dev.gas_sett.heatr_temp = settings.heater_temperature; /* degree Celsius */
-    bme680.dev.gas_sett.heatr_dur  = settings.heating_duration; /* milliseconds */
-    bme680.dev.power_mode = BME680_FORCED_MODE;
-
-    if(bme680_set_sensor_settings(BME680_OST_SEL | BME680_OSP_SEL | BME680_OSH_SEL | BME680_GAS_SENSOR_SEL, &bme680.dev)) {
-      DBG_PRINTF("BSEC ERR set_sensor_settings\n");
-    }
-    DBG_PRINTF("BME680 %10u set_sensor_settings\n", HAL_GetTick());
+  if(!settings->trigger_measurement)
+    return false;
 
-    // Begin BME680 Measurement
-    if(bme680_set_sensor_mode(&bme680.dev)) {
-      DBG_PRINTF("BSEC ERR set_sensor_mode\n");
-    }
-    DBG_PRINTF("BME680 %10u set_sensor_mode\n", HAL_GetTick());
+  /*
+   * Measure physical sensors
+   */
+  // Configure BME680
+  bme680.dev.tph_sett.os_hum     = settings->humidity_oversampling;
+  bme680.dev.tph_sett.os_pres    = settings->pressure_oversampling;
+  bme680.dev.tph_sett.os_temp    = settings->temperature_oversampling;
+  bme680.dev.gas_sett.run_gas    = settings->run_gas;
+  bme680.dev.gas_sett.heatr_temp = settings->heater_temperature; /* degree Celsius */
+  bme680.dev.gas_sett.heatr_dur  = settings->heating_duration; /* milliseconds */
+
+  if(bme680_set_sensor_settings(BME680_OST_SEL | BME680_OSP_SEL | BME680_OSH_SEL | BME680_GAS_SENSOR_SEL, &bme680.dev)) {
+    DBG_PRINTF("BSEC ERR set_sensor_settings\n");
+  }
+  DBG_PRINTF("BME680 %10u set_sensor_settings\n", HAL_GetTick());
 
-    // Wait BME680 Measurement to finish
-    bme680_get_profile_dur(&measure_period, &bme680.dev);
-    DBG_PRINTF("BME680 %10u get_profile_dur %10u\n", HAL_GetTick(), measure_period);
-    HAL_Delay(measure_period);
+  // Begin BME680 Measurement
+  if(BME680_Trigger()) {
+    DBG_PRINTF("BSEC ERR set_sensor_mode\n");
+    return false;
+  }
+  DBG_PRINTF("BME680 %10u set_sensor_mode due:%10u\n", HAL_GetTick(), bme680.due);
+  return true;
+}
 
-    // Poll BME680 Measurement to finish
-    while(bme680.dev.power_mode == BME680_FORCED_MODE) {
-      HAL_Delay(5);
-      if(bme680_get_sensor_mode(&bme680.dev)) {
-        DBG_PRINTF("BSEC ERR get_sensor_mode %10u\n", HAL_GetTick());
-      }
-    }
-    DBG_PRINTF("BME680 %10u SLEEP_MODE\n", HAL_GetTick());
+/* NAME
+ *        BSEC_Complete - Read the BME680 measurement started by BSEC_Start
+ *
+ * DESCRIPTION
+ *        Stops the MCU until the measurement is due, then feeds the physical
+ *        readings to BSEC and updates bme680.bsec with its virtual sensors.
+ */
+void BSEC_Complete(void) {
+  const bsec_bme_settings_t *settings = &bme680.bsec.settings;
+  const int64_t timestamp = bme680.bsec.timestamp;
 
-    /*
-     * Read physical sensors
-     */
-    inputs_n = 0;
-    if(settings.process_data) {
-      if(bme680_get_sensor_data(&bme680.data, &bme680.dev)) {
-        DBG_PRINTF("BSEC ERR get_sensor_data\n");
+  /* BME680 Physical Sensors  */
+  bsec_input_t inputs[BSEC_MAX_PHYSICAL_SENSOR];
+  uint8_t inputs_n;
+
+  /* BSEC Virtual Sensors */
+  bsec_output_t outputs[BSEC_NUMBER_OUTPUTS];
+  uint8_t outputs_n;
+
+  /* Debug Information */
+  unsigned outputs_i = 0, inputs_i = 0;
+
+  if(!bme680.pending)
+    return;
+
+  // Stop mode till BME680 Measurement is due
+  if(BME680_Await()) {
+    DBG_PRINTF("BSEC ERR get_sensor_mode %10u\n", HAL_GetTick());
+  }
+  DBG_PRINTF("BME680 %10u SLEEP_MODE\n", HAL_GetTick());
+
+  /*
+   * Read physical sensors
+   */
+  inputs_n = 0;
+  if(settings->process_data) {
+    if(bme680_get_sensor_data(&bme680.data, &bme680.dev)) {
+      DBG_PRINTF("BSEC ERR get_sensor_data\n");
+    }
+    DBG_PRINTF("BME680 %10u PHY  %10d", HAL_GetTick(), inputs_i++);
+    if(bme680.data.status & BME680_NEW_DATA_MSK) {
+      if(settings->process_data & BSEC_PROCESS_PRESSURE) {
+        inputs[inputs_n].sensor_id = BSEC_INPUT_PRESSURE;
+        inputs[inputs_n].signal = bme680.data.pressure;
+        inputs[inputs_n].time_stamp = timestamp;
+        inputs_n++;
+        DBG_PRINTF(" p:%3d", bme680.data.pressure);
       }
-      DBG_PRINTF("BME680 %10u PHY  %10d", HAL_GetTick(), inputs_i++);
-      if(bme680.data.status & BME680_NEW_DATA_MSK) {
-        if(settings.process_data & BSEC_PROCESS_PRESSURE) {
-          inputs[inputs_n].sensor_id = BSEC_INPUT_PRESSURE;
-          inputs[inputs_n].signal = bme680.data.pressure;
-          inputs[inputs_n].time_stamp = timestamp;
-          inputs_n++;
-          DBG_PRINTF(" p:%3d", bme680.data.pressure);
-        }
-        if(settings.process_data & BSEC_PROCESS_TEMPERATURE) {
-          inputs[inputs_n].sensor_id = BSEC_INPUT_TEMPERATURE;
-          inputs[inputs_n].signal = bme680.data.temperature / 100.0f;
-          inputs[inputs_n].time_stamp = timestamp;
-          inputs_n++;
-          DBG_PRINTF(" t:%3d", bme680.data.temperature);
-        }
-        if(settings.process_data & BSEC_PROCESS_HUMIDITY) {
-          inputs[inputs_n].sensor_id = BSEC_INPUT_HUMIDITY;
-          inputs[inputs_n].signal = bme680.data.humidity / 1000.0f;
-          inputs[inputs_n].time_stamp = timestamp;
-          inputs_n++;
-          DBG_PRINTF(" h:%3d", bme680.data.humidity);
-        }
-        if(settings.process_data & BSEC_PROCESS_GAS && bme680.data.status & BME680_GASM_VALID_MSK) {
-          inputs[inputs_n].sensor_id = BSEC_INPUT_GASRESISTOR;
-          inputs[inputs_n].signal = bme680.data.gas_resistance;
-          inputs[inputs_n].time_stamp = timestamp;
-          inputs_n++;
-          DBG_PRINTF(" g:%3d", (int)bme680.data.gas_resistance);
-        }
+      if(settings->process_data & BSEC_PROCESS_TEMPERATURE) {
+        inputs[inputs_n].sensor_id = BSEC_INPUT_TEMPERATURE;
+        inputs[inputs_n].signal = bme680.data.temperature / 100.0f;
+        inputs[inputs_n].time_stamp = timestamp;
+        inputs_n++;
+        DBG_PRINTF(" t:%3d", bme680.data.temperature);
+      }
+      if(settings->process_data & BSEC_PROCESS_HUMIDITY) {
+        inputs[inputs_n].sensor_id = BSEC_INPUT_HUMIDITY;
+        inputs[inputs_n].signal = bme680.data.humidity / 1000.0f;
+        inputs[inputs_n].time_stamp = timestamp;
+        inputs_n++;
+        DBG_PRINTF(" h:%3d", bme680.data.humidity);
+      }
+      if(settings->process_data & BSEC_PROCESS_GAS && bme680.data.status & BME680_GASM_VALID_MSK) {
+        inputs[inputs_n].sensor_id = BSEC_INPUT_GASRESISTOR;
+        inputs[inputs_n].signal = bme680.data.gas_resistance;
+        inputs[inputs_n].time_stamp = timestamp;
+        inputs_n++;
+        DBG_PRINTF(" g:%3d", (int)bme680.data.gas_resistance);
       }
-      DEBUG_MSG("\n");
-
     }
+    DEBUG_MSG("\n");
+
+  }
 
-    /*
-     * Read virtual sensors
+  /*
+   * Read virtual sensors
+   */
+  if(inputs_n) {
+    /* Perform processing of the data by BSEC
+     * Note:
+     * - The number of outputs you get depends on what you asked for during bsec_update_subscription(). This is
+     *   handled under bme680_bsec_update_subscription() function in this example file.
+     * - The number of actual outputs that are returned is written to num_bsec_outputs.
      */
-    if(inputs_n) {
-      /* Perform processing of the data by BSEC
-       * Note:
-       * - The number of outputs you get depends on what you asked for during bsec_update_subscription(). This is
-       *   handled under bme680_bsec_update_subscription() function in this example file.
-       * - The number of actual outputs that are returned is written to num_bsec_outputs.
-       */
-      outputs_n = sizeof outputs / sizeof *outputs;
-      bsec_do_steps(inputs, inputs_n, outputs, &outputs_n);
-      DBG_PRINTF("BSEC   %10u VIRT %10d", HAL_GetTick(), outputs_i++);
-      for(int i = 0; i < outputs_n; i++) {
-        switch(outputs[i].sensor_id) {
-        case BSEC_OUTPUT_IAQ:
-          DBG_PRINTF(" iaq:%3d.%03d (%x)", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
-          bme680.bsec.iaq = outputs[i].signal;
-          bme680.bsec.acc = outputs[i].accuracy;
-          break;
-        case BSEC_OUTPUT_STATIC_IAQ:
-          DBG_PRINTF(" siaq:%3d.%03d (%x)", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
-          break;
-        case BSEC_OUTPUT_CO2_EQUIVALENT:
-          DBG_PRINTF(" co2:%4d.%03d (%x)", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
-          bme680.bsec.co2 = outputs[i].signal;
-          break;
-        case BSEC_OUTPUT_BREATH_VOC_EQUIVALENT:
-          DBG_PRINTF(" voc:%3d.%03d (%x)", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
-          bme680.bsec.voc = outputs[i].signal;
-          break;
-        case BSEC_OUTPUT_RAW_TEMPERATURE:
-          DBG_PRINTF(" t:%3d.%02d", (int)outputs[i].signal, (int)(outputs[i].signal * 100) % 100);
-          break;
-        case BSEC_OUTPUT_RAW_PRESSURE:
-          DBG_PRINTF(" p:%6d", (int)outputs[i].signal);
-          break;
-        case BSEC_OUTPUT_RAW_HUMIDITY:
-          DBG_PRINTF(" h:%3d.%03d", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000);
-          break;
-        case BSEC_OUTPUT_RAW_GAS:
-          DBG_PRINTF(" g:%5d", (int)outputs[i].signal);
-          break;
-        case BSEC_OUTPUT_STABILIZATION_STATUS:
-          DBG_PRINTF(" g_st:%x", (int)outputs[i].signal);
-          break;
-        case BSEC_OUTPUT_RUN_IN_STATUS:
-          DBG_PRINTF(" g_ru:%x", (int)outputs[i].signal);
-          break;
-        case BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE:
-          DBG_PRINTF(" t_hc:%3d.%03d ?%x?", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
-          break;
-        case BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY:
-          DBG_PRINTF(" h_hc:%3d.%03d ?%x?", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
-          break;
-        case BSEC_OUTPUT_COMPENSATED_GAS:
-          DBG_PRINTF(" g_c:%3d.%03d ?%x?", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
-          break;
-        case BSEC_OUTPUT_GAS_PERCENTAGE:
-          DBG_PRINTF(" g_p:%3d.%03d ?%x?", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
-          break;
-        }
+    outputs_n = sizeof outputs / sizeof *outputs;
+    bsec_do_steps(inputs, inputs_n, outputs, &outputs_n);
+    DBG_PRINTF("BSEC   %10u VIRT %10d", HAL_GetTick(), outputs_i++);
+    for(int i = 0; i < outputs_n; i++) {
+      switch(outputs[i].sensor_id) {
+      case BSEC_OUTPUT_IAQ:
+        DBG_PRINTF(" iaq:%3d.%03d (%x)", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
+        bme680.bsec.iaq = outputs[i].signal;
+        bme680.bsec.acc = outputs[i].accuracy;
+        break;
+      case BSEC_OUTPUT_STATIC_IAQ:
+        DBG_PRINTF(" siaq:%3d.%03d (%x)", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
+        break;
+      case BSEC_OUTPUT_CO2_EQUIVALENT:
+        DBG_PRINTF(" co2:%4d.%03d (%x)", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
+        bme680.bsec.co2 = outputs[i].signal;
+        break;
+      case BSEC_OUTPUT_BREATH_VOC_EQUIVALENT:
+        DBG_PRINTF(" voc:%3d.%03d (%x)", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
+        bme680.bsec.voc = outputs[i].signal;
+        break;
+      case BSEC_OUTPUT_RAW_TEMPERATURE:
+        DBG_PRINTF(" t:%3d.%02d", (int)outputs[i].signal, (int)(outputs[i].signal * 100) % 100);
+        break;
+      case BSEC_OUTPUT_RAW_PRESSURE:
+        DBG_PRINTF(" p:%6d", (int)outputs[i].signal);
+        break;
+      case BSEC_OUTPUT_RAW_HUMIDITY:
+        DBG_PRINTF(" h:%3d.%03d", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000);
+        break;
+      case BSEC_OUTPUT_RAW_GAS:
+        DBG_PRINTF(" g:%5d", (int)outputs[i].signal);
+        break;
+      case BSEC_OUTPUT_STABILIZATION_STATUS:
+        DBG_PRINTF(" g_st:%x", (int)outputs[i].signal);
+        break;
+      case BSEC_OUTPUT_RUN_IN_STATUS:
+        DBG_PRINTF(" g_ru:%x", (int)outputs[i].signal);
+        break;
+      case BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_TEMPERATURE:
+        DBG_PRINTF(" t_hc:%3d.%03d ?%x?", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
+        break;
+      case BSEC_OUTPUT_SENSOR_HEAT_COMPENSATED_HUMIDITY:
+        DBG_PRINTF(" h_hc:%3d.%03d ?%x?", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
+        break;
+      case BSEC_OUTPUT_COMPENSATED_GAS:
+        DBG_PRINTF(" g_c:%3d.%03d ?%x?", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
+        break;
+      case BSEC_OUTPUT_GAS_PERCENTAGE:
+        DBG_PRINTF(" g_p:%3d.%03d ?%x?", (int)outputs[i].signal, (int)(outputs[i].signal * 1000) % 1000, outputs[i].accuracy);
+        break;
       }
-      DEBUG_MSG("\n");
     }
+    DEBUG_MSG("\n");
+
+#if BSEC_STATE_SAVE_INTERVAL
+    /* Save on schedule, or right away once accuracy improved */
+    if(bme680.bsec.acc && (bme680.bsec.acc > bsecState.acc ||
+        HW_RTCGetSTime() - bsecState.saved >= BSEC_STATE_SAVE_INTERVAL))
+      BSEC_SaveState();
+#endif
   }
 }
 
+void BSEC_Read(void) {
+  if(BSEC_Start())
+    BSEC_Complete();
+}
+
 void BSEC_ForeverTest(void) {
   /* BSEC sensor settings struct */
   bsec_bme_settings_t settings;
@@ -869,28 +1542,59 @@ void BME680_Init(void) {
       BME680_FILTER_SEL |
       BME680_GAS_SENSOR_SEL, &bme680.dev))) {c = 0x2; goto err;};
 
-  /* Apply the power mode */
-  if((r = bme680_set_sensor_mode(&bme680.dev))) {c = 0x3; goto err;};
+  /* Begin first measurement, BME680_Read collects it */
+  if((r = BME680_Trigger())) {c = 0x3; goto err;};
 
   return;
 err:
   DEBUG_PRINTF("SEN BME680  ERR ret:0x%x cond:0x%x Init Failed!\n", r, c);
 }
 
-void BME680_Read(void) {
-  uint16_t measure_period;
+/* NAME
+ *        BME680_Start - Begin a forced mode measurement
+ *
+ * DESCRIPTION
+ *        Returns right away, the MCU is free for other work during the gas
+ *        heater profile. BME680_Complete collects the result.
+ */
+void BME680_Start(void) {
+  int8_t r;
 
-  /* Delay till measurement is ready */
-  bme680_get_profile_dur(&measure_period, &bme680.dev);
-  HAL_Delay(measure_period);
+  if((r = BME680_Trigger()))
+    DEBUG_PRINTF("SEN BME680  ERR ret:0x%x Start Failed!\n", r);
+}
 
-  /* measure */
-  bme680_get_sensor_data(&bme680.data, &bme680.dev);
+/* NAME
+ *        BME680_Complete - Stop mode until the measurement is done, read it
+ *
+ * RETURN VALUE
+ *        BME680_OK with bme680.data updated, BME680_W_NO_NEW_DATA if no
+ *        measurement was started.
+ */
+int8_t BME680_Complete(void) {
+  int8_t r;
+
+  if(!bme680.pending)
+    return BME680_W_NO_NEW_DATA;
+  if((r = BME680_Await()))
+    return r;
+  return bme680_get_sensor_data(&bme680.data, &bme680.dev);
+}
 
-  /* Trigger the next measurement if you would like to read data out continuously */
-  if (bme680.dev.power_mode == BME680_FORCED_MODE) {
-    bme680_set_sensor_mode(&bme680.dev);
-  }
+/* NAME
+ *        BME680_Read - Collect the pending measurement, start the next one
+ *
+ * DESCRIPTION
+ *        The next read usually finds its measurement done already.
+ */
+void BME680_Read(void) {
+  if(!bme680.pending)
+    BME680_Start();
+
+  BME680_Complete();
+
+  /* Trigger the next measurement to read data out continuously */
+  BME680_Start();
 }
 
 /**
@@ -956,38 +1660,141 @@ void BME680_ReadOld(void) {
 
 #ifdef HDC2080
 struct HDC2080_Handle hdc2080;
-void HDC2080_Init(enum HDC2080_Threshold type, int32_t thres) {
+static void HDC2080_Parse(const uint8_t *buf);
+
+/* MEASURE: MEAS_TRIG self-clears, trigger anew on every configuration */
+static const uint8_t hdc2080_nocache[REGSHADOW_BITMAP(HDC2080_INT_ENABLE, HDC2080_MEASURE)] = {0x00, 0x01};
+REGSHADOW(hdc2080_regs, HDC2080_I2C_ADDR, HDC2080_INT_ENABLE, HDC2080_MEASURE, hdc2080_nocache);
+
+/* NAME
+ *        HDC2080_Arm - Threshold registers for a window's current state
+ *
+ * DESCRIPTION
+ *        Within the window TH/TL sit on the enabled thresholds. Once outside,
+ *        the exceeded one is disabled and the other side waits for the value
+ *        to come back by hyst. TL doubles as the minimum detector: the IC
+ *        only tracks maximums, so TL never rests below the running min and
+ *        a falling value fires on each new one.
+ *
+ *        Returns the TL (bit 0) and TH (bit 1) enables.
+ */
+static uint8_t HDC2080_Arm(const struct HDC2080_Window *w, uint8_t *tl, uint8_t *th) {
+  int32_t l = 0, h = 0xff;
+
+  if(w->state > 0) {
+    l = w->upper - w->hyst;
+  } else if(w->state < 0) {
+    h = w->lower + w->hyst;
+  } else {
+    if(w->windows & 0x2)
+      h = w->upper;
+    if(w->windows & 0x1)
+      l = w->lower;
+  }
+  l = l > w->min ? l : w->min;
+  h = h > 0xff ? 0xff : h;
+  *tl = l;
+  *th = h;
+  return (l > 0 ? 0x1 : 0) | (h < 0xff ? 0x2 : 0);
+}
+
+/* NAME
+ *        HDC2080_State - Next window state of a raw 8-bit sample
+ */
+static int8_t HDC2080_State(const struct HDC2080_Window *w, uint8_t v) {
+  int8_t s = w->state;
+
+  if(s > 0 && (!(w->windows & 0x2) || v + w->hyst < w->upper))
+    s = 0;
+  if(s < 0 && (!(w->windows & 0x1) || v > w->lower + w->hyst))
+    s = 0;
+  if(s == 0 && w->windows & 0x2 && v > w->upper)
+    s = 1;
+  if(s == 0 && w->windows & 0x1 && v < w->lower)
+    s = -1;
+  return s;
+}
+
+/* NAME
+ *        HDC2080_Rearm - Stage INT_ENABLE and TEMP_TL..HUMID_TH into hdc2080_regs
+ */
+static void HDC2080_Rearm(void) {
+  uint8_t buf[4], en, e = 0x00;
+
+  if(hdc2080.armed) {
+    en = HDC2080_Arm(&hdc2080.temp_win, &buf[0], &buf[1]);
+    e |= (en & 0x1 ? 0x20 : 0) | (en & 0x2 ? 0x40 : 0);
+    en = HDC2080_Arm(&hdc2080.humid_win, &buf[2], &buf[3]);
+    e |= (en & 0x1 ? 0x08 : 0) | (en & 0x2 ? 0x10 : 0);
+  } else {
+    buf[0] = buf[2] = 0x00;
+    buf[1] = buf[3] = 0xff;
+  }
+  RegShadow_Set(&hdc2080_regs, HDC2080_INT_ENABLE, &e, 1);
+  RegShadow_Set(&hdc2080_regs, HDC2080_TEMP_TL, buf, 4);
+}
+
+/* NAME
+ *        HDC2080_Init - Configure HDC2080 threshold windows and auto mode rate
+ *
+ * DESCRIPTION
+ *        thres is indexed by enum HDC2080_Threshold, only the entries with
+ *        their HDC2080_WINDOW bit set in windows are used. Temperature in
+ *        centi-Celsius, humidity in %rH. config holds HDC2080_CONFIG_* fields.
+ *
+ *        Both upper and lower thresholds of either quantity may be active,
+ *        each crossing out of a window sends a LoRa message once, until the
+ *        value returns by the hysteresis.
+ *
+ *    Reconfiguration
+ *        Soft reset only on first configuration, after that only registers
+ *        that differ from hdc2080_regs are written, in one burst.
+ *
+ * NOTES
+ *        Interrupt is level sensitive, active high, held until STATUS is
+ *        read. EXTI catches its rising edge, HDC2080_Process reads it out.
+ */
+void HDC2080_Init(const int32_t thres[4], uint8_t windows, uint32_t config) {
   int32_t r, c;
-  uint8_t buf[6];
+  uint8_t buf[2], rate;
 
   /* Turn off Interrupt handler */
   CLEAR_BIT(EXTI->IMR, TEMP_Int_Pin);
 
   // HDC2080_CONFIG: reset peripheral
-  *buf = 0x80;
-  r = HAL_I2C_Mem_Write(&hi2c1, HDC2080_I2C_ADDR, HDC2080_CONFIG, I2C_MEMADD_SIZE_8BIT, buf, 1, 50);
-  HAL_Delay(1);
+  if(!RegShadow_Known(&hdc2080_regs)) {
+    *buf = 0x80;
+    r = I2C_MemWrite(HDC2080_I2C_ADDR, HDC2080_CONFIG, I2C_MEMADD_SIZE_8BIT, buf, 1, 50);
+    HAL_Delay(1);
+  }
 
-  // HDC2080_INT_ENABLE: enable specific threshold interrupt
-  *buf =
-    type == HDC2080_TEMPERATURE_LOW  ? 0x20 :
-    type == HDC2080_TEMPERATURE_HIGH ? 0x40 :
-    type == HDC2080_HUMIDITY_LOW  ? 0x80 :
-    type == HDC2080_HUMIDITY_HIGH ? 0x10 : 0x10;
-  if((r = HAL_I2C_Mem_Write(&hi2c1, HDC2080_I2C_ADDR, HDC2080_INT_ENABLE, I2C_MEMADD_SIZE_8BIT, buf, 1, 50))) {c = 0x2; goto err;};
+  /* Windows in threshold register representation */
+  hdc2080.armed = windows || config;
+  hdc2080.temp_win.windows = windows >> HDC2080_TEMPERATURE_LOW & 0x3;
+  hdc2080.humid_win.windows = windows >> HDC2080_HUMIDITY_LOW & 0x3;
+  for(size_t i = 0; i < 4; i++) {
+    int32_t v = i < HDC2080_HUMIDITY_LOW ? (thres[i] + 4000) * 256 / 16500 : thres[i] * 256 / 100;
+    v = v < 0 ? 0 : v > 0xff ? 0xff : v;
+    *(i == HDC2080_TEMPERATURE_LOW  ? &hdc2080.temp_win.lower  :
+      i == HDC2080_TEMPERATURE_HIGH ? &hdc2080.temp_win.upper  :
+      i == HDC2080_HUMIDITY_LOW     ? &hdc2080.humid_win.lower : &hdc2080.humid_win.upper) = v;
+  }
+  hdc2080.temp_win.hyst = (((config & HDC2080_CONFIG_HYST_T) >> 8) * 10 * 256 + 16499) / 16500;
+  hdc2080.humid_win.hyst = (((config & HDC2080_CONFIG_HYST_H) >> 16) * 256 + 999) / 1000;
+  hdc2080.temp_win.state = hdc2080.humid_win.state = 0;
+  hdc2080.temp_win.min = hdc2080.humid_win.min = 0xff;
 
-  // HDC2080_*_TL: Configure specific threshold
-  buf[0] = type != HDC2080_TEMPERATURE_LOW  ? 0x00 : (thres + 4000) * 256 / 16500;
-  buf[1] = type != HDC2080_TEMPERATURE_HIGH ? 0xff : (thres + 4000) * 256 / 16500;
-  buf[2] = type != HDC2080_HUMIDITY_LOW     ? 0x00 : thres * 256 / 100;
-  buf[3] = type != HDC2080_HUMIDITY_HIGH    ? 0xff : thres * 256 / 100;
+  HDC2080_Rearm();
 
-  // HDC2080_CONFIG: 1Hz Auto measure mode, Enable interrupt (non-latched; high active level)
-  buf[4] = 0x01 | 0x02 | 0x04 | 0x50;
+  // HDC2080_CONFIG: Auto measure mode, Enable interrupt (level sensitive; high active level)
+  rate = config & HDC2080_CONFIG_RATE;
+  buf[0] = (rate ? rate : ONE_HZ) << 4 | 0x02 | (hdc2080.armed ? 0x04 : 0x00);
 
   // HDC2080_MEASURE: Measure humidity and temperature with 9-bit resolution, Start Measurement.
-  buf[5] = 0x80 | 0x20 | 0x01;
-  if((r = HAL_I2C_Mem_Write(&hi2c1, HDC2080_I2C_ADDR, HDC2080_TEMP_TL, I2C_MEMADD_SIZE_8BIT, buf, 6, 50))) {c = 0x3; goto err;};
+  buf[1] = 0x80 | 0x20 | 0x01;
+  RegShadow_Set(&hdc2080_regs, HDC2080_CONFIG, buf, 2);
+
+  if((r = RegShadow_Flush(&hdc2080_regs))) {c = 0x3; goto err;};
 
   goto exit;
 err:
@@ -999,22 +1806,122 @@ exit:
 
 void HDC2080_Read(void) {
   int32_t r;
-  uint8_t buf[5];
-  if(r = HAL_I2C_Mem_Read(&hi2c1, HDC2080_I2C_ADDR, HDC2080_TEMP, I2C_MEMADD_SIZE_8BIT, buf, 5, 50), r != HAL_OK) {
+  uint8_t buf[7];
+  if(r = I2C_MemRead(HDC2080_I2C_ADDR, HDC2080_TEMP, I2C_MEMADD_SIZE_8BIT, buf, 7, 50), r != HAL_OK) {
     DEBUG_PRINTF("SEN HDC2080 I2C <RX ERR ret:0x%x\n", r);
     return;
   };
+  HDC2080_Parse(buf);
+}
 
+/* NAME
+ *        HDC2080_Parse - Update globals from TEMP..HUMID_MAX registers
+ *
+ * NOTES
+ *        Right after a peak restart the MAX registers read 0 while TEMP and
+ *        HUMID still hold the previous measurement, which counts towards the
+ *        new window. So max is kept no lower than the sample, nor min > max.
+ */
+static void HDC2080_Parse(const uint8_t *buf) {
   hdc2080.raw_temp = buf[1] << 8 | buf[0];
   hdc2080.raw_humid = buf[3] << 8 | buf[2];
   hdc2080.fix_temp = hdc2080.raw_temp * 165 * 100 / 65536 - 4000;
   hdc2080.humid = hdc2080.raw_humid * 100 / 65536;
+  hdc2080.fix_humid = hdc2080.raw_humid * 100000 / 65536;
   hdc2080.status = buf[4];
+  hdc2080.temp_win.max = buf[5] > buf[1] ? buf[5] : buf[1];
+  hdc2080.humid_win.max = buf[6] > buf[3] ? buf[6] : buf[3];
+  if(buf[1] < hdc2080.temp_win.min)
+    hdc2080.temp_win.min = buf[1];
+  if(buf[3] < hdc2080.humid_win.min)
+    hdc2080.humid_win.min = buf[3];
+}
+
+/* NAME
+ *        HDC2080_Interrupt - TEMP_Int edge, from EXTI callback
+ */
+void HDC2080_Interrupt(void) {
+  if(hdc2080.armed)
+    hdc2080.irq = true;
+}
+
+/* NAME
+ *        HDC2080_Process - Window transitions and peak restart, in thread mode
+ *
+ * DESCRIPTION
+ *        Reading STATUS releases the INT pin. Entering an excursion sends the
+ *        matching LoRa trigger, then thresholds are moved to the new state.
+ */
+void HDC2080_Process(void) {
+  uint8_t buf[7];
+  int8_t s;
+  int32_t r;
+
+  if(!hdc2080.irq)
+    return;
+  hdc2080.irq = false;
+
+  if((r = I2C_MemRead(HDC2080_I2C_ADDR, HDC2080_TEMP, I2C_MEMADD_SIZE_8BIT, buf, 7, 50))) {
+    DEBUG_PRINTF("SEN HDC2080 I2C <RX ERR ret:0x%x\n", r);
+    return;
+  }
+  HDC2080_Parse(buf);
+
+  if(s = HDC2080_State(&hdc2080.temp_win, buf[1]), s != hdc2080.temp_win.state) {
+    hdc2080.temp_win.state = s;
+    if(s)
+      enqueueToSend(EVENT, s > 0 ? LRW_B0_TRIGGER_TEMPERATURE_HIGH : LRW_B0_TRIGGER_TEMPERATURE_LOW);
+  }
+  if(s = HDC2080_State(&hdc2080.humid_win, buf[3]), s != hdc2080.humid_win.state) {
+    hdc2080.humid_win.state = s;
+    if(s)
+      enqueueToSend(EVENT, s > 0 ? LRW_B0_TRIGGER_HUMIDITY_HIGH : LRW_B0_TRIGGER_HUMIDITY_LOW);
+  }
+  DEBUG_PRINTF("SEN HDC2080 IRQ status:0x%02x T:%d..%d (%d) H:%d..%d (%d)\n", hdc2080.status,
+    hdc2080.temp_win.min, hdc2080.temp_win.max, hdc2080.temp_win.state, hdc2080.humid_win.min, hdc2080.humid_win.max, hdc2080.humid_win.state);
+
+  HDC2080_Rearm();
+  if((r = RegShadow_Flush(&hdc2080_regs)))
+    DEBUG_PRINTF("SEN HDC2080 ERR ret:0x%x Rearm Failed\n", r);
+}
+
+/* NAME
+ *        HDC2080_Extremes - Take extremes since last call and restart them
+ *
+ * DESCRIPTION
+ *        For the scheduled message, in thread mode. The registers are read
+ *        right before, so peaks since the last interrupt aren't lost, and the
+ *        IC peak detector is cleared only once they're captured. out holds
+ *        temperature min, max, humidity min, max, raw 8-bit.
+ */
+void HDC2080_Extremes(uint8_t out[4]) {
+  static const uint8_t zero[2] = {0x00, 0x00};
+  uint8_t buf[7];
+  int32_t r;
+
+  if((r = I2C_MemRead(HDC2080_I2C_ADDR, HDC2080_TEMP, I2C_MEMADD_SIZE_8BIT, buf, 7, 50)))
+    DEBUG_PRINTF("SEN HDC2080 I2C <RX ERR ret:0x%x\n", r);
+  else
+    HDC2080_Parse(buf);
+
+  out[0] = hdc2080.temp_win.min;
+  out[1] = hdc2080.temp_win.max;
+  out[2] = hdc2080.humid_win.min;
+  out[3] = hdc2080.humid_win.max;
+
+  if((r = I2C_MemWrite(HDC2080_I2C_ADDR, HDC2080_TEMP_MAX, I2C_MEMADD_SIZE_8BIT, zero, 2, 50)))
+    DEBUG_PRINTF("SEN HDC2080 I2C >TX ERR ret:0x%x\n", r);
+  hdc2080.temp_win.min = hdc2080.humid_win.min = 0xff;
+  hdc2080.temp_win.max = hdc2080.humid_win.max = 0;
+
+  /* Rearm TL on the restarted minimum */
+  hdc2080.irq = hdc2080.armed;
 }
 
 void HDC2080_Reset(void) {
   uint8_t val = 0x80;
-  if(HAL_OK != HAL_I2C_Mem_Write(&hi2c1, HDC2080_I2C_ADDR, HDC2080_CONFIG, I2C_MEMADD_SIZE_8BIT, &val, 1, 100))
+  RegShadow_Invalidate(&hdc2080_regs);
+  if(HAL_OK != I2C_MemWrite(HDC2080_I2C_ADDR, HDC2080_CONFIG, I2C_MEMADD_SIZE_8BIT, &val, 1, 100))
     DEBUG_MSG("SEN HDC2080 Reset Failed!\n");
   HAL_Delay(1);
 }
@@ -1039,3 +1946,270 @@ void HDC2080_ForeverTest(void) {
 }
 #endif
 
+
+/*
+ * Sensor registry
+ * ---------------
+ * HDC2080 (auto mode) and SFH7776 (400 ms ALS cycle) convert on their
+ * own, start just queues the result registers on I2C1. BMA400 driver
+ * transfers queue behind them. BME680 converts on demand, its heater profile
+ * overlaps all of the above.
+ */
+#ifdef HDC2080
+static uint8_t hdc2080_buf[7];
+static struct I2C_Xfer hdc2080_xfer = I2C_XFER_READ(HDC2080_I2C_ADDR, HDC2080_TEMP, I2C_MEMADD_SIZE_8BIT, hdc2080_buf, sizeof hdc2080_buf);
+
+static void HDC2080_Submit(void) {
+  I2C_Submit(&hdc2080_xfer);
+}
+
+static void HDC2080_Collect(void) {
+  if(I2C_Wait(&hdc2080_xfer, 50) == HAL_OK)
+    HDC2080_Parse(hdc2080_buf);
+  else
+    DEBUG_PRINTF("SEN HDC2080 I2C <RX ERR ret:0x%x\n", hdc2080_xfer.status);
+}
+
+static const struct SensorChannel hdc2080_channels[] = {
+  {PBSMSG_TX_SENSOR_TEMPERATURE, SENSOR_FMT_S16, &hdc2080.fix_temp},
+  {PBSMSG_TX_SENSOR_HUMIDITY,    SENSOR_FMT_U32, &hdc2080.fix_humid},
+};
+
+static const struct Sensor hdc2080_sensor = {
+  .name = "HDC2080",
+  .addr = HDC2080_I2C_ADDR,
+  .start = HDC2080_Submit,
+  .read = HDC2080_Collect,
+  .max_age = SENSORS_MAX_AGE,
+  .channels = hdc2080_channels,
+  .channels_n = sizeof hdc2080_channels / sizeof *hdc2080_channels,
+};
+#endif
+
+#ifdef SFH7776
+static uint8_t sfh7776_buf[4];
+static struct I2C_Xfer sfh7776_xfer = I2C_XFER_READ(0x72, SFH7776_ALS_VIS_DATA_LSB, I2C_MEMADD_SIZE_8BIT, sfh7776_buf, sizeof sfh7776_buf);
+
+static void SFH7776_Submit(void) {
+  I2C_Submit(&sfh7776_xfer);
+}
+
+static void SFH7776_Collect(void) {
+  if(I2C_Wait(&sfh7776_xfer, 100) == HAL_OK)
+    SFH7776_Parse(sfh7776_buf);
+  else
+    DEBUG_PRINTF("SEN SFH7776 I2C <RX ERR ret:0x%x\n", sfh7776_xfer.status);
+}
+
+static const struct SensorChannel sfh7776_channels[] = {
+  {PBSMSG_TX_SENSOR_LUMINANCE, SENSOR_FMT_U16, &sfh7776.lux},
+};
+
+static const struct Sensor sfh7776_sensor = {
+  .name = "SFH7776",
+  .addr = 0x72,
+  .start = SFH7776_Submit,
+  .read = SFH7776_Collect,
+  .max_age = SENSORS_MAX_AGE,
+  .channels = sfh7776_channels,
+  .channels_n = sizeof sfh7776_channels / sizeof *sfh7776_channels,
+};
+#endif
+
+#ifdef BMA400
+static const struct SensorChannel bma400_channels[] = {
+  {PBSMSG_TX_SENSOR_X_AXIS,   SENSOR_FMT_S16, &bma400.fix_x},
+  {PBSMSG_TX_SENSOR_Y_AXIS,   SENSOR_FMT_S16, &bma400.fix_y},
+  {PBSMSG_TX_SENSOR_Z_AXIS,   SENSOR_FMT_S16, &bma400.fix_z},
+  {PBSMSG_TX_SENSOR_STEPS,    SENSOR_FMT_U32, &bma400.steps},
+  {PBSMSG_TX_SENSOR_ACTIVITY, SENSOR_FMT_U8,  &bma400.activity},
+};
+
+static const struct Sensor bma400_sensor = {
+  .name = "BMA400",
+  .addr = BMA400_I2C_ADDRESS_SDO_LOW << 1,
+  .read = BMA400_Read,
+  .max_age = SENSORS_MAX_AGE,
+  .channels = bma400_channels,
+  .channels_n = sizeof bma400_channels / sizeof *bma400_channels,
+};
+#endif
+
+#ifdef BME680
+#ifndef BSEC
+static uint32_t BME680_Ready(void) {
+  return bme680.due;
+}
+
+static void BME680_Collect(void) {
+  int8_t r;
+
+  if((r = BME680_Complete()))
+    DEBUG_PRINTF("SEN BME680  ERR ret:0x%x Read Failed!\n", r);
+}
+#endif
+
+static const struct SensorChannel bme680_channels[] = {
+  {PBSMSG_TX_SENSOR_TEMPERATURE,  SENSOR_FMT_S16,   &bme680.data.temperature},
+  {PBSMSG_TX_SENSOR_HUMIDITY,     SENSOR_FMT_U32,   &bme680.data.humidity},
+  {PBSMSG_TX_SENSOR_PRESSURE,     SENSOR_FMT_U32,   &bme680.data.pressure},
+#ifdef BSEC
+  {PBSMSG_TX_SENSOR_AIR_QUALITY,  SENSOR_FMT_FLOAT, &bme680.bsec.iaq},
+  {PBSMSG_TX_SENSOR_AIR_VOC_PPM,  SENSOR_FMT_FLOAT, &bme680.bsec.voc},
+  {PBSMSG_TX_SENSOR_AIR_CO2_PPM,  SENSOR_FMT_FLOAT, &bme680.bsec.co2},
+  {PBSMSG_TX_SENSOR_AIR_ACCURACY, SENSOR_FMT_U32,   &bme680.bsec.acc},
+#endif
+};
+
+/* BSEC samples on its own schedule, see BSEC_Read */
+static const struct Sensor bme680_sensor = {
+  .name = "BME680",
+  .addr = BME680_I2C_ADDR_PRIMARY << 1,
+#ifndef BSEC
+  .start = BME680_Start,
+  .ready = BME680_Ready,
+  .read = BME680_Collect,
+  .max_age = SENSORS_MAX_AGE,
+#endif
+  .channels = bme680_channels,
+  .channels_n = sizeof bme680_channels / sizeof *bme680_channels,
+};
+#endif
+
+const struct Sensor *const sensors[] = {
+#ifdef HDC2080
+  &hdc2080_sensor,
+#endif
+#ifdef SFH7776
+  &sfh7776_sensor,
+#endif
+#ifdef BMA400
+  &bma400_sensor,
+#endif
+#ifdef BME680
+  &bme680_sensor,
+#endif
+  NULL,
+};
+
+#define SENSORS_N  (sizeof sensors / sizeof *sensors - 1)
+
+/* Latest-sample cache state */
+static struct {
+  uint32_t ts[SENSORS_N + 1];  /* HW_RTCGetMsTime of last sample */
+  uint32_t valid;              /* Sensors sampled at least once */
+  volatile bool requested;     /* Stale sensors to resample in main ctx */
+} sensorCache;
+
+/* NAME
+ *        Sensors_Sample - Sample given sensors, conversions overlapped
+ *
+ * DESCRIPTION
+ *        Starts every sensor, then collects them in order of readiness. The
+ *        MCU stops until the next one is ready, and sleeps through the I2C
+ *        transfers.
+ *
+ * SEE ALSO
+ *        I2C_Submit, HW_StopUntil
+ */
+static void Sensors_Sample(uint32_t mask) {
+  uint32_t pending = 0;
+
+  static_assert(SENSORS_N <= 32, "Sensor registry exceeds pending mask.");
+
+  for(unsigned i = 0; sensors[i]; i++) {
+    if(!(mask & 1U << i) || !sensors[i]->read || !I2C_Present(sensors[i]->addr))
+      continue;
+    if(sensors[i]->start)
+      sensors[i]->start();
+    pending |= 1U << i;
+  }
+
+  while(pending) {
+    const uint32_t now = HW_RTCGetMsTime();
+    uint32_t due = 0;
+    unsigned next = 0;
+    bool found = false;
+
+    for(unsigned i = 0; sensors[i]; i++) {
+      uint32_t ready;
+      if(!(pending & 1U << i))
+        continue;
+      ready = sensors[i]->ready ? sensors[i]->ready() : now;
+      if(!found || (int32_t)(ready - due) < 0)
+        due = ready, next = i, found = true;
+    }
+
+    HW_StopUntil(due);
+    sensors[next]->read();
+    pending &= ~(1U << next);
+    sensorCache.ts[next] = HW_RTCGetMsTime();
+    sensorCache.valid |= 1U << next;
+  }
+}
+
+/* NAME
+ *        Sensors_Stale - Mask of sensors whose cached sample is too old
+ */
+static uint32_t Sensors_Stale(void) {
+  const uint32_t now = HW_RTCGetMsTime();
+  uint32_t mask = 0;
+
+  for(unsigned i = 0; sensors[i]; i++) {
+    if(!sensors[i]->read || !I2C_Present(sensors[i]->addr))
+      continue;
+    if(~sensorCache.valid & 1U << i || now - sensorCache.ts[i] > sensors[i]->max_age)
+      mask |= 1U << i;
+  }
+  return mask;
+}
+
+/* NAME
+ *        Sensors_Read - Sample all registered sensors now
+ */
+void Sensors_Read(void) {
+  Sensors_Sample(UINT32_MAX);
+}
+
+/* NAME
+ *        Sensors_Update - Bring cached samples up to date for a consumer
+ *
+ * DESCRIPTION
+ *        In main context stale sensors are resampled right away. Interrupt
+ *        handlers (NFC) get the cache as is, and the resampling
+ *        is deferred to Sensors_Process, keeping drivers out of ISRs and NFC
+ *        responses instant.
+ */
+void Sensors_Update(void) {
+  uint32_t stale = Sensors_Stale();
+
+  if(!stale)
+    return;
+  if(__get_IPSR()) {
+    sensorCache.requested = true;
+    return;
+  }
+  Sensors_Sample(stale);
+}
+
+/* NAME
+ *        Sensors_Process - Resample stale sensors an ISR asked for
+ */
+void Sensors_Process(void) {
+  if(!sensorCache.requested)
+    return;
+  sensorCache.requested = false;
+  Sensors_Sample(Sensors_Stale());
+}
+
+/* NAME
+ *        Sensors_Age - Milliseconds since sensors[i] was sampled
+ *
+ * RETURN VALUE
+ *        UINT32_MAX if it never was.
+ */
+uint32_t Sensors_Age(unsigned i) {
+  if(i >= SENSORS_N || ~sensorCache.valid & 1U << i)
+    return UINT32_MAX;
+  return HW_RTCGetMsTime() - sensorCache.ts[i];
+}
@@ -531,8 +531,10 @@ void RadioInit( RadioEvents_t *events )
     SX126xSetDioIrqParams( IRQ_RADIO_ALL, IRQ_RADIO_ALL, IRQ_RADIO_NONE, IRQ_RADIO_NONE );
 
     // Add registers to the retention list (4 is the maximum possible number)
+    // Warm sleep then keeps the workarounds, next to the retained configuration
     RadioAddRegisterToRetentionList( REG_RX_GAIN );
     RadioAddRegisterToRetentionList( REG_TX_MODULATION );
+    RadioAddRegisterToRetentionList( REG_TX_CLAMP_CFG );
 
     // Initialize driver timeout timers
     TimerInit( &TxTimeoutTimer, RadioOnTxTimeoutIrq );
@@ -73,9 +73,67 @@ static volatile RadioLoRaPacketLengthsMode_t LoRaHeaderType;
 volatile uint32_t FrequencyError = 0;
 
 /*!
- * \brief Hold the status of the Image calibration
+ * \brief Band of the last image calibration, as its two calibration frequency
+ *        bytes, 0 when not calibrated. Warm sleep retains the calibration.
  */
-static bool ImageCalibrated = false;
+static uint16_t ImageCalibratedBand = 0;
+
+/*!
+ * \brief Last parameters sent with a configuration command
+ */
+typedef struct SX126xCommandShadow_s
+{
+    RadioCommands_t Opcode;
+    uint8_t         Size;                           //!< 0 when the radio state is unknown
+    uint8_t         Buffer[9];
+}SX126xCommandShadow_t;
+
+/*!
+ * \brief Configuration commands whose parameters the radio retains across warm
+ *        sleep, so that unchanged ones are not sent again
+ */
+static SX126xCommandShadow_t CommandShadow[] =
+{
+    { .Opcode = RADIO_SET_PACKETTYPE },
+    { .Opcode = RADIO_SET_MODULATIONPARAMS },
+    { .Opcode = RADIO_SET_PACKETPARAMS },
+    { .Opcode = RADIO_CFG_DIOIRQ },
+    { .Opcode = RADIO_SET_PACONFIG },
+    { .Opcode = RADIO_SET_TXPARAMS },
+    { .Opcode = RADIO_SET_RFFREQUENCY },
+};
+
+/*!
+ * \brief Finds the shadow of a configuration command
+ *
+ * \param [in]  command       Opcode
+ *
+ * \returns The CommandShadow entry, NULL if the command isn't shadowed
+ */
+static SX126xCommandShadow_t* SX126xGetCommandShadow( RadioCommands_t command );
+
+/*!
+ * \brief Sends a configuration command, unless its parameters are unchanged
+ *
+ * \param [in]  command       Opcode, one listed in CommandShadow
+ * \param [in]  buffer        Command parameters
+ * \param [in]  size          Size of the parameters
+ */
+static void SX126xWriteCommandShadowed( RadioCommands_t command, uint8_t *buffer, uint16_t size );
+
+/*!
+ * \brief Forgets the radio configuration, after reset or cold sleep
+ */
+static void SX126xInvalidateShadow( void );
+
+/*!
+ * \brief Gets the image calibration band of a frequency
+ *
+ * \param [in] freq           Frequency in Hertz
+ *
+ * \returns The two calibration frequency bytes of RADIO_CALIBRATEIMAGE
+ */
+static uint16_t SX126xGetImageCalibrationBand( uint32_t freq );
 
 /*!
  * \brief Get the number of PLL steps for a given frequency in Hertz
@@ -125,8 +183,8 @@ void SX126xInit( DioIrqHandler dioIrq )
     // Initialize RF switch control
     SX126xIoRfSwitchInit( );
 
-    // Force image calibration
-    ImageCalibrated = false;
+    // Force image calibration and full configuration
+    SX126xInvalidateShadow( );
 
     SX126xSetOperatingMode( MODE_STDBY_RC );
 }
@@ -257,8 +315,8 @@ void SX126xSetSleep( SleepParams_t sleepConfig )
 
     if( sleepConfig.Fields.WarmStart == 0 )
     {
-        // Force image calibration
-        ImageCalibrated = false;
+        // Force image calibration and full configuration
+        SX126xInvalidateShadow( );
     }
     SX126xWriteCommand( RADIO_SET_SLEEP, &value, 1 );
     SX126xSetOperatingMode( MODE_SLEEP );
@@ -402,35 +460,37 @@ void SX126xCalibrate( CalibrationParams_t calibParam )
     SX126xWriteCommand( RADIO_CALIBRATE, &value, 1 );
 }
 
-void SX126xCalibrateImage( uint32_t freq )
+static uint16_t SX126xGetImageCalibrationBand( uint32_t freq )
 {
-    uint8_t calFreq[2];
-
     if( freq > 900000000 )
     {
-        calFreq[0] = 0xE1;
-        calFreq[1] = 0xE9;
+        return 0xE1E9;
     }
     else if( freq > 850000000 )
     {
-        calFreq[0] = 0xD7;
-        calFreq[1] = 0xDB;
+        return 0xD7DB;
     }
     else if( freq > 770000000 )
     {
-        calFreq[0] = 0xC1;
-        calFreq[1] = 0xC5;
+        return 0xC1C5;
     }
     else if( freq > 460000000 )
     {
-        calFreq[0] = 0x75;
-        calFreq[1] = 0x81;
+        return 0x7581;
     }
-    else if( freq > 425000000 )
+    else
     {
-        calFreq[0] = 0x6B;
-        calFreq[1] = 0x6F;
+        return 0x6B6F;
     }
+}
+
+void SX126xCalibrateImage( uint32_t freq )
+{
+    uint16_t band = SX126xGetImageCalibrationBand( freq );
+    uint8_t calFreq[2];
+
+    calFreq[0] = ( uint8_t )( band >> 8 );
+    calFreq[1] = ( uint8_t )( band & 0xFF );
     SX126xWriteCommand( RADIO_CALIBRATEIMAGE, calFreq, 2 );
 }
 
@@ -442,7 +502,7 @@ void SX126xSetPaConfig( uint8_t paDutyCycle, uint8_t hpMax, uint8_t deviceSel, u
     buf[1] = hpMax;
     buf[2] = deviceSel;
     buf[3] = paLut;
-    SX126xWriteCommand( RADIO_SET_PACONFIG, buf, 4 );
+    SX126xWriteCommandShadowed( RADIO_SET_PACONFIG, buf, 4 );
 }
 
 void SX126xSetRxTxFallbackMode( uint8_t fallbackMode )
@@ -462,7 +522,7 @@ void SX126xSetDioIrqParams( uint16_t irqMask, uint16_t dio1Mask, uint16_t dio2Ma
     buf[5] = ( uint8_t )( dio2Mask & 0x00FF );
     buf[6] = ( uint8_t )( ( dio3Mask >> 8 ) & 0x00FF );
     buf[7] = ( uint8_t )( dio3Mask & 0x00FF );
-    SX126xWriteCommand( RADIO_CFG_DIOIRQ, buf, 8 );
+    SX126xWriteCommandShadowed( RADIO_CFG_DIOIRQ, buf, 8 );
 }
 
 uint16_t SX126xGetIrqStatus( void )
@@ -493,11 +553,13 @@ void SX126xSetDio3AsTcxoCtrl( RadioTcxoCtrlVoltage_t tcxoVoltage, uint32_t timeo
 void SX126xSetRfFrequency( uint32_t frequency )
 {
     uint8_t buf[4];
+    uint16_t band = SX126xGetImageCalibrationBand( frequency );
 
-    if( ImageCalibrated == false )
+    // Channel hops within a band keep the calibration
+    if( ImageCalibratedBand != band )
     {
         SX126xCalibrateImage( frequency );
-        ImageCalibrated = true;
+        ImageCalibratedBand = band;
     }
 
     uint32_t freqInPllSteps = SX126xConvertFreqInHzToPllStep( frequency );
@@ -506,14 +568,20 @@ void SX126xSetRfFrequency( uint32_t frequency )
     buf[1] = ( uint8_t )( ( freqInPllSteps >> 16 ) & 0xFF );
     buf[2] = ( uint8_t )( ( freqInPllSteps >> 8 ) & 0xFF );
     buf[3] = ( uint8_t )( freqInPllSteps & 0xFF );
-    SX126xWriteCommand( RADIO_SET_RFFREQUENCY, buf, 4 );
+    SX126xWriteCommandShadowed( RADIO_SET_RFFREQUENCY, buf, 4 );
 }
 
 void SX126xSetPacketType( RadioPacketTypes_t packetType )
 {
     // Save packet type internally to avoid questioning the radio
+    if( PacketType != packetType )
+    {
+        // Modulation and packet parameters belong to the packet type
+        SX126xGetCommandShadow( RADIO_SET_MODULATIONPARAMS )->Size = 0;
+        SX126xGetCommandShadow( RADIO_SET_PACKETPARAMS )->Size = 0;
+    }
     PacketType = packetType;
-    SX126xWriteCommand( RADIO_SET_PACKETTYPE, ( uint8_t* )&packetType, 1 );
+    SX126xWriteCommandShadowed( RADIO_SET_PACKETTYPE, ( uint8_t* )&packetType, 1 );
 }
 
 RadioPacketTypes_t SX126xGetPacketType( void )
@@ -547,7 +615,11 @@ void SX126xSetTxParams( int8_t power, RadioRampTimes_t rampTime )
     else // sx1262
     {
         // WORKAROUND - Better Resistance of the SX1262 Tx to Antenna Mismatch, see DS_SX1261-2_V1.2 datasheet chapter 15.2
-        SX126xWriteRegister( REG_TX_CLAMP_CFG, SX126xReadRegister( REG_TX_CLAMP_CFG ) | ( 0x0F << 1 ) );
+        uint8_t clamp = SX126xReadRegister( REG_TX_CLAMP_CFG );
+        if( ( clamp & ( 0x0F << 1 ) ) != ( 0x0F << 1 ) )
+        {
+            SX126xWriteRegister( REG_TX_CLAMP_CFG, clamp | ( 0x0F << 1 ) );
+        }
         // WORKAROUND END
 
         SX126xSetPaConfig( 0x04, 0x07, 0x00, 0x01 );
@@ -562,7 +634,7 @@ void SX126xSetTxParams( int8_t power, RadioRampTimes_t rampTime )
     }
     buf[0] = power;
     buf[1] = ( uint8_t )rampTime;
-    SX126xWriteCommand( RADIO_SET_TXPARAMS, buf, 2 );
+    SX126xWriteCommandShadowed( RADIO_SET_TXPARAMS, buf, 2 );
 }
 
 void SX126xSetModulationParams( ModulationParams_t *modulationParams )
@@ -592,7 +664,7 @@ void SX126xSetModulationParams( ModulationParams_t *modulationParams )
         buf[5] = ( tempVal >> 16 ) & 0xFF;
         buf[6] = ( tempVal >> 8 ) & 0xFF;
         buf[7] = ( tempVal& 0xFF );
-        SX126xWriteCommand( RADIO_SET_MODULATIONPARAMS, buf, n );
+        SX126xWriteCommandShadowed( RADIO_SET_MODULATIONPARAMS, buf, n );
         break;
     case PACKET_TYPE_LORA:
         n = 4;
@@ -601,7 +673,7 @@ void SX126xSetModulationParams( ModulationParams_t *modulationParams )
         buf[2] = modulationParams->Params.LoRa.CodingRate;
         buf[3] = modulationParams->Params.LoRa.LowDatarateOptimize;
 
-        SX126xWriteCommand( RADIO_SET_MODULATIONPARAMS, buf, n );
+        SX126xWriteCommandShadowed( RADIO_SET_MODULATIONPARAMS, buf, n );
 
         break;
     default:
@@ -666,7 +738,7 @@ void SX126xSetPacketParams( PacketParams_t *packetParams )
     case PACKET_TYPE_NONE:
         return;
     }
-    SX126xWriteCommand( RADIO_SET_PACKETPARAMS, buf, n );
+    SX126xWriteCommandShadowed( RADIO_SET_PACKETPARAMS, buf, n );
 }
 
 void SX126xSetCadParams( RadioLoRaCadSymbols_t cadSymbolNum, uint8_t cadDetPeak, uint8_t cadDetMin, RadioCadExitModes_t cadExitMode, uint32_t cadTimeout )
@@ -799,6 +871,40 @@ void SX126xClearIrqStatus( uint16_t irq )
     SX126xWriteCommand( RADIO_CLR_IRQSTATUS, buf, 2 );
 }
 
+static SX126xCommandShadow_t* SX126xGetCommandShadow( RadioCommands_t command )
+{
+    for( uint8_t i = 0; i < sizeof( CommandShadow ) / sizeof( CommandShadow[0] ); i++ )
+    {
+        if( CommandShadow[i].Opcode == command )
+        {
+            return &CommandShadow[i];
+        }
+    }
+    return NULL;
+}
+
+static void SX126xWriteCommandShadowed( RadioCommands_t command, uint8_t *buffer, uint16_t size )
+{
+    SX126xCommandShadow_t *shadow = SX126xGetCommandShadow( command );
+
+    if( ( shadow->Size == size ) && ( memcmp( shadow->Buffer, buffer, size ) == 0 ) )
+    {
+        return;
+    }
+    shadow->Size = size;
+    memcpy1( shadow->Buffer, buffer, size );
+    SX126xWriteCommand( command, buffer, size );
+}
+
+static void SX126xInvalidateShadow( void )
+{
+    for( uint8_t i = 0; i < sizeof( CommandShadow ) / sizeof( CommandShadow[0] ); i++ )
+    {
+        CommandShadow[i].Size = 0;
+    }
+    ImageCalibratedBand = 0;
+}
+
 static uint32_t SX126xConvertFreqInHzToPllStep( uint32_t freqInHz )
 {
     uint32_t stepsInt;